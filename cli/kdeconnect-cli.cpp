@@ -25,8 +25,12 @@
 #include <QCoreApplication>
 #include <QTextStream>
 #include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
 
 #include <KAboutData>
+#include <KFormat>
 
 #include "interfaces/devicesmodel.h"
 #include "interfaces/notificationsmodel.h"
@@ -54,12 +58,14 @@ int main(int argc, char** argv)
     parser.addOption(QCommandLineOption(QStringLiteral("name-only"), i18n("Make --list-devices or --list-available print only the devices name, to ease scripting")));
     parser.addOption(QCommandLineOption(QStringLiteral("id-name-only"), i18n("Make --list-devices or --list-available print only the devices id and name, to ease scripting")));
     parser.addOption(QCommandLineOption(QStringLiteral("refresh"), i18n("Search for devices in the network and re-establish connections")));
+    parser.addOption(QCommandLineOption(QStringLiteral("list-transfers"), i18n("List the files being sent and waiting to be sent to all devices")));
     parser.addOption(QCommandLineOption(QStringLiteral("pair"), i18n("Request pairing to a said device")));
     parser.addOption(QCommandLineOption(QStringLiteral("ring"), i18n("Find the said device by ringing it.")));
     parser.addOption(QCommandLineOption(QStringLiteral("unpair"), i18n("Stop pairing to a said device")));
     parser.addOption(QCommandLineOption(QStringLiteral("ping"), i18n("Sends a ping to said device")));
     parser.addOption(QCommandLineOption(QStringLiteral("ping-msg"), i18n("Same as ping but you can set the message to display"), i18n("message")));
     parser.addOption(QCommandLineOption(QStringLiteral("share"), i18n("Share a file to a said device"), QStringLiteral("path")));
+    parser.addOption(QCommandLineOption(QStringLiteral("sync"), i18n("With --share, only send what changed in files the device already received")));
     parser.addOption(QCommandLineOption(QStringLiteral("share-text"), i18n("Share text to a said device"), QStringLiteral("text")));
     parser.addOption(QCommandLineOption(QStringLiteral("list-notifications"), i18n("Display the notifications on a said device")));
     parser.addOption(QCommandLineOption(QStringLiteral("lock"), i18n("Lock the specified device")));
@@ -167,6 +173,27 @@ int main(int argc, char** argv)
     } else if(parser.isSet(QStringLiteral("refresh"))) {
         QDBusMessage msg = QDBusMessage::createMethodCall(QStringLiteral("org.kde.kdeconnect"), QStringLiteral("/modules/kdeconnect"), QStringLiteral("org.kde.kdeconnect.daemon"), QStringLiteral("forceOnNetworkChange"));
         blockOnReply(QDBusConnection::sessionBus().asyncCall(msg));
+    } else if(parser.isSet(QStringLiteral("list-transfers"))) {
+        const QJsonArray transfers = QJsonDocument::fromJson(blockOnReply<QString>(iface.transfers()).toUtf8()).array();
+        KFormat format;
+        for (const QJsonValue& value : transfers) {
+            const QJsonObject transfer = value.toObject();
+            const qint64 size = transfer.value(QStringLiteral("size")).toDouble();
+            QString statusInfo;
+            const QString state = transfer.value(QStringLiteral("state")).toString();
+            if (state == QLatin1String("active")) {
+                statusInfo = i18n("(%1 of %2 sent)", format.formatByteSize(transfer.value(QStringLiteral("sent")).toDouble()),
+                                  size >= 0 ? format.formatByteSize(size) : i18n("unknown size"));
+            } else if (state == QLatin1String("stalled")) {
+                statusInfo = i18n("(%1 of %2 sent, stalled)", format.formatByteSize(transfer.value(QStringLiteral("sent")).toDouble()),
+                                  size >= 0 ? format.formatByteSize(size) : i18n("unknown size"));
+            } else {
+                statusInfo = i18n("(queued)");
+            }
+            QTextStream(stdout) << "- " << transfer.value(QStringLiteral("deviceName")).toString()
+                    << ": " << transfer.value(QStringLiteral("name")).toString() << ' ' << statusInfo << endl;
+        }
+        QTextStream(stderr) << i18np("1 transfer", "%1 transfers", transfers.size()) << endl;
     } else {
 
         QString device = parser.value(QStringLiteral("device"));
@@ -196,7 +223,8 @@ int main(int argc, char** argv)
             }
 
             QDBusMessage msg = QDBusMessage::createMethodCall(QStringLiteral("org.kde.kdeconnect"), "/modules/kdeconnect/devices/"+device+"/share", 
-                                                              QStringLiteral("org.kde.kdeconnect.device.share"), QStringLiteral("shareUrls"));
+                                                              QStringLiteral("org.kde.kdeconnect.device.share"),
+                                                              parser.isSet(QStringLiteral("sync")) ? QStringLiteral("syncUrls") : QStringLiteral("shareUrls"));
             
             msg.setArguments(QVariantList() << QVariant(urls));
             blockOnReply(QDBusConnection::sessionBus().asyncCall(msg));
@@ -48,14 +48,25 @@ QString BluetoothDeviceLink::name()
     return "BluetoothLink"; // Should be same in both android and kde version
 }
 
+void BluetoothDeviceLink::setEncoding(NetworkPacket::Encoding encoding)
+{
+    DeviceLink::setEncoding(encoding);
+    mSocketReader->setEncoding(encoding);
+}
+
 bool BluetoothDeviceLink::sendPacket(NetworkPacket& np)
 {
-    if (np.hasPayload()) {
+    if (np.hasPayload() && !np.inlinePayload(encoding(), inlinePayloadSize())) {
         BluetoothUploadJob* uploadJob = new BluetoothUploadJob(np.payload(), mBluetoothSocket->peerAddress(), this);
+        uploadJob->setBandwidthLimiter(bandwidthLimiter(), BandwidthLimiter::priorityOf(np));
         np.setPayloadTransferInfo(uploadJob->transferInfo());
         uploadJob->start();
     }
-    int written = mSocketReader->write(np.serialize());
+    const QByteArray data = np.serialize(encoding(), compression());
+    if (BandwidthLimiter* limiter = bandwidthLimiter()) {
+        limiter->consume(data.size(), BandwidthLimiter::priorityOf(np));
+    }
+    int written = mSocketReader->write(data);
     return (written != -1);
 }
 
@@ -73,14 +84,23 @@ bool BluetoothDeviceLink::linkShouldBeKeptAlive() {
 
 void BluetoothDeviceLink::dataReceived()
 {
-    if (mSocketReader->bytesAvailable() == 0) return;
+    //Handle everything we have in one go, but let the event loop run after receiveBudget() packets
+    for (int i = 0; i < receiveBudget() && mSocketReader->bytesAvailable() > 0; ++i) {
+        packetReceived(mSocketReader->readPacket());
+    }
 
-    const QByteArray serializedPacket = mSocketReader->readLine();
+    if (mSocketReader->bytesAvailable() > 0) {
+        QMetaObject::invokeMethod(this, "dataReceived", Qt::QueuedConnection);
+    }
+}
 
+void BluetoothDeviceLink::packetReceived(const PacketFramer::PacketView& serializedPacket)
+{
     //qCDebug(KDECONNECT_CORE) << "BluetoothDeviceLink dataReceived" << packet;
 
     NetworkPacket packet((QString()));
-    NetworkPacket::unserialize(serializedPacket, &packet);
+    //No copy, unserialize() copies what it keeps and the view isn't used after it
+    NetworkPacket::unserialize(QByteArray::fromRawData(serializedPacket.data, serializedPacket.size), &packet, encoding());
 
     if (packet.type() == PACKET_TYPE_PAIR) {
         //TODO: Handle pair/unpair requests and forward them (to the pairing handler?)
@@ -88,7 +108,9 @@ void BluetoothDeviceLink::dataReceived()
         return;
     }
 
-    if (packet.hasPayloadTransferInfo()) {
+    if (packet.hasInlinePayload()) {
+        packet.extractInlinePayload();
+    } else if (packet.hasPayloadTransferInfo()) {
         BluetoothDownloadJob* downloadJob = new BluetoothDownloadJob(mBluetoothSocket->peerAddress(),
                                                                      packet.payloadTransferInfo(), this);
         downloadJob->start();
@@ -96,8 +118,4 @@ void BluetoothDeviceLink::dataReceived()
     }
 
     Q_EMIT receivedPacket(packet);
-
-    if (mSocketReader->bytesAvailable() > 0) {
-        QMetaObject::invokeMethod(this, "dataReceived", Qt::QueuedConnection);
-    }
 }
@@ -39,6 +39,7 @@ public:
 
     virtual QString name() override;
     bool sendPacket(NetworkPacket& np) override;
+    void setEncoding(NetworkPacket::Encoding encoding) override;
 
     virtual void userRequestsPair() override;
     virtual void userRequestsUnpair() override;
@@ -49,6 +50,8 @@ private Q_SLOTS:
     void dataReceived();
 
 private:
+    void packetReceived(const PacketFramer::PacketView& serializedPacket);
+
     DeviceLineReader* mSocketReader;
     QBluetoothSocket* mBluetoothSocket;
     BluetoothPairingHandler* mPairingHandler;
@@ -209,6 +209,11 @@ void BluetoothLinkProvider::clientIdentityReceived()
 
         qCDebug(KDECONNECT_CORE) << "Handshaking done (I'm the new device)";
 
+        //Our identity packet went out as JSON, from now on we can use something better
+        deviceLink->setEncoding(NetworkPacket::negotiateEncoding(receivedPacket));
+        deviceLink->setCompression(NetworkPacket::negotiateCompression(receivedPacket));
+        deviceLink->setInlinePayloadSize(NetworkPacket::negotiateInlinePayloadSize(receivedPacket));
+
         connect(deviceLink, SIGNAL(destroyed(QObject*)),
                 this, SLOT(deviceLinkDestroyed(QObject*)));
 
@@ -291,6 +296,9 @@ void BluetoothLinkProvider::serverDataReceived()
 
     const QString& deviceId = receivedPacket.get<QString>("deviceId");
     BluetoothDeviceLink* deviceLink = new BluetoothDeviceLink(deviceId, this, socket);
+    deviceLink->setEncoding(NetworkPacket::negotiateEncoding(receivedPacket));
+    deviceLink->setCompression(NetworkPacket::negotiateCompression(receivedPacket));
+    deviceLink->setInlinePayloadSize(NetworkPacket::negotiateInlinePayloadSize(receivedPacket));
 
     connect(deviceLink, SIGNAL(destroyed(QObject*)),
             this, SLOT(deviceLinkDestroyed(QObject*)));
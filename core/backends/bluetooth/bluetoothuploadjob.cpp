@@ -31,6 +31,7 @@ BluetoothUploadJob::BluetoothUploadJob(const QSharedPointer<QIODevice>& data, co
     , mRemoteAddress(remoteAddress)
     , mTransferUuid(QBluetoothUuid::createUuid())
     , mServer(new QBluetoothServer(QBluetoothServiceInfo::RfcommProtocol, this))
+    , m_priority(BandwidthLimiter::Bulk)
 {
     mServer->setSecurityFlags(QBluetooth::Encryption | QBluetooth::Secure);
 }
@@ -42,6 +43,12 @@ QVariantMap BluetoothUploadJob::transferInfo() const
     return ret;
 }
 
+void BluetoothUploadJob::setBandwidthLimiter(BandwidthLimiter* limiter, BandwidthLimiter::Priority priority)
+{
+    m_limiter = limiter;
+    m_priority = priority;
+}
+
 void BluetoothUploadJob::start()
 {
     connect(mServer, &QBluetoothServer::newConnection, this, &BluetoothUploadJob::newConnection);
@@ -73,6 +80,9 @@ void BluetoothUploadJob::newConnection()
 
     connect(m_socket, &QBluetoothSocket::bytesWritten, this, &BluetoothUploadJob::writeSome);
     connect(m_socket, &QBluetoothSocket::disconnected, this, &BluetoothUploadJob::closeConnection);
+    if (m_limiter) {
+        connect(m_limiter.data(), &BandwidthLimiter::ready, this, &BluetoothUploadJob::writeSome);
+    }
     writeSome();
 }
 
@@ -82,6 +92,16 @@ void BluetoothUploadJob::writeSome() {
     bool errorOccurred = false;
     while (m_socket->bytesToWrite() == 0 && mData->bytesAvailable() && m_socket->isWritable()) {
         qint64 bytes = qMin<qint64>(mData->bytesAvailable(), 4096);
+        if (m_limiter && m_priority == BandwidthLimiter::Bulk) {
+            const qint64 allowance = m_limiter->allowance();
+            if (allowance == 0) {
+                m_limiter->waitForAllowance();
+                return;
+            }
+            if (allowance > 0) {
+                bytes = qMin(bytes, allowance);
+            }
+        }
         int bytesWritten = m_socket->write(mData->read(bytes));
 
         if (bytesWritten < 0) {
@@ -89,10 +109,16 @@ void BluetoothUploadJob::writeSome() {
             errorOccurred = true;
             break;
         }
+        if (m_limiter) {
+            m_limiter->consume(bytesWritten, m_priority);
+        }
     }
 
     if (mData->atEnd() || errorOccurred) {
         disconnect(m_socket, &QBluetoothSocket::bytesWritten, this, &BluetoothUploadJob::writeSome);
+        if (m_limiter) {
+            disconnect(m_limiter.data(), &BandwidthLimiter::ready, this, &BluetoothUploadJob::writeSome);
+        }
         mData->close();
 
         connect(m_socket, &QBluetoothSocket::bytesWritten, this, &BluetoothUploadJob::finishWrites);
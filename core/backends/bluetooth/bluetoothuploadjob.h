@@ -29,6 +29,9 @@
 #include <QBluetoothAddress>
 #include <QBluetoothUuid>
 #include <QBluetoothServer>
+#include <QPointer>
+
+#include "bandwidthlimiter.h"
 
 class BluetoothUploadJob
     : public QObject
@@ -39,6 +42,8 @@ public:
 
     QVariantMap transferInfo() const;
     void start();
+    //Bulk uploads wait for the limiter before every write
+    void setBandwidthLimiter(BandwidthLimiter* limiter, BandwidthLimiter::Priority priority);
 
 private:
     QSharedPointer<QIODevice> mData;
@@ -47,6 +52,8 @@ private:
     QBluetoothServer* mServer;
     QBluetoothServiceInfo mServiceInfo;
     QBluetoothSocket* m_socket;
+    QPointer<BandwidthLimiter> m_limiter;
+    BandwidthLimiter::Priority m_priority;
 
     void closeConnection();
 
@@ -21,9 +21,12 @@
 
 #include "devicelinereader.h"
 
+#include "core_debug.h"
+
 DeviceLineReader::DeviceLineReader(QIODevice* device, QObject* parent)
     : QObject(parent)
     , m_device(device)
+    , m_encoding(NetworkPacket::JsonEncoding)
 {
     connect(m_device, SIGNAL(readyRead()),
             this, SLOT(dataReceived()));
@@ -33,23 +36,15 @@ DeviceLineReader::DeviceLineReader(QIODevice* device, QObject* parent)
 
 void DeviceLineReader::dataReceived()
 {
-    while(m_device->canReadLine()) {
-        const QByteArray line = m_device->readLine();
-        if (line.length() > 1) {
-            m_packets.enqueue(line);//we don't want single \n
-        }
-    }
-
-    //If we still have things to read from the device, call dataReceived again
-    //We do this manually because we do not trust readyRead to be emitted again
-    //So we call this method again just in case.
-    if (m_device->bytesAvailable() > 0) {
-        QMetaObject::invokeMethod(this, "dataReceived", Qt::QueuedConnection);
+    //Everything available is read at once, so there is no need to call ourselves again
+    if (!m_framer.readFrom(m_device)) {
+        qCWarning(KDECONNECT_CORE) << "Refusing a packet bigger than" << PacketFramer::s_maxPacketLength << "bytes";
+        m_device->close();
         return;
     }
 
     //If we have any packets, tell it to the world.
-    if (!m_packets.isEmpty()) {
+    if (m_framer.packetCount() > 0) {
         Q_EMIT readyRead();
     }
 }
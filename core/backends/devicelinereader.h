@@ -23,9 +23,11 @@
 
 #include <QObject>
 #include <QString>
-#include <QQueue>
 #include <QIODevice>
 
+#include "networkpacket.h"
+#include "packetframer.h"
+
 /*
  * Encapsulates a QIODevice and implements the same methods of its API that are
  * used by LanDeviceLink and BluetoothDeviceLink, but readyRead is emitted only
@@ -39,9 +41,12 @@ class DeviceLineReader
 public:
     DeviceLineReader(QIODevice* device, QObject* parent = 0);
 
-    QByteArray readLine() { return m_packets.dequeue(); }
-    qint64 write(const QByteArray& data) { return m_device->write(data); }
-    qint64 bytesAvailable() const { return m_packets.size(); }
+    QByteArray readLine() { return m_framer.takePacket().toByteArray(); }
+    //Without copying it, only valid until the next readyRead()
+    PacketFramer::PacketView readPacket() { return m_framer.takePacket(); }
+    qint64 write(const QByteArray& data) { return PacketFramer::write(m_device, data, m_encoding); }
+    void setEncoding(NetworkPacket::Encoding encoding) { m_encoding = encoding; m_framer.setEncoding(encoding); }
+    qint64 bytesAvailable() const { return m_framer.packetCount(); }
 
 Q_SIGNALS:
     void readyRead();
@@ -51,9 +56,9 @@ private Q_SLOTS:
     void dataReceived();
 
 private:
-    QByteArray m_lastChunk;
     QIODevice* m_device;
-    QQueue<QByteArray> m_packets;
+    PacketFramer m_framer;
+    NetworkPacket::Encoding m_encoding;
 
 };
 
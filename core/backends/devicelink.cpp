@@ -22,15 +22,28 @@
 #include "kdeconnectconfig.h"
 #include "linkprovider.h"
 
+const int DeviceLink::s_defaultReceiveBudget = 64;
+
 DeviceLink::DeviceLink(const QString& deviceId, LinkProvider* parent)
     : QObject(parent)
     , m_deviceId(deviceId)
     , m_linkProvider(parent)
     , m_pairStatus(NotPaired)
+    , m_encoding(NetworkPacket::JsonEncoding)
+    , m_compression(NetworkPacket::NoCompression)
+    , m_inlinePayloadSize(0)
+    , m_receiveBudget(s_defaultReceiveBudget)
 {
     Q_ASSERT(!deviceId.isEmpty());
 
     setProperty("deviceId", deviceId);
+
+    //Can be tuned per device, a lower budget keeps the UI responsive during big bursts
+    const int budget = KdeConnectConfig::instance()->getDeviceProperty(deviceId, QStringLiteral("receiveBudget"),
+                                                                       QString::number(s_defaultReceiveBudget)).toInt();
+    if (budget > 0) {
+        setReceiveBudget(budget);
+    }
 }
 
 void DeviceLink::setPairStatus(DeviceLink::PairStatus status)
@@ -22,7 +22,9 @@
 #define DEVICELINK_H
 
 #include <QObject>
+#include <QPointer>
 
+#include "bandwidthlimiter.h"
 #include "networkpacket.h"
 
 class PairingHandler;
@@ -48,6 +50,25 @@ public:
 
     virtual bool sendPacket(NetworkPacket& np) = 0;
 
+    //Encoding used for the packets exchanged after the identity packets
+    NetworkPacket::Encoding encoding() const { return m_encoding; }
+    virtual void setEncoding(NetworkPacket::Encoding encoding) { m_encoding = encoding; }
+    NetworkPacket::Compression compression() const { return m_compression; }
+    void setCompression(NetworkPacket::Compression compression) { m_compression = compression; }
+    //Biggest payload the other side accepts inside the packet, 0 if it doesn't support it
+    qint64 inlinePayloadSize() const { return m_inlinePayloadSize; }
+    void setInlinePayloadSize(qint64 size) { m_inlinePayloadSize = size; }
+
+    //How many received packets are handled in a row before letting the event loop run,
+    //from the "receiveBudget" device property
+    int receiveBudget() const { return m_receiveBudget; }
+    void setReceiveBudget(int budget) { Q_ASSERT(budget > 0); m_receiveBudget = budget; }
+    const static int s_defaultReceiveBudget;
+
+    //Of the device, for everything sent through this link. Null until it is added to one
+    BandwidthLimiter* bandwidthLimiter() const { return m_bandwidthLimiter; }
+    void setBandwidthLimiter(BandwidthLimiter* limiter) { m_bandwidthLimiter = limiter; }
+
     //user actions
     virtual void userRequestsPair() = 0;
     virtual void userRequestsUnpair() = 0;
@@ -69,6 +90,11 @@ private:
     const QString m_deviceId;
     LinkProvider* m_linkProvider;
     PairStatus m_pairStatus;
+    NetworkPacket::Encoding m_encoding;
+    NetworkPacket::Compression m_compression;
+    qint64 m_inlinePayloadSize;
+    int m_receiveBudget;
+    QPointer<BandwidthLimiter> m_bandwidthLimiter;
 
 };
 
@@ -25,18 +25,25 @@
 #include <KJobTrackerInterface>
 #include "lanlinkprovider.h"
 #include <daemon.h>
+#include <kdeconnectconfig.h>
 #include "plugins/share/shareplugin.h"
 
-CompositeUploadJob::CompositeUploadJob(const QString& deviceId, bool displayNotification) 
+#ifdef KDECONNECT_KTLS
+#include "kerneltlssocket.h"
+#endif
+
+CompositeUploadJob::CompositeUploadJob(const QString& deviceId, bool displayNotification, PayloadServer* payloadServer)
     : KCompositeJob()
-    , m_server(new Server(this))
-    , m_socket(nullptr)
+    , m_server(payloadServer ? nullptr : new Server(this))
+    , m_payloadServer(payloadServer)
+    , m_maxConcurrentJobs(s_defaultMaxConcurrentJobs)
+    , m_resumable(false)
+    , m_priority(BandwidthLimiter::Bulk)
     , m_port(0)
     , m_deviceId(deviceId)
     , m_running(false)
-    , m_currentJobNum(1)
+    , m_currentJobNum(0)
     , m_totalJobs(0)
-    , m_currentJobSendPayloadSize(0)
     , m_totalSendPayloadSize(0)
     , m_totalPayloadSize(0)
     , m_currentJob(nullptr)
@@ -50,11 +57,37 @@ CompositeUploadJob::CompositeUploadJob(const QString& deviceId, bool displayNoti
     }
 }
 
+CompositeUploadJob::~CompositeUploadJob()
+{
+    if (m_payloadServer) {
+        for (const QByteArray& token : m_waitingJobs.keys()) {
+            m_payloadServer->removeTransfer(token);
+        }
+    }
+}
+
 bool CompositeUploadJob::isRunning()
 {
     return m_running;
 }
 
+void CompositeUploadJob::setMaxConcurrentJobs(int maxConcurrentJobs)
+{
+    m_maxConcurrentJobs = qMax(1, maxConcurrentJobs);
+}
+
+void CompositeUploadJob::setBandwidthLimiter(BandwidthLimiter* limiter, BandwidthLimiter::Priority priority)
+{
+    m_limiter = limiter;
+    m_priority = priority;
+}
+
+void CompositeUploadJob::setTransferScheduler(TransferScheduler* scheduler)
+{
+    m_scheduler = scheduler;
+    connect(scheduler, &TransferScheduler::transferAllowed, this, &CompositeUploadJob::transferAllowed);
+}
+
 void CompositeUploadJob::start() {
     if (m_running) {
         qCWarning(KDECONNECT_CORE) << "CompositeUploadJob::start() - already running";
@@ -67,25 +100,27 @@ void CompositeUploadJob::start() {
         return;
     }
     
-    if (!startListening()) {
+    if (m_payloadServer) {
+        m_port = m_payloadServer->port();
+    } else if (startListening()) {
+        connect(m_server, &QTcpServer::newConnection, this, &CompositeUploadJob::newConnection);
+    } else {
         return;
     }
-    
-    connect(m_server, &QTcpServer::newConnection, this, &CompositeUploadJob::newConnection);
-    
+
     m_running = true;
  
     //Give SharePlugin some time to add subjobs
-    QMetaObject::invokeMethod(this, "startNextSubJob", Qt::QueuedConnection);
+    QMetaObject::invokeMethod(this, "startSubJobs", Qt::QueuedConnection);
 }
 
 bool CompositeUploadJob::startListening()
 {
-    m_port = MIN_PORT;
+    m_port = PayloadServer::MIN_PORT;
     while (!m_server->listen(QHostAddress::Any, m_port)) {
         m_port++;
-        if (m_port > MAX_PORT) { //No ports available?
-            qCWarning(KDECONNECT_CORE) << "CompositeUploadJob::startListening() - Error opening a port in range" << MIN_PORT << "-" << MAX_PORT;
+        if (m_port > PayloadServer::MAX_PORT) { //No ports available?
+            qCWarning(KDECONNECT_CORE) << "CompositeUploadJob::startListening() - Error opening a port in range" << PayloadServer::MIN_PORT << "-" << PayloadServer::MAX_PORT;
             m_port = 0;
             setError(NoPortAvailable);
             setErrorText(i18n("Couldn't find an available port"));
@@ -98,30 +133,93 @@ bool CompositeUploadJob::startListening()
     return true;
 }
 
-void CompositeUploadJob::startNextSubJob()
+void CompositeUploadJob::startSubJobs()
 {
-    m_currentJob = qobject_cast<UploadJob*>(subjobs().at(0));
-    m_currentJobSendPayloadSize = 0;
-    emitDescription(m_currentJob->getNetworkPacket().get<QString>(QStringLiteral("filename")));
+    //Our own server can't tell the connections apart, so without transfer tokens files are sent one by one
+    const int maxConcurrentJobs = m_payloadServer ? m_maxConcurrentJobs : 1;
+
+    if (m_scheduler) {
+        while (m_running && !m_pendingJobs.isEmpty()) {
+            UploadJob* job = m_pendingJobs.takeFirst();
+            const NetworkPacket& np = job->getNetworkPacket();
+            m_scheduledJobs.append(job);
+            m_scheduler->enqueue(job, m_deviceId, np.get<QString>(QStringLiteral("filename")), np.payloadSize(), this, maxConcurrentJobs);
+        }
+        return;
+    }
 
-    connect(m_currentJob, SIGNAL(processedAmount(KJob*,KJob::Unit,qulonglong)), this, SLOT(slotProcessedAmount(KJob*,KJob::Unit,qulonglong)));
+    while (m_running && !m_pendingJobs.isEmpty() && m_runningJobs.size() < maxConcurrentJobs) {
+        if (!startSubJob(m_pendingJobs.takeFirst())) {
+            return;
+        }
+    }
+}
+
+void CompositeUploadJob::transferAllowed(KJob* job)
+{
+    //The scheduler is shared, most of the jobs it lets start belong to someone else
+    UploadJob* uploadJob = qobject_cast<UploadJob*>(job);
+    if (!uploadJob || !m_scheduledJobs.removeOne(uploadJob)) {
+        return;
+    }
+
+    if (m_running && !error()) {
+        startSubJob(uploadJob);
+    }
+}
+
+bool CompositeUploadJob::startSubJob(UploadJob* job)
+{
+    m_currentJob = job;
+    m_currentJobNum++;
+    m_runningJobs.insert(job, 0);
+    emitDescription(job->getNetworkPacket().get<QString>(QStringLiteral("filename")));
+
+    connect(job, SIGNAL(processedAmount(KJob*,KJob::Unit,qulonglong)), this, SLOT(slotProcessedAmount(KJob*,KJob::Unit,qulonglong)));
     //Already done by KCompositeJob
-    //connect(m_currentJob, &KJob::result, this, &CompositeUploadJob::slotResult);
+    //connect(job, &KJob::result, this, &CompositeUploadJob::slotResult);
     
     //TODO: Create a copy of the networkpacket that can be re-injected if sending via lan fails?
-    NetworkPacket np = m_currentJob->getNetworkPacket();
+    NetworkPacket np = job->getNetworkPacket();
     np.setPayload(nullptr, np.payloadSize());
-    np.setPayloadTransferInfo({{"port", m_port}});
+    QVariantMap transferInfo = {{QStringLiteral("port"), m_port}};
+    QByteArray token;
+    if (m_payloadServer) {
+        token = m_payloadServer->addTransfer(this);
+        transferInfo.insert(QStringLiteral("token"), QString::fromLatin1(token));
+    }
+    //Streamed payloads can't seek, so they start over instead
+    if (m_resumable && !job->getNetworkPacket().payload()->isSequential()) {
+        transferInfo.insert(QStringLiteral("resumable"), true);
+        job->setResumable(true);
+    }
+    if (!m_payloadHash.isEmpty()) {
+        transferInfo.insert(QStringLiteral("hash"), m_payloadHash);
+        job->setPayloadHash(m_payloadHash);
+    }
+    job->setBandwidthLimiter(m_limiter, m_priority);
+    //Can be tuned per device, bigger buffers help on fast networks with a high latency
+    const int sendBufferSize = KdeConnectConfig::instance()->getDeviceProperty(m_deviceId, QStringLiteral("sendBufferSize"),
+                                                                               QString::number(UploadJob::s_defaultSendBufferSize)).toInt();
+    if (sendBufferSize > 0) {
+        job->setSendBufferSize(sendBufferSize);
+    }
+    np.setPayloadTransferInfo(transferInfo);
+    m_waitingJobs.insert(token, job);
     np.set<int>(QStringLiteral("numberOfFiles"), m_totalJobs);
     np.set<quint64>(QStringLiteral("totalPayloadSize"), m_totalPayloadSize);
     
     if (Daemon::instance()->getDevice(m_deviceId)->sendPacket(np)) {
-        m_server->resumeAccepting();
+        if (m_server) {
+            m_server->resumeAccepting();
+        }
+        return true;
     } else {
         setError(SendingNetworkPacketFailed);
         setErrorText(i18n("Failed to send packet to %1", Daemon::instance()->getDevice(m_deviceId)->name()));
 
         emitResult();
+        return false;
     }
 }
 
@@ -129,28 +227,134 @@ void CompositeUploadJob::newConnection()
 {
     m_server->pauseAccepting();
     
-    m_socket = m_server->nextPendingConnection();
+    QSslSocket* socket = m_server->nextPendingConnection();
     
-    if (!m_socket) {
+    if (!socket) {
         qCDebug(KDECONNECT_CORE) << "CompositeUploadJob::newConnection() - m_server->nextPendingConnection() returned a nullptr";
         return;
     }
+
+    UploadJob* job = m_waitingJobs.take(QByteArray());
+    if (!job) {
+        socket->deleteLater();
+        return;
+    }
     
-    m_currentJob->setSocket(m_socket);
-    
-    connect(m_socket, &QSslSocket::disconnected, this, &CompositeUploadJob::socketDisconnected);
-    connect(m_socket, QOverload<QAbstractSocket::SocketError>::of(&QAbstractSocket::error), this, &CompositeUploadJob::socketError);
-    connect(m_socket, QOverload<const QList<QSslError> &>::of(&QSslSocket::sslErrors), this, &CompositeUploadJob::sslError);
-    connect(m_socket, &QSslSocket::encrypted, this, &CompositeUploadJob::encrypted);
+    setSocketPriority(socket);
+    if (takeOverSocket(socket, job, true)) {
+        return;
+    }
+    setupSocket(socket, job);
+    LanLinkProvider::configureSslSocket(socket, m_deviceId, true);
+    socket->startServerEncryption();
+}
+
+static QSslCertificate peerCertificate(QIODevice* socket)
+{
+#ifdef KDECONNECT_KTLS
+    if (KernelTlsSocket* kernelTlsSocket = qobject_cast<KernelTlsSocket*>(socket)) {
+        return kernelTlsSocket->peerCertificate();
+    }
+#endif
+    return static_cast<QSslSocket*>(socket)->peerCertificate();
+}
+
+bool CompositeUploadJob::payloadConnection(QIODevice* socket, const QByteArray& token)
+{
+    UploadJob* job = m_waitingJobs.value(token);
+    if (!m_running || !job) {
+        return false;
+    }
+
+    //The token came through TLS, make sure it is the device we offered the transfer to that sent it
+    const QString certString = KdeConnectConfig::instance()->getDeviceProperty(m_deviceId, QStringLiteral("certificate"), QString());
+    if (certString.isEmpty() || peerCertificate(socket) != QSslCertificate(certString.toLatin1())) {
+        qCWarning(KDECONNECT_CORE) << "CompositeUploadJob - transfer token sent by a device that isn't" << m_deviceId;
+        return false;
+    }
+    m_waitingJobs.remove(token);
+
+#ifdef KDECONNECT_KTLS
+    if (KernelTlsSocket* kernelTlsSocket = qobject_cast<KernelTlsSocket*>(socket)) {
+        if (m_priority == BandwidthLimiter::Bulk) {
+            kernelTlsSocket->setTypeOfService(BandwidthLimiter::s_bulkTypeOfService);
+        }
+        setupKernelTlsSocket(kernelTlsSocket, job);
+        startUpload(job);
+        return true;
+    }
+#endif
+
+    QSslSocket* sslSocket = static_cast<QSslSocket*>(socket);
+    setSocketPriority(sslSocket);
+    setupSocket(sslSocket, job);
+    startUpload(job);
+    return true;
+}
+
+void CompositeUploadJob::setupSocket(QSslSocket* socket, UploadJob* job)
+{
+    m_sockets.insert(socket, job);
+    job->setSocket(socket);
     
-    LanLinkProvider::configureSslSocket(m_socket, m_deviceId, true);
+    connect(socket, &QSslSocket::disconnected, this, &CompositeUploadJob::socketDisconnected);
+    connect(socket, QOverload<QAbstractSocket::SocketError>::of(&QAbstractSocket::error), this, &CompositeUploadJob::socketError);
+    connect(socket, QOverload<const QList<QSslError> &>::of(&QSslSocket::sslErrors), this, &CompositeUploadJob::sslError);
+    connect(socket, &QSslSocket::encrypted, this, &CompositeUploadJob::encrypted);
+}
+
+void CompositeUploadJob::setSocketPriority(QSslSocket* socket)
+{
+    //Also applies to a KernelTlsSocket taking it over, they share the same connection
+    if (m_priority == BandwidthLimiter::Bulk) {
+        socket->setSocketOption(QAbstractSocket::TypeOfServiceOption, BandwidthLimiter::s_bulkTypeOfService);
+    }
+}
+
+bool CompositeUploadJob::takeOverSocket(QSslSocket* socket, UploadJob* job, bool serverMode)
+{
+#ifdef KDECONNECT_KTLS
+    //Files can go straight from the page cache to the socket if the kernel does the encryption
+    if (!job->sendsFile()) {
+        return false;
+    }
+    KernelTlsSocket* kernelTlsSocket = KernelTlsSocket::takeOver(socket, m_deviceId, serverMode);
+    if (!kernelTlsSocket) {
+        return false;
+    }
+
+    setupKernelTlsSocket(kernelTlsSocket, job);
+    return true;
+#else
+    Q_UNUSED(socket);
+    Q_UNUSED(job);
+    Q_UNUSED(serverMode);
+    return false;
+#endif
+}
+
+void CompositeUploadJob::setupKernelTlsSocket(KernelTlsSocket* socket, UploadJob* job)
+{
+#ifdef KDECONNECT_KTLS
+    m_sockets.insert(socket, job);
+    job->setKernelTlsSocket(socket);
+    connect(socket, &KernelTlsSocket::encrypted, this, &CompositeUploadJob::encrypted);
+    connect(socket, &KernelTlsSocket::errorOccurred, this, [this](const QString& message) {
+        setError(SslError);
+        setErrorText(message);
+        emitResult();
 
-    m_socket->startServerEncryption();
+        m_running = false;
+    });
+#else
+    Q_UNUSED(socket);
+    Q_UNUSED(job);
+#endif
 }
 
 void CompositeUploadJob::socketDisconnected()
 {
-    m_socket->close();
+    qobject_cast<QSslSocket*>(sender())->close();
 }
 
 void CompositeUploadJob::socketError(QAbstractSocket::SocketError error)
@@ -168,7 +372,7 @@ void CompositeUploadJob::sslError(const QList<QSslError>& errors)
 {
     Q_UNUSED(errors);
     
-    m_socket->close();
+    qobject_cast<QSslSocket*>(sender())->close();
     setError(SslError);
     emitResult();
 
@@ -176,18 +380,24 @@ void CompositeUploadJob::sslError(const QList<QSslError>& errors)
 }
 
 void CompositeUploadJob::encrypted()
+{
+    if (UploadJob* job = m_sockets.value(sender())) {
+        startUpload(job);
+    }
+}
+
+void CompositeUploadJob::startUpload(UploadJob* job)
 {
     if (!m_timer.isValid()) {
         m_timer.start();
     }
-    
-    m_currentJob->start();
+    job->start();
 }
 
 bool CompositeUploadJob::addSubjob(KJob* job)
 {
     if (UploadJob *uploadJob = qobject_cast<UploadJob*>(job)) {
-        NetworkPacket np = uploadJob->getNetworkPacket();
+        const NetworkPacket& np = uploadJob->getNetworkPacket();
         
         m_totalJobs++;
         
@@ -211,8 +421,16 @@ bool CompositeUploadJob::addSubjob(KJob* job)
             m_updatePacketPending = true;
             QMetaObject::invokeMethod(this, "sendUpdatePacket", Qt::QueuedConnection);
         }
-        
-        return KCompositeJob::addSubjob(job);
+
+        if (!KCompositeJob::addSubjob(job)) {
+            return false;
+        }
+
+        m_pendingJobs.append(uploadJob);
+        if (m_running) {
+            QMetaObject::invokeMethod(this, "startSubJobs", Qt::QueuedConnection);
+        }
+        return true;
     } else {
         qCDebug(KDECONNECT_CORE) << "CompositeUploadJob::addSubjob() - you can only add UploadJob's, ignoring";
         return false;
@@ -221,6 +439,7 @@ bool CompositeUploadJob::addSubjob(KJob* job)
 
 void CompositeUploadJob::sendUpdatePacket() {
     NetworkPacket np(PACKET_TYPE_SHARE_REQUEST_UPDATE);
+    np.setBulk(true);
     np.set<int>(QStringLiteral("numberOfFiles"), m_totalJobs);
     np.set<quint64>(QStringLiteral("totalPayloadSize"), m_totalPayloadSize);
     
@@ -233,18 +452,24 @@ bool CompositeUploadJob::doKill()
 {
     if (m_running) {
         m_running = false;
-        
-        return m_currentJob->stop();
+
+        bool stopped = true;
+        for (KJob* job : m_runningJobs.keys()) {
+            stopped = qobject_cast<UploadJob*>(job)->stop() && stopped;
+        }
+        return stopped;
     }
     
     return true;
 }
 
 void CompositeUploadJob::slotProcessedAmount(KJob *job, KJob::Unit unit, qulonglong amount) {
-    Q_UNUSED(job);
-    
-    m_currentJobSendPayloadSize = amount;
-    quint64 uploaded = m_totalSendPayloadSize + m_currentJobSendPayloadSize;
+    m_runningJobs[job] = amount;
+
+    quint64 uploaded = m_totalSendPayloadSize;
+    for (quint64 sent : qAsConst(m_runningJobs)) {
+        uploaded += sent;
+    }
     
     if (uploaded == m_totalPayloadSize || m_prevElapsedTime == 0 || m_timer.elapsed() - m_prevElapsedTime >= 100) {
         m_prevElapsedTime = m_timer.elapsed();
@@ -265,11 +490,17 @@ void CompositeUploadJob::slotResult(KJob *job) {
         return;
     }
     
-    m_totalSendPayloadSize += m_currentJobSendPayloadSize;
+    m_totalSendPayloadSize += m_runningJobs.take(job);
+    for (auto it = m_sockets.begin(); it != m_sockets.end();) {
+        if (it.value() == job) {
+            it = m_sockets.erase(it);
+        } else {
+            ++it;
+        }
+    }
     
     if (hasSubjobs()) {
-        m_currentJobNum++;
-        startNextSubJob();
+        startSubJobs();
     } else {
         QPair<QString, QString> field2;
         field2.first = QString("Files");
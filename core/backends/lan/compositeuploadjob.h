@@ -23,8 +23,12 @@
 
 #include "kdeconnectcore_export.h"
 #include <KCompositeJob>
+#include <QHash>
+#include <QPointer>
 #include "server.h"
+#include "payloadserver.h"
 #include "uploadjob.h"
+#include <transferscheduler.h>
 
 class KDECONNECTCORE_EXPORT CompositeUploadJob
     : public KCompositeJob
@@ -32,15 +36,43 @@ class KDECONNECTCORE_EXPORT CompositeUploadJob
     Q_OBJECT
 
 public:
-    explicit CompositeUploadJob(const QString& deviceId, bool displayNotification);
-    
+    //Without a payloadServer the job listens on a port of its own, for devices that don't support transfer tokens
+    explicit CompositeUploadJob(const QString& deviceId, bool displayNotification, PayloadServer* payloadServer = nullptr);
+    ~CompositeUploadJob() override;
+
     void start() override;
     QVariantMap transferInfo();
     bool isRunning();
     bool addSubjob(KJob* job) override;
-    
+
+    //How many files are sent at the same time, each over its own connection. Only
+    //used with a payloadServer, without transfer tokens we couldn't tell the connections apart
+    void setMaxConcurrentJobs(int maxConcurrentJobs);
+    //Below TransferScheduler::s_defaultMaxActiveTransfers, so one device doesn't take all the slots
+    const static int s_defaultMaxConcurrentJobs = 2;
+
+    //Whether the other device can ask to resume the transfers, see UploadJob::setResumable()
+    void setResumable(bool resumable) { m_resumable = resumable; }
+    //Empty to not hash the payloads, see PayloadHasher
+    void setPayloadHash(const QString& algorithm) { m_payloadHash = algorithm; }
+    //For all the uploads, see UploadJob::setBandwidthLimiter()
+    void setBandwidthLimiter(BandwidthLimiter* limiter, BandwidthLimiter::Priority priority);
+    //The uploads wait in the queue shared with the other devices instead of starting right away
+    void setTransferScheduler(TransferScheduler* scheduler);
+
+    //Called by PayloadServer when the other device sends one of our transfer tokens through an
+    //encrypted @p socket (QSslSocket or KernelTlsSocket). Returns false, and leaves the socket
+    //alone, if we don't take it
+    bool payloadConnection(QIODevice* socket, const QByteArray& token);
+
 private:
     bool startListening();
+    bool startSubJob(UploadJob* job);
+    void setupSocket(QSslSocket* socket, UploadJob* job);
+    bool takeOverSocket(QSslSocket* socket, UploadJob* job, bool serverMode);
+    void setupKernelTlsSocket(KernelTlsSocket* socket, UploadJob* job);
+    void setSocketPriority(QSslSocket* socket);
+    void startUpload(UploadJob* job);
     void emitDescription(const QString& currentFileName);
     
 protected:
@@ -55,13 +87,23 @@ private:
     };
     
     Server *const m_server;
-    QSslSocket *m_socket;
+    QPointer<PayloadServer> m_payloadServer;
+    int m_maxConcurrentJobs;
+    bool m_resumable;
+    QString m_payloadHash;
+    QPointer<BandwidthLimiter> m_limiter;
+    BandwidthLimiter::Priority m_priority;
+    QPointer<TransferScheduler> m_scheduler;
+    QList<UploadJob*> m_pendingJobs;
+    QList<UploadJob*> m_scheduledJobs; //Queued in m_scheduler, not started yet
+    QHash<QByteArray, UploadJob*> m_waitingJobs; //By transfer token, empty without a payloadServer
+    QHash<QObject*, UploadJob*> m_sockets; //QSslSocket or KernelTlsSocket
+    QHash<KJob*, quint64> m_runningJobs; //Bytes sent by each started job
     quint16 m_port;
     const QString& m_deviceId;
     bool m_running;
     int m_currentJobNum;
     int m_totalJobs;
-    quint64 m_currentJobSendPayloadSize;
     quint64 m_totalSendPayloadSize;
     quint64 m_totalPayloadSize;
     UploadJob *m_currentJob;
@@ -69,9 +111,6 @@ private:
     quint64 m_prevElapsedTime;
     bool m_updatePacketPending;
 
-    const static quint16 MIN_PORT = 1739;
-    const static quint16 MAX_PORT = 1764;
-    
 private Q_SLOTS:
     void newConnection();
     void socketDisconnected();
@@ -80,7 +119,8 @@ private Q_SLOTS:
     void encrypted();
     void slotProcessedAmount(KJob *job, KJob::Unit unit, qulonglong amount);
     void slotResult(KJob *job) override;
-    void startNextSubJob();
+    void startSubJobs();
+    void transferAllowed(KJob* job);
     void sendUpdatePacket();
 };
 
@@ -0,0 +1,453 @@
+/**
+ * Copyright 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "kerneltlssocket.h"
+
+#include <QFile>
+#include <QSocketNotifier>
+#include <QSslKey>
+
+#include <KLocalizedString>
+
+#include <openssl/err.h>
+#include <openssl/x509.h>
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "core_debug.h"
+#include "kdeconnectconfig.h"
+
+//Same TLS 1.2 ciphers as LanLinkProvider uses for its sockets. Our certificates are RSA ones, so
+//only the last one can be negotiated, and being CBC the kernel can't take it. Connections go to the
+//kernel when they use TLS 1.3, whose AES-GCM suites OpenSSL enables by default.
+static const char s_ciphers[] = "ECDHE-ECDSA-AES256-GCM-SHA384:ECDHE-ECDSA-AES128-GCM-SHA256:ECDHE-RSA-AES128-SHA";
+
+//Used for reading, and for files when OpenSSL does the encryption
+static const int s_bufferSize = 64 * 1024;
+
+static QString sslErrorString()
+{
+    char error[256];
+    ERR_error_string_n(ERR_get_error(), error, sizeof(error));
+    ERR_clear_error();
+    return QString::fromLatin1(error);
+}
+
+static QByteArray toDer(X509* certificate)
+{
+    QByteArray der(i2d_X509(certificate, nullptr), Qt::Uninitialized);
+    unsigned char* data = reinterpret_cast<unsigned char*>(der.data());
+    i2d_X509(certificate, &data);
+    return der;
+}
+
+static SSL_CTX* createContext(const QByteArray& certificate)
+{
+    const QByteArray privateKey = KdeConnectConfig::instance()->privateKey().toDer();
+
+    SSL_CTX* context = SSL_CTX_new(TLS_method());
+    if (!context) {
+        return nullptr;
+    }
+    SSL_CTX_set_min_proto_version(context, TLS1_2_VERSION);
+    SSL_CTX_set_options(context, SSL_OP_ENABLE_KTLS | SSL_OP_IGNORE_UNEXPECTED_EOF);
+    SSL_CTX_set_mode(context, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+    //The receivers of our payloads resume the session of their last payload connection, which
+    //only works because the context is shared. It has to be named, as the peers send certificates.
+    static const unsigned char s_sessionContext[] = "kdeconnect-payload";
+    SSL_CTX_set_session_cache_mode(context, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_set_session_id_context(context, s_sessionContext, sizeof(s_sessionContext) - 1);
+    SSL_CTX_set_num_tickets(context, 1);
+    //The certificates are self signed, the peer's is compared to the one we paired with after the handshake
+    SSL_CTX_set_verify(context, SSL_VERIFY_PEER | SSL_VERIFY_FAIL_IF_NO_PEER_CERT, [](int, X509_STORE_CTX*) { return 1; });
+
+    const unsigned char* keyData = reinterpret_cast<const unsigned char*>(privateKey.constData());
+    EVP_PKEY* key = d2i_AutoPrivateKey(nullptr, &keyData, privateKey.size());
+    const bool configured = key
+        && SSL_CTX_set_cipher_list(context, s_ciphers) == 1
+        && SSL_CTX_use_certificate_ASN1(context, certificate.size(), reinterpret_cast<const unsigned char*>(certificate.constData())) == 1
+        && SSL_CTX_use_PrivateKey(context, key) == 1;
+    EVP_PKEY_free(key);
+
+    if (!configured) {
+        qCWarning(KDECONNECT_CORE) << "KernelTlsSocket - couldn't set up OpenSSL:" << sslErrorString();
+        SSL_CTX_free(context);
+        return nullptr;
+    }
+    return context;
+}
+
+//Parsing our key and setting everything up is built once, and again only if our certificate
+//changes. Every socket gets its own reference, it can outlive the context being replaced.
+static SSL_CTX* sharedContext()
+{
+    static SSL_CTX* context = nullptr;
+    static QByteArray contextCertificate;
+
+    const QByteArray certificate = KdeConnectConfig::instance()->certificate().toDer();
+    if (!context || certificate != contextCertificate) {
+        SSL_CTX* newContext = createContext(certificate);
+        if (!newContext) {
+            return nullptr;
+        }
+        SSL_CTX_free(context);
+        context = newContext;
+        contextCertificate = certificate;
+    }
+
+    SSL_CTX_up_ref(context);
+    return context;
+}
+
+bool KernelTlsSocket::isAvailable()
+{
+    static const bool available = [] {
+        QFile ulps(QStringLiteral("/proc/sys/net/ipv4/tcp_available_ulp"));
+        return ulps.open(QIODevice::ReadOnly) && ulps.readAll().simplified().split(' ').contains("tls");
+    }();
+    return available;
+}
+
+KernelTlsSocket* KernelTlsSocket::takeOver(QSslSocket* socket, const QString& deviceId, bool serverMode)
+{
+    //Anything already read would be lost
+    if (!isAvailable() || socket->bytesAvailable() > 0) {
+        return nullptr;
+    }
+
+    QByteArray peerCertificate;
+    if (!deviceId.isEmpty()) {
+        const QString certificateString = KdeConnectConfig::instance()->getDeviceProperty(deviceId, QStringLiteral("certificate"), QString());
+        peerCertificate = QSslCertificate(certificateString.toLatin1()).toDer();
+        if (peerCertificate.isEmpty()) {
+            return nullptr;
+        }
+    }
+
+    SSL_CTX* context = sharedContext();
+    if (!context) {
+        return nullptr;
+    }
+
+    //The socket closes its descriptor, the connection stays open through ours
+    const int fd = ::dup(socket->socketDescriptor());
+    SSL* ssl = (fd >= 0) ? SSL_new(context) : nullptr;
+    if (!ssl || SSL_set_fd(ssl, fd) != 1) {
+        qCWarning(KDECONNECT_CORE) << "KernelTlsSocket - couldn't take over the connection" << strerror(errno);
+        SSL_free(ssl);
+        SSL_CTX_free(context);
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        return nullptr;
+    }
+
+    if (serverMode) {
+        SSL_set_accept_state(ssl);
+    } else {
+        SSL_set_connect_state(ssl);
+    }
+
+    socket->abort();
+    socket->deleteLater();
+
+    return new KernelTlsSocket(fd, context, ssl, peerCertificate);
+}
+
+KernelTlsSocket::KernelTlsSocket(int fd, SSL_CTX* context, SSL* ssl, const QByteArray& peerCertificate)
+    : QIODevice()
+    , m_fd(fd)
+    , m_context(context)
+    , m_ssl(ssl)
+    , m_peerCertificate(peerCertificate)
+    , m_readNotifier(new QSocketNotifier(fd, QSocketNotifier::Read, this))
+    , m_writeNotifier(new QSocketNotifier(fd, QSocketNotifier::Write, this))
+    , m_pendingFileWrite(0)
+    , m_handshaking(true)
+    , m_closing(false)
+{
+    //Enabled whenever OpenSSL wants to read or write
+    m_readNotifier->setEnabled(false);
+    m_writeNotifier->setEnabled(false);
+    connect(m_readNotifier, &QSocketNotifier::activated, this, &KernelTlsSocket::readActivated);
+    connect(m_writeNotifier, &QSocketNotifier::activated, this, &KernelTlsSocket::writeActivated);
+
+    open(QIODevice::ReadWrite | QIODevice::Unbuffered);
+
+    //Let the caller connect to our signals first
+    QMetaObject::invokeMethod(this, "continueHandshake", Qt::QueuedConnection);
+}
+
+KernelTlsSocket::~KernelTlsSocket()
+{
+    closeConnection();
+    SSL_free(m_ssl);
+    SSL_CTX_free(m_context);
+}
+
+qint64 KernelTlsSocket::bytesAvailable() const
+{
+    return m_readBuffer.size() + QIODevice::bytesAvailable();
+}
+
+qint64 KernelTlsSocket::bytesToWrite() const
+{
+    return m_writeBuffer.size();
+}
+
+bool KernelTlsSocket::isKernelEncrypted() const
+{
+    return !m_handshaking && BIO_get_ktls_send(SSL_get_wbio(m_ssl));
+}
+
+void KernelTlsSocket::continueHandshake()
+{
+    if (m_fd < 0) {
+        return;
+    }
+
+    const int ret = SSL_do_handshake(m_ssl);
+    if (ret != 1) {
+        if (!wouldBlock(SSL_get_error(m_ssl, ret))) {
+            fail(i18n("TLS handshake failed: %1", sslErrorString()));
+        }
+        return;
+    }
+
+    m_handshaking = false;
+    if (!verifyPeer()) {
+        fail(i18n("The device sent an unexpected certificate"));
+        return;
+    }
+
+    qCDebug(KDECONNECT_CORE) << "KernelTlsSocket - encrypted with" << SSL_get_cipher_name(m_ssl)
+                             << (isKernelEncrypted() ? "by the kernel" : "by OpenSSL, the kernel can't take the cipher");
+
+    //Always listening from now on, to notice when the other side closes the connection
+    m_readNotifier->setEnabled(true);
+    Q_EMIT encrypted();
+}
+
+QSslCertificate KernelTlsSocket::peerCertificate() const
+{
+    X509* certificate = m_handshaking ? nullptr : SSL_get1_peer_certificate(m_ssl);
+    if (!certificate) {
+        return QSslCertificate();
+    }
+    const QByteArray der = toDer(certificate);
+    X509_free(certificate);
+    return QSslCertificate(der, QSsl::Der);
+}
+
+void KernelTlsSocket::setTypeOfService(int typeOfService)
+{
+    if (m_fd >= 0) {
+        setsockopt(m_fd, IPPROTO_IP, IP_TOS, &typeOfService, sizeof(typeOfService));
+    }
+}
+
+bool KernelTlsSocket::verifyPeer() const
+{
+    X509* certificate = SSL_get1_peer_certificate(m_ssl);
+    if (!certificate) {
+        return false;
+    }
+    const bool trusted = m_peerCertificate.isEmpty() || (toDer(certificate) == m_peerCertificate);
+    X509_free(certificate);
+    return trusted;
+}
+
+bool KernelTlsSocket::wouldBlock(int sslError)
+{
+    switch (sslError) {
+    case SSL_ERROR_WANT_READ:
+        m_readNotifier->setEnabled(true);
+        return true;
+    case SSL_ERROR_WANT_WRITE:
+        m_writeNotifier->setEnabled(true);
+        return true;
+    default:
+        return false;
+    }
+}
+
+void KernelTlsSocket::readActivated()
+{
+    m_readNotifier->setEnabled(false);
+    if (m_handshaking) {
+        continueHandshake();
+    } else {
+        readIncoming();
+    }
+}
+
+void KernelTlsSocket::writeActivated()
+{
+    m_writeNotifier->setEnabled(false);
+    if (m_handshaking) {
+        continueHandshake();
+        return;
+    }
+
+    if (!flushWrites()) {
+        return;
+    }
+    if (m_closing) {
+        SSL_shutdown(m_ssl);
+        closeConnection();
+        Q_EMIT disconnected();
+        return;
+    }
+    Q_EMIT writable();
+}
+
+void KernelTlsSocket::readIncoming()
+{
+    char buffer[s_bufferSize];
+    int ret;
+    const int oldSize = m_readBuffer.size();
+    while ((ret = SSL_read(m_ssl, buffer, sizeof(buffer))) > 0) {
+        m_readBuffer.append(buffer, ret);
+    }
+    const int sslError = SSL_get_error(m_ssl, ret);
+
+    if (m_readBuffer.size() > oldSize) {
+        Q_EMIT readyRead();
+    }
+
+    if (sslError == SSL_ERROR_ZERO_RETURN) {
+        //The other side closed the connection
+        closeConnection();
+        Q_EMIT disconnected();
+    } else if (!wouldBlock(sslError)) {
+        fail(i18n("Couldn't read from the connection: %1", sslErrorString()));
+    }
+}
+
+qint64 KernelTlsSocket::readData(char* data, qint64 maxSize)
+{
+    const int size = static_cast<int>(qMin<qint64>(maxSize, m_readBuffer.size()));
+    memcpy(data, m_readBuffer.constData(), size);
+    m_readBuffer.remove(0, size);
+    return size;
+}
+
+qint64 KernelTlsSocket::writeData(const char* data, qint64 size)
+{
+    if (m_fd < 0) {
+        return -1;
+    }
+    m_writeBuffer.append(data, static_cast<int>(size));
+    flushWrites();
+    return size;
+}
+
+bool KernelTlsSocket::flushWrites()
+{
+    while (!m_writeBuffer.isEmpty() && m_fd >= 0) {
+        const int ret = SSL_write(m_ssl, m_writeBuffer.constData(), m_writeBuffer.size());
+        if (ret <= 0) {
+            if (!wouldBlock(SSL_get_error(m_ssl, ret))) {
+                fail(i18n("Couldn't write to the connection: %1", sslErrorString()));
+            }
+            return false;
+        }
+        m_writeBuffer.remove(0, ret);
+    }
+    return m_fd >= 0;
+}
+
+qint64 KernelTlsSocket::sendFile(int fd, qint64 offset, qint64 size)
+{
+    if (!flushWrites()) {
+        return m_fd < 0 ? -1 : 0;
+    }
+
+    ossl_ssize_t sent;
+    if (isKernelEncrypted()) {
+        sent = SSL_sendfile(m_ssl, fd, offset, size, 0);
+    } else {
+        //A write that didn't fit has to be retried with the same bytes, the caller passes the same offset
+        const int length = m_pendingFileWrite > 0 ? m_pendingFileWrite : static_cast<int>(qMin<qint64>(size, s_bufferSize));
+        m_fileBuffer.resize(length);
+        const ssize_t read = ::pread(fd, m_fileBuffer.data(), length, offset);
+        if (read != length && (m_pendingFileWrite > 0 || read <= 0)) {
+            qCWarning(KDECONNECT_CORE) << "KernelTlsSocket - couldn't read the file" << strerror(errno);
+            return -1;
+        }
+        sent = SSL_write(m_ssl, m_fileBuffer.constData(), static_cast<int>(read));
+        m_pendingFileWrite = (sent > 0) ? 0 : static_cast<int>(read);
+    }
+
+    if (sent > 0) {
+        return sent;
+    }
+    if (wouldBlock(SSL_get_error(m_ssl, static_cast<int>(sent)))) {
+        return 0;
+    }
+    fail(i18n("Couldn't send the file: %1", sslErrorString()));
+    return -1;
+}
+
+void KernelTlsSocket::disconnectFromHost()
+{
+    if (m_fd < 0) {
+        return;
+    }
+
+    m_closing = true;
+    if (flushWrites()) {
+        SSL_shutdown(m_ssl);
+        closeConnection();
+        Q_EMIT disconnected();
+    }
+}
+
+void KernelTlsSocket::abort()
+{
+    m_writeBuffer.clear();
+    closeConnection();
+}
+
+void KernelTlsSocket::fail(const QString& message)
+{
+    qCWarning(KDECONNECT_CORE) << "KernelTlsSocket -" << message;
+    setErrorString(message);
+    closeConnection();
+    Q_EMIT errorOccurred(message);
+    Q_EMIT disconnected();
+}
+
+void KernelTlsSocket::closeConnection()
+{
+    if (m_fd < 0) {
+        return;
+    }
+
+    m_readNotifier->setEnabled(false);
+    m_writeNotifier->setEnabled(false);
+    ::close(m_fd);
+    m_fd = -1;
+    QIODevice::close();
+}
@@ -0,0 +1,114 @@
+/**
+ * Copyright 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef KERNELTLSSOCKET_H
+#define KERNELTLSSOCKET_H
+
+#include <QIODevice>
+#include <QSslSocket>
+
+#include <openssl/ssl.h>
+
+#include "kdeconnectcore_export.h"
+
+class QSocketNotifier;
+
+/*
+ * A payload connection encrypted by the kernel (kTLS). The handshake runs on OpenSSL,
+ * which hands the negotiated keys to the kernel, so files can then be sent with
+ * sendfile() without being copied to and encrypted in user space.
+ * If the kernel can't take the negotiated cipher, OpenSSL encrypts the data instead.
+ */
+class KDECONNECTCORE_EXPORT KernelTlsSocket
+    : public QIODevice
+{
+    Q_OBJECT
+
+public:
+    //The kernel needs the tls module loaded ("modprobe tls")
+    static bool isAvailable();
+
+    //Takes over the connection of @p socket, which must not have started its handshake.
+    //Returns nullptr if it can't, @p socket can then be used as usual.
+    //Without @p deviceId any certificate is accepted, the caller checks peerCertificate() later.
+    static KernelTlsSocket* takeOver(QSslSocket* socket, const QString& deviceId, bool serverMode);
+    ~KernelTlsSocket() override;
+
+    bool isSequential() const override { return true; }
+    qint64 bytesAvailable() const override;
+    qint64 bytesToWrite() const override;
+
+    //Whether the kernel does the encryption, only known once encrypted() is emitted
+    bool isKernelEncrypted() const;
+    QSslCertificate peerCertificate() const;
+    //Same as QAbstractSocket::TypeOfServiceOption
+    void setTypeOfService(int typeOfService);
+
+    //Sends @p size bytes of @p fd starting at @p offset, returns how many were sent,
+    //0 if the socket can't take more for now (see writable()) or -1 on errors.
+    //After a 0 it must be called again with the same @p offset, and without the kernel
+    //doing the encryption it then sends the bytes it tried to send before, whatever @p size is.
+    qint64 sendFile(int fd, qint64 offset, qint64 size);
+
+    //Closes the connection once the written data is sent
+    void disconnectFromHost();
+    //Closes the connection right away, what isn't sent yet is dropped
+    void abort();
+
+Q_SIGNALS:
+    void encrypted();
+    void writable();
+    void disconnected();
+    void errorOccurred(const QString& message);
+
+protected:
+    qint64 readData(char* data, qint64 maxSize) override;
+    qint64 writeData(const char* data, qint64 size) override;
+
+private Q_SLOTS:
+    void continueHandshake();
+
+private:
+    KernelTlsSocket(int fd, SSL_CTX* context, SSL* ssl, const QByteArray& peerCertificate);
+
+    void readActivated();
+    void writeActivated();
+    void readIncoming();
+    bool flushWrites();
+    bool wouldBlock(int sslError);
+    bool verifyPeer() const;
+    void fail(const QString& message);
+    void closeConnection();
+
+    int m_fd;
+    SSL_CTX* m_context;
+    SSL* m_ssl;
+    QByteArray m_peerCertificate; //DER, the one we paired with, empty if the caller checks it
+    QSocketNotifier* m_readNotifier;
+    QSocketNotifier* m_writeNotifier;
+    QByteArray m_readBuffer;
+    QByteArray m_writeBuffer;
+    QByteArray m_fileBuffer; //For sendFile() when OpenSSL does the encryption
+    int m_pendingFileWrite; //Bytes of m_fileBuffer that SSL_write() has to be called with again
+    bool m_handshaking;
+    bool m_closing;
+};
+
+#endif
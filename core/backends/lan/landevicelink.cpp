@@ -23,15 +23,24 @@
 #include <KLocalizedString>
 
 #include "core_debug.h"
+#include "daemon.h"
 #include "kdeconnectconfig.h"
 #include "backends/linkprovider.h"
 #include "socketlinereader.h"
 #include "lanlinkprovider.h"
 #include "plugins/share/shareplugin.h"
 
+//Of each payload connection, so TCP makes the other side wait when we don't read it. The
+//connections of the files a CompositeFileTransferJob hasn't started yet would buffer everything otherwise
+static const qint64 s_payloadReadBufferSize = 2 * 1024 * 1024;
+
 LanDeviceLink::LanDeviceLink(const QString& deviceId, LinkProvider* parent, QSslSocket* socket, ConnectionStarted connectionSource)
     : DeviceLink(deviceId, parent)
     , m_socketLineReader(nullptr)
+    , m_payloadTransferTokens(false)
+    , m_payloadMultiplexer(new PayloadMultiplexer(this))
+    , m_payloadChannels(false)
+    , m_resumableTransfers(false)
 {
     reset(socket, connectionSource);
 }
@@ -47,6 +56,7 @@ void LanDeviceLink::reset(QSslSocket* socket, ConnectionStarted connectionSource
 
     connect(socket, &QAbstractSocket::disconnected, this, &QObject::deleteLater);
     connect(m_socketLineReader, &SocketLineReader::readyRead, this, &LanDeviceLink::dataReceived);
+    m_payloadMultiplexer->setSocketLineReader(m_socketLineReader);
 
     //We take ownership of the socket.
     //When the link provider destroys us,
@@ -56,6 +66,15 @@ void LanDeviceLink::reset(QSslSocket* socket, ConnectionStarted connectionSource
 
     m_connectionSource = connectionSource;
 
+    //A new socket starts with JSON until the provider negotiates something else
+    DeviceLink::setEncoding(NetworkPacket::JsonEncoding);
+    setCompression(NetworkPacket::NoCompression);
+    setInlinePayloadSize(0);
+    m_payloadTransferTokens = false;
+    m_payloadChannels = false;
+    m_resumableTransfers = false;
+    m_payloadHash.clear();
+
     QString certString = KdeConnectConfig::instance()->getDeviceProperty(deviceId(), QStringLiteral("certificate"));
     DeviceLink::setPairStatus(certString.isEmpty()? PairStatus::NotPaired : PairStatus::Paired);
 }
@@ -82,12 +101,47 @@ QString LanDeviceLink::name()
     return QStringLiteral("LanLink"); // Should be same in both android and kde version
 }
 
+void LanDeviceLink::setEncoding(NetworkPacket::Encoding encoding)
+{
+    DeviceLink::setEncoding(encoding);
+    m_socketLineReader->setEncoding(encoding);
+    m_payloadMultiplexer->setEncoding(encoding);
+}
+
+PayloadServer* LanDeviceLink::payloadServer()
+{
+    if (!m_payloadTransferTokens) {
+        return nullptr;
+    }
+    PayloadServer* server = qobject_cast<LanLinkProvider*>(provider())->payloadServer();
+    return server->isListening() ? server : nullptr;
+}
+
+//Files and folders shared by the user are sent one after another, with their progress shown
+static bool isSharedFile(const NetworkPacket& np)
+{
+    return np.type() == PACKET_TYPE_SHARE_REQUEST || np.type() == PACKET_TYPE_SHARE_ARCHIVE || np.type() == PACKET_TYPE_SHARE_SYNC_DELTA;
+}
+
 bool LanDeviceLink::sendPacket(NetworkPacket& np)
 {
-    if (np.payload()) {
-        if (np.type() == PACKET_TYPE_SHARE_REQUEST && np.payloadSize() >= 0) {
+    //Shared files always go through CompositeUploadJob, which tells the receiver how many there are
+    if (np.payload() && !isSharedFile(np) && np.inlinePayload(encoding(), inlinePayloadSize())) {
+        return writePacket(np);
+    } else if (np.payload() && m_payloadChannels && !isSharedFile(np) && PayloadMultiplexer::canMultiplex(np)) {
+        //Not worth a connection of its own, the data follows this packet
+        np.setPayloadTransferInfo(m_payloadMultiplexer->sendPayload(np));
+        return writePacket(np);
+    } else if (np.payload()) {
+        if (isSharedFile(np) && np.payloadSize() >= 0) {
             if (!m_compositeUploadJob || !m_compositeUploadJob->isRunning()) {
-                m_compositeUploadJob = new CompositeUploadJob(deviceId(), true);
+                m_compositeUploadJob = new CompositeUploadJob(deviceId(), true, payloadServer());
+                m_compositeUploadJob->setMaxConcurrentJobs(KdeConnectConfig::instance()->getDeviceProperty(deviceId(), QStringLiteral("concurrentTransfers"),
+                                                               QString::number(CompositeUploadJob::s_defaultMaxConcurrentJobs)).toInt());
+                m_compositeUploadJob->setResumable(m_resumableTransfers);
+                m_compositeUploadJob->setPayloadHash(m_payloadHash);
+                m_compositeUploadJob->setBandwidthLimiter(bandwidthLimiter(), BandwidthLimiter::Bulk);
+                m_compositeUploadJob->setTransferScheduler(Daemon::instance()->transferScheduler());
             }
         
             m_compositeUploadJob->addSubjob(new UploadJob(np));
@@ -96,31 +150,51 @@ bool LanDeviceLink::sendPacket(NetworkPacket& np)
                 m_compositeUploadJob->start();
             }
         } else { //Infinite stream
-            CompositeUploadJob* fireAndForgetJob = new CompositeUploadJob(deviceId(), false);
+            CompositeUploadJob* fireAndForgetJob = new CompositeUploadJob(deviceId(), false, payloadServer());
+            fireAndForgetJob->setBandwidthLimiter(bandwidthLimiter(), BandwidthLimiter::priorityOf(np));
             fireAndForgetJob->addSubjob(new UploadJob(np));
             fireAndForgetJob->start();
         }
         
         return true;
     } else {
-        int written = m_socketLineReader->write(np.serialize());
-
         //Actually we can't detect if a packet is received or not. We keep TCP
         //"ESTABLISHED" connections that look legit (return true when we use them),
         //but that are actually broken (until keepalive detects that they are down).
-        return (written != -1);
+        return writePacket(np);
+    }
+}
+
+bool LanDeviceLink::writePacket(const NetworkPacket& np)
+{
+    const QByteArray data = np.serialize(encoding(), compression());
+    if (BandwidthLimiter* limiter = bandwidthLimiter()) {
+        //Interactive packets make bulk transfers yield
+        limiter->consume(data.size(), BandwidthLimiter::priorityOf(np));
     }
+    return m_socketLineReader->write(data) != -1;
 }
 
 void LanDeviceLink::dataReceived()
 {
-    if (m_socketLineReader->bytesAvailable() == 0) return;
+    //Handle everything we have in one go (there can be hundreds of packets after
+    //reconnecting), but let the event loop run after receiveBudget() of them
+    for (int i = 0; i < receiveBudget() && m_socketLineReader->bytesAvailable() > 0; ++i) {
+        packetReceived(m_socketLineReader->readPacket());
+    }
+
+    if (m_socketLineReader->bytesAvailable() > 0) {
+        QMetaObject::invokeMethod(this, "dataReceived", Qt::QueuedConnection);
+    }
+}
 
-    const QByteArray serializedPacket = m_socketLineReader->readLine();
+void LanDeviceLink::packetReceived(const PacketFramer::PacketView& serializedPacket)
+{
     NetworkPacket packet((QString()));
-    NetworkPacket::unserialize(serializedPacket, &packet);
+    //No copy, unserialize() copies what it keeps and the view isn't used after it
+    NetworkPacket::unserialize(QByteArray::fromRawData(serializedPacket.data, serializedPacket.size), &packet, encoding());
 
-    //qCDebug(KDECONNECT_CORE) << "LanDeviceLink dataReceived" << serializedPacket;
+    //qCDebug(KDECONNECT_CORE) << "LanDeviceLink dataReceived" << packet;
 
     if (packet.type() == PACKET_TYPE_PAIR) {
         //TODO: Handle pair/unpair requests and forward them (to the pairing handler?)
@@ -128,11 +202,20 @@ void LanDeviceLink::dataReceived()
         return;
     }
 
-    if (packet.hasPayloadTransferInfo()) {
+    if (m_payloadMultiplexer->packetReceived(packet)) {
+        return;
+    }
+
+    if (packet.hasInlinePayload()) {
+        packet.extractInlinePayload();
+    } else if (packet.hasPayloadTransferInfo() && packet.payloadTransferInfo().contains(QStringLiteral("channel"))) {
+        packet.setPayload(m_payloadMultiplexer->receivePayload(packet), packet.payloadSize());
+    } else if (packet.hasPayloadTransferInfo()) {
         //qCDebug(KDECONNECT_CORE) << "HasPayloadTransferInfo";
         const QVariantMap transferInfo = packet.payloadTransferInfo();
 
         QSharedPointer<QSslSocket> socket(new QSslSocket);
+        socket->setReadBufferSize(s_payloadReadBufferSize);
 
         LanLinkProvider::configureSslSocket(socket.data(), deviceId(), true);
 
@@ -142,16 +225,20 @@ void LanDeviceLink::dataReceived()
 
         const QString address = m_socketLineReader->peerAddress().toString();
         const quint16 port = transferInfo[QStringLiteral("port")].toInt();
+        const QByteArray token = transferInfo.value(QStringLiteral("token")).toString().toLatin1();
+        if (!token.isEmpty()) {
+            //We stay the TLS client, so our session with the device can be resumed, and tell
+            //the shared payload server which transfer this is once the handshake is done
+            QSslSocket* rawSocket = socket.data();
+            connect(rawSocket, &QSslSocket::encrypted, rawSocket, [rawSocket, token]() {
+                rawSocket->write(token + '\n');
+            });
+        }
         socket->connectToHostEncrypted(address, port, QIODevice::ReadWrite);
         packet.setPayload(socket, packet.payloadSize());
     }
 
     Q_EMIT receivedPacket(packet);
-
-    if (m_socketLineReader->bytesAvailable() > 0) {
-        QMetaObject::invokeMethod(this, "dataReceived", Qt::QueuedConnection);
-    }
-
 }
 
 void LanDeviceLink::userRequestsPair()
@@ -181,6 +268,7 @@ void LanDeviceLink::setPairStatus(PairStatus status)
         Q_ASSERT(!m_socketLineReader->peerCertificate().isNull());
         KdeConnectConfig::instance()->setDeviceProperty(deviceId(), QStringLiteral("certificate"), m_socketLineReader->peerCertificate().toPem());
     }
+    LanLinkProvider::invalidateSslConfiguration(deviceId());
 }
 
 bool LanDeviceLink::linkShouldBeKeptAlive() {
@@ -31,6 +31,8 @@
 #include "backends/devicelink.h"
 #include "uploadjob.h"
 #include "compositeuploadjob.h"
+#include "payloadmultiplexer.h"
+#include "backends/packetframer.h"
 
 class SocketLineReader;
 
@@ -47,6 +49,7 @@ public:
 
     QString name() override;
     bool sendPacket(NetworkPacket& np) override;
+    void setEncoding(NetworkPacket::Encoding encoding) override;
 
     void userRequestsPair() override;
     void userRequestsUnpair() override;
@@ -57,14 +60,32 @@ public:
 
     QHostAddress hostAddress() const;
 
+    //Whether the other device can connect to our shared PayloadServer, see CompositeUploadJob
+    void setPayloadTransferTokens(bool supported) { m_payloadTransferTokens = supported; }
+    //Whether small payloads can be sent over this connection, see PayloadMultiplexer
+    void setPayloadChannels(bool supported) { m_payloadChannels = supported; }
+    //Whether the other device can resume broken shares, see FileTransferJob
+    void setResumableTransfers(bool supported) { m_resumableTransfers = supported; }
+    //Hash algorithm to verify the shared files with, empty if there is none in common
+    void setPayloadHash(const QString& algorithm) { m_payloadHash = algorithm; }
+
 private Q_SLOTS:
     void dataReceived();
 
 private:
+    void packetReceived(const PacketFramer::PacketView& serializedPacket);
+    PayloadServer* payloadServer();
+    bool writePacket(const NetworkPacket& np);
+
     SocketLineReader* m_socketLineReader;
     ConnectionStarted m_connectionSource;
     QHostAddress m_hostAddress;
     QPointer<CompositeUploadJob> m_compositeUploadJob;
+    bool m_payloadTransferTokens;
+    PayloadMultiplexer* m_payloadMultiplexer;
+    bool m_payloadChannels;
+    bool m_resumableTransfers;
+    QString m_payloadHash;
 };
 
 #endif
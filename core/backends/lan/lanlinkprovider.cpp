@@ -37,11 +37,14 @@
 #include <QNetworkConfigurationManager>
 #include <QSslCipher>
 #include <QSslConfiguration>
+#include <QSslKey>
+#include <QElapsedTimer>
 
 #include "daemon.h"
 #include "landevicelink.h"
 #include "lanpairinghandler.h"
 #include "kdeconnectconfig.h"
+#include "payloadhasher.h"
 
 #define MIN_VERSION_WITH_SSL_SUPPORT 6
 
@@ -51,6 +54,7 @@ LanLinkProvider::LanLinkProvider(
         quint16 udpListenPort
     )
     : m_server(new Server(this))
+    , m_payloadServer(new PayloadServer(this))
     , m_udpSocket(this)
     , m_tcpPort(0)
     , m_udpBroadcastPort(udpBroadcastPort)
@@ -115,6 +119,9 @@ void LanLinkProvider::onStart()
         }
     }
 
+    //Uploads to devices that don't support transfer tokens still work if this fails
+    m_payloadServer->listen(bindAddress);
+
     onNetworkChange();
     qCDebug(KDECONNECT_CORE) << "LanLinkProvider started";
 }
@@ -123,6 +130,7 @@ void LanLinkProvider::onStop()
 {
     m_udpSocket.close();
     m_server->close();
+    m_payloadServer->close();
     qCDebug(KDECONNECT_CORE) << "LanLinkProvider stopped";
 }
 
@@ -136,6 +144,16 @@ void LanLinkProvider::onNetworkChange()
 }
 
 //I'm in a new network, let's be polite and introduce myself
+void LanLinkProvider::createIdentityPacket(NetworkPacket* np)
+{
+    NetworkPacket::createIdentityPacket(np);
+    //What we support on top of the plain protocol, see addLink()
+    np->set(QStringLiteral("payloadTransferTokens"), true);
+    np->set(QStringLiteral("payloadChannels"), true);
+    np->set(QStringLiteral("resumableTransfers"), true);
+    np->set(QStringLiteral("payloadHashes"), PayloadHasher::supportedAlgorithms());
+}
+
 void LanLinkProvider::broadcastToNetwork()
 {
 
@@ -151,7 +169,7 @@ void LanLinkProvider::broadcastToNetwork()
     QHostAddress destAddress = m_testMode? QHostAddress::LocalHost : QHostAddress(QStringLiteral("255.255.255.255"));
 
     NetworkPacket np(QLatin1String(""));
-    NetworkPacket::createIdentityPacket(&np);
+    createIdentityPacket(&np);
     np.set(QStringLiteral("tcpPort"), m_tcpPort);
 
 #ifdef Q_OS_WIN
@@ -240,7 +258,7 @@ void LanLinkProvider::connectError(QAbstractSocket::SocketError socketError)
     qCDebug(KDECONNECT_CORE) << "Socket error" << socketError;
     qCDebug(KDECONNECT_CORE) << "Fallback (1), try reverse connection (send udp packet)" << socket->errorString();
     NetworkPacket np(QLatin1String(""));
-    NetworkPacket::createIdentityPacket(&np);
+    createIdentityPacket(&np);
     np.set(QStringLiteral("tcpPort"), m_tcpPort);
     m_udpSocket.writeDatagram(np.serialize(), m_receivedIdentityPackets[socket].sender, m_udpBroadcastPort);
 
@@ -270,7 +288,7 @@ void LanLinkProvider::tcpSocketConnected()
 
     // If network is on ssl, do not believe when they are connected, believe when handshake is completed
     NetworkPacket np2(QLatin1String(""));
-    NetworkPacket::createIdentityPacket(&np2);
+    createIdentityPacket(&np2);
     socket->write(np2.serialize());
     bool success = socket->waitForBytesWritten();
 
@@ -440,30 +458,99 @@ void LanLinkProvider::deviceLinkDestroyed(QObject* destroyedDeviceLink)
 
 }
 
-void LanLinkProvider::configureSslSocket(QSslSocket* socket, const QString& deviceId, bool isDeviceTrusted)
+//Last TLS session with each trusted device, so the next connections we start can resume
+//it instead of doing a full handshake. Only client sockets can use it: Qt creates a new
+//context for every server socket, so the sessions they issue can't be resumed.
+static QHash<QString, QByteArray>& tlsSessions()
 {
-    // Setting supported ciphers manually, to match those on Android (FIXME: Test if this can be left unconfigured and still works for Android 4)
-    QList<QSslCipher> socketCiphers;
-    socketCiphers.append(QSslCipher(QStringLiteral("ECDHE-ECDSA-AES256-GCM-SHA384")));
-    socketCiphers.append(QSslCipher(QStringLiteral("ECDHE-ECDSA-AES128-GCM-SHA256")));
-    socketCiphers.append(QSslCipher(QStringLiteral("ECDHE-RSA-AES128-SHA")));
-
-    // Configure for ssl
-    QSslConfiguration sslConfig;
-    sslConfig.setCiphers(socketCiphers);
-
-    socket->setSslConfiguration(sslConfig);
-    socket->setLocalCertificate(KdeConnectConfig::instance()->certificate());
-    socket->setPrivateKey(KdeConnectConfig::instance()->privateKeyPath());
-    socket->setPeerVerifyName(deviceId);
+    static QHash<QString, QByteArray> sessions;
+    return sessions;
+}
 
+//Configuration shared by all the sockets, built once so we don't parse our key and certificate for every connection
+static const QSslConfiguration& untrustedSslConfiguration()
+{
+    static const QSslConfiguration sslConfig = [] {
+        // Setting supported ciphers manually, to match those on Android (FIXME: Test if this can be left unconfigured and still works for Android 4)
+        QList<QSslCipher> socketCiphers;
+        socketCiphers.append(QSslCipher(QStringLiteral("ECDHE-ECDSA-AES256-GCM-SHA384")));
+        socketCiphers.append(QSslCipher(QStringLiteral("ECDHE-ECDSA-AES128-GCM-SHA256")));
+        socketCiphers.append(QSslCipher(QStringLiteral("ECDHE-RSA-AES128-SHA")));
+
+        QSslConfiguration config;
+        config.setCiphers(socketCiphers);
+        config.setLocalCertificate(KdeConnectConfig::instance()->certificate());
+        config.setPrivateKey(KdeConnectConfig::instance()->privateKey());
+        config.setPeerVerifyMode(QSslSocket::QueryPeer);
+        return config;
+    }();
+    return sslConfig;
+}
+
+//Same thing for trusted devices, also with their certificate already parsed. Each one remembers the
+//certificate it was built from, so it isn't used anymore once the device is unpaired or its certificate changes
+struct TrustedSslConfiguration {
+    QString certificate;
+    QSslConfiguration config;
+};
+
+static QHash<QString, TrustedSslConfiguration>& trustedSslConfigurations()
+{
+    static QHash<QString, TrustedSslConfiguration> configs;
+    return configs;
+}
+
+static QSslConfiguration trustedSslConfiguration(const QString& deviceId)
+{
+    const QString certString = KdeConnectConfig::instance()->getDeviceProperty(deviceId, QStringLiteral("certificate"), QString());
+    auto it = trustedSslConfigurations().constFind(deviceId);
+    if (it != trustedSslConfigurations().constEnd() && it->certificate == certString) {
+        return it->config;
+    }
+
+    //A session negotiated with another certificate must not be resumed
+    tlsSessions().remove(deviceId);
+
+    QSslConfiguration config = untrustedSslConfiguration();
+    config.setCaCertificates({QSslCertificate(certString.toLatin1())});
+    config.setPeerVerifyMode(QSslSocket::VerifyPeer);
+    config.setSslOption(QSsl::SslOptionDisableSessionPersistence, false);
+    trustedSslConfigurations().insert(deviceId, {certString, config});
+    return config;
+}
+
+void LanLinkProvider::invalidateSslConfiguration(const QString& deviceId)
+{
+    trustedSslConfigurations().remove(deviceId);
+    tlsSessions().remove(deviceId);
+}
+
+void LanLinkProvider::configureSslSocket(QSslSocket* socket, const QString& deviceId, bool isDeviceTrusted)
+{
+    QByteArray tlsSession;
     if (isDeviceTrusted) {
-        QString certString = KdeConnectConfig::instance()->getDeviceProperty(deviceId, QStringLiteral("certificate"), QString());
-        socket->addCaCertificate(QSslCertificate(certString.toLatin1()));
-        socket->setPeerVerifyMode(QSslSocket::VerifyPeer);
+        QSslConfiguration sslConfig = trustedSslConfiguration(deviceId);
+        tlsSession = tlsSessions().value(deviceId);
+        sslConfig.setSessionTicket(tlsSession);
+        socket->setSslConfiguration(sslConfig);
     } else {
-        socket->setPeerVerifyMode(QSslSocket::QueryPeer);
+        socket->setSslConfiguration(untrustedSslConfiguration());
     }
+    socket->setPeerVerifyName(deviceId);
+
+    //The handshake starts right after this, time it to see what resuming sessions saves
+    QElapsedTimer handshakeTimer;
+    handshakeTimer.start();
+    QObject::connect(socket, &QSslSocket::encrypted, socket, [socket, deviceId, isDeviceTrusted, tlsSession, handshakeTimer]() {
+        qCDebug(KDECONNECT_CORE) << "TLS handshake with" << deviceId << "took" << handshakeTimer.elapsed() << "ms"
+                                 << (tlsSession.isEmpty() ? "" : "(resuming a session)");
+        if (isDeviceTrusted && socket->mode() == QSslSocket::SslClientMode) {
+            const QByteArray newSession = socket->sslConfiguration().sessionTicket();
+            if (!newSession.isEmpty()) {
+                tlsSessions().insert(deviceId, newSession);
+            }
+        }
+    });
 
     //Usually SSL errors are only bad for trusted devices. Uncomment this section to log errors in any case, for debugging.
     //QObject::connect(socket, static_cast<void (QSslSocket::*)(const QList<QSslError>&)>(&QSslSocket::sslErrors), [](const QList<QSslError>& errors)
@@ -523,6 +610,14 @@ void LanLinkProvider::addLink(const QString& deviceId, QSslSocket* socket, Netwo
             m_pairingHandlers[deviceId]->setDeviceLink(deviceLink);
         }
     }
+    //Both sides have seen each other's identity before the TLS handshake, so they agree on this
+    deviceLink->setEncoding(NetworkPacket::negotiateEncoding(*receivedPacket));
+    deviceLink->setCompression(NetworkPacket::negotiateCompression(*receivedPacket));
+    deviceLink->setInlinePayloadSize(NetworkPacket::negotiateInlinePayloadSize(*receivedPacket));
+    deviceLink->setPayloadTransferTokens(receivedPacket->get<bool>(QStringLiteral("payloadTransferTokens")));
+    deviceLink->setPayloadChannels(receivedPacket->get<bool>(QStringLiteral("payloadChannels")));
+    deviceLink->setResumableTransfers(receivedPacket->get<bool>(QStringLiteral("resumableTransfers")));
+    deviceLink->setPayloadHash(PayloadHasher::negotiateAlgorithm(receivedPacket->get<QStringList>(QStringLiteral("payloadHashes"))));
     Q_EMIT onConnectionReceived(*receivedPacket, deviceLink);
 }
 
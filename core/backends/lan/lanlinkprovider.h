@@ -31,6 +31,7 @@
 #include "kdeconnectcore_export.h"
 #include "backends/linkprovider.h"
 #include "server.h"
+#include "payloadserver.h"
 #include "landevicelink.h"
 
 class LanPairingHandler;
@@ -60,8 +61,12 @@ public:
     void incomingPairPacket(DeviceLink* device, const NetworkPacket& np);
 
     static void configureSslSocket(QSslSocket* socket, const QString& deviceId, bool isDeviceTrusted);
+    //Drops the cached TLS state for the device. A changed certificate is noticed anyway, this also forgets the session
+    static void invalidateSslConfiguration(const QString& deviceId);
     static void configureSocket(QSslSocket* socket);
 
+    PayloadServer* payloadServer() const { return m_payloadServer; }
+
     /**
      * This is the default UDP port both for broadcasting and receiving identity packets
      */
@@ -86,12 +91,15 @@ private Q_SLOTS:
     void broadcastToNetwork();
 
 private:
+    //Adds the lan specific fields to NetworkPacket::createIdentityPacket()
+    static void createIdentityPacket(NetworkPacket* np);
     LanPairingHandler* createPairingHandler(DeviceLink* link);
 
     void onNetworkConfigurationChanged(const QNetworkConfiguration& config);
     void addLink(const QString& deviceId, QSslSocket* socket, NetworkPacket* receivedPacket, LanDeviceLink::ConnectionStarted connectionOrigin);
 
     Server* m_server;
+    PayloadServer* m_payloadServer;
     QUdpSocket m_udpSocket;
     quint16 m_tcpPort;
 
@@ -0,0 +1,245 @@
+/**
+ * Copyright 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "payloadmultiplexer.h"
+
+#include <QIODevice>
+
+#include "core_debug.h"
+#include "networkpackettypes.h"
+#include "socketlinereader.h"
+
+const qint64 PayloadMultiplexer::s_maxPayloadSize = 1024 * 1024;
+const int PayloadMultiplexer::s_chunkSize = 16 * 1024;
+const int PayloadMultiplexer::s_maxPendingBytes = 4 * s_chunkSize;
+
+/*
+ * The payload of a received packet, filled by the kdeconnect.payload packets of its
+ * channel. Like a socket it's sequential and finishes when all the data arrived.
+ */
+class PayloadChannelDevice
+    : public QIODevice
+{
+public:
+    explicit PayloadChannelDevice(qint64 size)
+        : m_pos(0)
+        , m_remaining(size)
+    {
+        open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+    }
+
+    bool isSequential() const override { return true; }
+    qint64 bytesAvailable() const override { return m_buffer.size() - m_pos + QIODevice::bytesAvailable(); }
+    bool atEnd() const override { return m_remaining <= 0 && bytesAvailable() == 0; }
+    bool isComplete() const { return m_remaining <= 0; }
+
+    void append(const QByteArray& data)
+    {
+        //Forget what was read already instead of growing the buffer forever
+        if (m_pos == m_buffer.size()) {
+            m_buffer.clear();
+            m_pos = 0;
+        }
+        m_buffer.append(data.left(qMax<qint64>(0, m_remaining)));
+        m_remaining -= data.size();
+        Q_EMIT readyRead();
+        if (m_remaining <= 0) {
+            Q_EMIT readChannelFinished();
+        }
+    }
+
+    void abort()
+    {
+        m_remaining = 0;
+        Q_EMIT readChannelFinished();
+    }
+
+protected:
+    qint64 readData(char* data, qint64 maxSize) override
+    {
+        const qint64 size = qMin<qint64>(maxSize, m_buffer.size() - m_pos);
+        if (size == 0) {
+            return isComplete() ? -1 : 0;
+        }
+        memcpy(data, m_buffer.constData() + m_pos, size);
+        m_pos += size;
+        return size;
+    }
+
+    qint64 writeData(const char* data, qint64 maxSize) override
+    {
+        Q_UNUSED(data);
+        Q_UNUSED(maxSize);
+        return -1;
+    }
+
+private:
+    QByteArray m_buffer;
+    int m_pos;
+    qint64 m_remaining;
+};
+
+PayloadMultiplexer::PayloadMultiplexer(QObject* parent)
+    : QObject(parent)
+    , m_encoding(NetworkPacket::JsonEncoding)
+    , m_lastChannel(0)
+{
+}
+
+PayloadMultiplexer::~PayloadMultiplexer()
+{
+    abortChannels();
+}
+
+void PayloadMultiplexer::setSocketLineReader(SocketLineReader* reader)
+{
+    //The other end of the previous connection is gone, and so are the channels
+    abortChannels();
+
+    m_reader = reader;
+    m_encoding = NetworkPacket::JsonEncoding;
+    connect(m_reader->m_socket, &QSslSocket::encryptedBytesWritten, this, &PayloadMultiplexer::writeChunks);
+}
+
+bool PayloadMultiplexer::canMultiplex(const NetworkPacket& np)
+{
+    //Sequential payloads could have nothing to read when it's their turn, and we can't wait for them
+    return np.payloadSize() >= 0 && np.payloadSize() <= s_maxPayloadSize && !np.payload()->isSequential();
+}
+
+QVariantMap PayloadMultiplexer::sendPayload(const NetworkPacket& np)
+{
+    const QSharedPointer<QIODevice> payload = np.payload();
+    if (!payload->isOpen() && !payload->open(QIODevice::ReadOnly)) {
+        qCWarning(KDECONNECT_CORE) << "PayloadMultiplexer - error when opening the payload to send";
+    }
+
+    const int id = ++m_lastChannel;
+    if (np.payloadSize() == 0) {
+        payload->close(); //Nothing to send, the other side knows it from the packet
+    } else {
+        m_outgoing.append({id, payload, np.payloadSize()});
+        //The packet announcing the channel goes first
+        QMetaObject::invokeMethod(this, "writeChunks", Qt::QueuedConnection);
+    }
+
+    return {{QStringLiteral("channel"), id}};
+}
+
+QSharedPointer<QIODevice> PayloadMultiplexer::receivePayload(const NetworkPacket& np)
+{
+    const int id = np.payloadTransferInfo().value(QStringLiteral("channel")).toInt();
+    PayloadChannelDevice* device = new PayloadChannelDevice(np.payloadSize());
+    if (device->isComplete()) {
+        device->abort(); //Empty payload, there won't be any data
+    } else {
+        m_incoming.insert(id, device);
+    }
+    return QSharedPointer<QIODevice>(device);
+}
+
+bool PayloadMultiplexer::packetReceived(const NetworkPacket& np)
+{
+    if (np.type() != PACKET_TYPE_PAYLOAD) {
+        return false;
+    }
+
+    const int id = np.get<int>(QStringLiteral("channel"));
+    PayloadChannelDevice* device = m_incoming.value(id);
+    if (!device) {
+        //Nobody wanted the payload, or the channel is unknown
+        m_incoming.remove(id);
+        return true;
+    }
+
+    if (np.get<bool>(QStringLiteral("aborted"))) {
+        qCDebug(KDECONNECT_CORE) << "PayloadMultiplexer - channel" << id << "aborted by the other device";
+        device->abort();
+    } else if (m_encoding == NetworkPacket::CborEncoding) {
+        device->append(np.get<QByteArray>(QStringLiteral("data")));
+    } else {
+        device->append(QByteArray::fromBase64(np.get<QString>(QStringLiteral("data")).toLatin1()));
+    }
+
+    if (device->isComplete()) {
+        m_incoming.remove(id);
+    }
+    return true;
+}
+
+void PayloadMultiplexer::writeChunks()
+{
+    if (!m_reader) {
+        return;
+    }
+
+    QSslSocket* socket = m_reader->m_socket;
+    while (!m_outgoing.isEmpty() && socket->bytesToWrite() + socket->encryptedBytesToWrite() < s_maxPendingBytes) {
+        OutgoingChannel channel = m_outgoing.takeFirst();
+        const QByteArray data = channel.payload->read(qMin<qint64>(s_chunkSize, channel.remaining));
+
+        if (data.isEmpty()) {
+            qCWarning(KDECONNECT_CORE) << "PayloadMultiplexer - payload of channel" << channel.id << "is shorter than announced";
+            NetworkPacket np(PACKET_TYPE_PAYLOAD);
+            np.set(QStringLiteral("channel"), channel.id);
+            np.set(QStringLiteral("aborted"), true);
+            m_reader->write(np.serialize(m_encoding));
+            channel.payload->close();
+            continue;
+        }
+
+        writeData(channel.id, data);
+        channel.remaining -= data.size();
+
+        if (channel.remaining > 0) {
+            m_outgoing.append(channel); //Back to the end of the queue, so every channel gets its turn
+        } else {
+            channel.payload->close();
+        }
+    }
+}
+
+void PayloadMultiplexer::writeData(int channel, const QByteArray& data)
+{
+    NetworkPacket np(PACKET_TYPE_PAYLOAD);
+    np.set(QStringLiteral("channel"), channel);
+    if (m_encoding == NetworkPacket::CborEncoding) {
+        np.set(QStringLiteral("data"), data);
+    } else {
+        np.set(QStringLiteral("data"), QString::fromLatin1(data.toBase64()));
+    }
+    //Payloads are usually compressed already, so they are not deflated
+    m_reader->write(np.serialize(m_encoding));
+}
+
+void PayloadMultiplexer::abortChannels()
+{
+    for (const OutgoingChannel& channel : qAsConst(m_outgoing)) {
+        channel.payload->close();
+    }
+    m_outgoing.clear();
+
+    for (PayloadChannelDevice* device : qAsConst(m_incoming)) {
+        if (device) {
+            device->abort();
+        }
+    }
+    m_incoming.clear();
+}
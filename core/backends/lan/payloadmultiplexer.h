@@ -0,0 +1,93 @@
+/**
+ * Copyright 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef PAYLOADMULTIPLEXER_H
+#define PAYLOADMULTIPLEXER_H
+
+#include <QObject>
+#include <QHash>
+#include <QList>
+#include <QPointer>
+#include <QSharedPointer>
+
+#include "kdeconnectcore_export.h"
+#include "networkpacket.h"
+
+class QIODevice;
+class SocketLineReader;
+class PayloadChannelDevice;
+
+/*
+ * Sends small payloads over the control connection instead of opening a new
+ * connection, and doing a TLS handshake, for each of them. Like in the Bluetooth
+ * multiplexing protocol every payload gets its own channel: the packet announces
+ * it with a "channel" in its payloadTransferInfo and the data follows in
+ * kdeconnect.payload packets. Channels take turns to send a chunk and only a few
+ * chunks are kept in the socket buffer, so other packets never wait long behind them.
+ * There is no flow control, the receiver keeps what it didn't read in memory, that's
+ * why only payloads up to s_maxPayloadSize are multiplexed.
+ */
+class KDECONNECTCORE_EXPORT PayloadMultiplexer
+    : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit PayloadMultiplexer(QObject* parent = nullptr);
+    ~PayloadMultiplexer() override;
+
+    //Channels of a previous connection are aborted
+    void setSocketLineReader(SocketLineReader* reader);
+    void setEncoding(NetworkPacket::Encoding encoding) { m_encoding = encoding; }
+
+    static bool canMultiplex(const NetworkPacket& np);
+
+    //Returns the payloadTransferInfo for np, the data is sent once we get back to the event loop
+    QVariantMap sendPayload(const NetworkPacket& np);
+    QSharedPointer<QIODevice> receivePayload(const NetworkPacket& np);
+
+    //Returns whether np was payload data for one of our channels
+    bool packetReceived(const NetworkPacket& np);
+
+    const static qint64 s_maxPayloadSize;
+    const static int s_chunkSize;
+    const static int s_maxPendingBytes;
+
+private Q_SLOTS:
+    void writeChunks();
+
+private:
+    struct OutgoingChannel {
+        int id;
+        QSharedPointer<QIODevice> payload;
+        qint64 remaining;
+    };
+
+    void writeData(int channel, const QByteArray& data);
+    void abortChannels();
+
+    QPointer<SocketLineReader> m_reader;
+    NetworkPacket::Encoding m_encoding;
+    int m_lastChannel;
+    QList<OutgoingChannel> m_outgoing;
+    QHash<int, QPointer<PayloadChannelDevice>> m_incoming;
+};
+
+#endif
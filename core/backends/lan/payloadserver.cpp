@@ -0,0 +1,164 @@
+/**
+ * Copyright 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "payloadserver.h"
+
+#include <QNetworkProxy>
+#include <QSslSocket>
+#include <QTimer>
+#include <QUuid>
+
+#include "core_debug.h"
+#include "server.h"
+#include "compositeuploadjob.h"
+#include "kerneltlssocket.h"
+#include "lanlinkprovider.h"
+
+//Connections that don't finish the handshake and send a token in this time are dropped
+static const int s_tokenTimeoutMs = 10000;
+//Hex encoded 128 bits, plus the newline
+static const int s_tokenLineLength = 33;
+
+PayloadServer::PayloadServer(QObject* parent)
+    : QObject(parent)
+    , m_server(new Server(this))
+    , m_port(0)
+{
+    m_server->setProxy(QNetworkProxy::NoProxy);
+    connect(m_server, &QTcpServer::newConnection, this, &PayloadServer::newConnection);
+}
+
+bool PayloadServer::listen(const QHostAddress& address)
+{
+    m_port = MIN_PORT;
+    while (!m_server->listen(address, m_port)) {
+        m_port++;
+        if (m_port > MAX_PORT) { //No ports available?
+            qCWarning(KDECONNECT_CORE) << "PayloadServer::listen() - Error opening a port in range" << MIN_PORT << "-" << MAX_PORT;
+            m_port = 0;
+            return false;
+        }
+    }
+
+    qCDebug(KDECONNECT_CORE) << "PayloadServer::listen() - listening on port:" << m_port;
+    return true;
+}
+
+void PayloadServer::close()
+{
+    m_server->close();
+    m_port = 0;
+}
+
+bool PayloadServer::isListening() const
+{
+    return m_server->isListening();
+}
+
+QByteArray PayloadServer::addTransfer(CompositeUploadJob* job)
+{
+    //Forget about the jobs that finished without their transfer being used
+    for (auto it = m_transfers.begin(); it != m_transfers.end();) {
+        if (it->isNull()) {
+            it = m_transfers.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    const QByteArray token = QUuid::createUuid().toRfc4122().toHex();
+    m_transfers.insert(token, job);
+    return token;
+}
+
+void PayloadServer::removeTransfer(const QByteArray& token)
+{
+    m_transfers.remove(token);
+}
+
+void PayloadServer::newConnection()
+{
+    while (m_server->hasPendingConnections()) {
+        QSslSocket* sslSocket = m_server->nextPendingConnection();
+        //We don't know which device this is until we have the token, the job checks the certificate then
+#ifdef KDECONNECT_KTLS
+        if (KernelTlsSocket* kernelTlsSocket = KernelTlsSocket::takeOver(sslSocket, QString(), true)) {
+            kernelTlsSocket->setParent(this);
+            connect(kernelTlsSocket, &KernelTlsSocket::disconnected, kernelTlsSocket, &QObject::deleteLater);
+            waitForToken(kernelTlsSocket);
+            continue;
+        }
+#endif
+        //Server creates the sockets as children of its parent, that is us, until a job takes them
+        connect(sslSocket, &QAbstractSocket::disconnected, sslSocket, &QObject::deleteLater);
+        waitForToken(sslSocket);
+
+        LanLinkProvider::configureSslSocket(sslSocket, QString(), false);
+        sslSocket->startServerEncryption();
+    }
+}
+
+void PayloadServer::waitForToken(QIODevice* socket)
+{
+    connect(socket, &QIODevice::readyRead, this, [this, socket]() { tokenReceived(socket); });
+    QTimer::singleShot(s_tokenTimeoutMs, socket, [this, socket]() {
+        if (socket->parent() == this) {
+            qCDebug(KDECONNECT_CORE) << "PayloadServer - no token received in time";
+            socket->deleteLater();
+        }
+    });
+}
+
+void PayloadServer::tokenReceived(QIODevice* socket)
+{
+    //Only decrypted data makes it here, but better safe than sorry
+    QSslSocket* sslSocket = qobject_cast<QSslSocket*>(socket);
+    if (sslSocket && !sslSocket->isEncrypted()) {
+        socket->deleteLater();
+        return;
+    }
+
+    //KernelTlsSocket doesn't buffer through QIODevice, so no canReadLine(), tokens have a fixed length anyway
+    if (socket->bytesAvailable() < s_tokenLineLength) {
+        return;
+    }
+
+    disconnect(socket, nullptr, this, nullptr);
+    if (sslSocket) {
+        disconnect(sslSocket, &QAbstractSocket::disconnected, sslSocket, &QObject::deleteLater);
+    }
+#ifdef KDECONNECT_KTLS
+    else if (KernelTlsSocket* kernelTlsSocket = qobject_cast<KernelTlsSocket*>(socket)) {
+        disconnect(kernelTlsSocket, &KernelTlsSocket::disconnected, kernelTlsSocket, &QObject::deleteLater);
+    }
+#endif
+
+    const QByteArray line = socket->read(s_tokenLineLength);
+    const QByteArray token = line.left(s_tokenLineLength - 1);
+    const QPointer<CompositeUploadJob> job = m_transfers.value(token);
+    if (!line.endsWith('\n') || !job || !job->payloadConnection(socket, token)) {
+        //A token sent by the wrong device stays valid for the right one
+        qCWarning(KDECONNECT_CORE) << "PayloadServer - refusing transfer token";
+        socket->deleteLater();
+        return;
+    }
+
+    m_transfers.remove(token);
+}
@@ -0,0 +1,76 @@
+/**
+ * Copyright 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef PAYLOADSERVER_H
+#define PAYLOADSERVER_H
+
+#include <QObject>
+#include <QHash>
+#include <QPointer>
+#include <QHostAddress>
+
+#include "kdeconnectcore_export.h"
+
+class Server;
+class QIODevice;
+class CompositeUploadJob;
+
+/*
+ * Listens for the payload connections of all the upload jobs, so they don't need
+ * a server (and a port) each. Every transfer gets a random token that is sent to
+ * the other device in payloadTransferInfo. As for the payload connections of a single
+ * job, the side that connects is the TLS client, so it can resume its session with us.
+ * Once the handshake is done it sends the token back and we hand the socket (a
+ * KernelTlsSocket if we could take it over) to the job that registered it, which checks
+ * that the peer certificate is the one of the device it offered the transfer to.
+ */
+class KDECONNECTCORE_EXPORT PayloadServer
+    : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit PayloadServer(QObject* parent = nullptr);
+
+    bool listen(const QHostAddress& address);
+    void close();
+    bool isListening() const;
+    quint16 port() const { return m_port; }
+
+    //Tokens can only be used once
+    QByteArray addTransfer(CompositeUploadJob* job);
+    void removeTransfer(const QByteArray& token);
+
+    const static quint16 MIN_PORT = 1739;
+    const static quint16 MAX_PORT = 1764;
+
+private Q_SLOTS:
+    void newConnection();
+
+private:
+    void waitForToken(QIODevice* socket);
+    void tokenReceived(QIODevice* socket);
+
+    Server* m_server;
+    quint16 m_port;
+    QHash<QByteArray, QPointer<CompositeUploadJob>> m_transfers;
+};
+
+#endif
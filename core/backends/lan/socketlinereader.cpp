@@ -21,9 +21,12 @@
 
 #include "socketlinereader.h"
 
+#include "core_debug.h"
+
 SocketLineReader::SocketLineReader(QSslSocket* socket, QObject* parent)
     : QObject(parent)
     , m_socket(socket)
+    , m_encoding(NetworkPacket::JsonEncoding)
 {
     connect(m_socket, &QIODevice::readyRead,
             this, &SocketLineReader::dataReceived);
@@ -31,23 +34,15 @@ SocketLineReader::SocketLineReader(QSslSocket* socket, QObject* parent)
 
 void SocketLineReader::dataReceived()
 {
-    while (m_socket->canReadLine()) {
-        const QByteArray line = m_socket->readLine();
-        if (line.length() > 1) { //we don't want a single \n
-            m_packets.enqueue(line);
-        }
-    }
-
-    //If we still have things to read from the socket, call dataReceived again
-    //We do this manually because we do not trust readyRead to be emitted again
-    //So we call this method again just in case.
-    if (m_socket->bytesAvailable() > 0) {
-        QMetaObject::invokeMethod(this, "dataReceived", Qt::QueuedConnection);
+    //Everything available is read at once, so there is no need to call ourselves again
+    if (!m_framer.readFrom(m_socket)) {
+        qCWarning(KDECONNECT_CORE) << "Refusing a packet bigger than" << PacketFramer::s_maxPacketLength << "bytes from" << m_socket->peerAddress();
+        m_socket->disconnectFromHost();
         return;
     }
 
     //If we have any packets, tell it to the world.
-    if (!m_packets.isEmpty()) {
+    if (m_framer.packetCount() > 0) {
         Q_EMIT readyRead();
     }
 }
@@ -22,15 +22,17 @@
 #define SOCKETLINEREADER_H
 
 #include <QObject>
-#include <QQueue>
 #include <QSslSocket>
 #include <QHostAddress>
 
 #include <kdeconnectcore_export.h>
+#include "networkpacket.h"
+#include "backends/packetframer.h"
 
 /*
  * Encapsulates a QTcpSocket and implements the same methods of its API that are
  * used by LanDeviceLink, but readyRead is emitted only when a newline is found.
+ * With CBOR encoding packets are framed by a 32 bit big endian length instead.
  */
 class KDECONNECTCORE_EXPORT SocketLineReader
     : public QObject
@@ -40,11 +42,14 @@ class KDECONNECTCORE_EXPORT SocketLineReader
 public:
     explicit SocketLineReader(QSslSocket* socket, QObject* parent = nullptr);
 
-    QByteArray readLine() { return m_packets.dequeue(); }
-    qint64 write(const QByteArray& data) { return m_socket->write(data); }
+    QByteArray readLine() { return m_framer.takePacket().toByteArray(); }
+    //Without copying it, only valid until the next readyRead()
+    PacketFramer::PacketView readPacket() { return m_framer.takePacket(); }
+    qint64 write(const QByteArray& data) { return PacketFramer::write(m_socket, data, m_encoding); }
+    void setEncoding(NetworkPacket::Encoding encoding) { m_encoding = encoding; m_framer.setEncoding(encoding); }
     QHostAddress peerAddress() const { return m_socket->peerAddress(); }
     QSslCertificate peerCertificate() const { return m_socket->peerCertificate(); }
-    qint64 bytesAvailable() const { return m_packets.size(); }
+    qint64 bytesAvailable() const { return m_framer.packetCount(); }
 
     QSslSocket* m_socket;
     
@@ -55,8 +60,8 @@ private Q_SLOTS:
     void dataReceived();
 
 private:
-    QByteArray m_lastChunk;
-    QQueue<QByteArray> m_packets;
+    PacketFramer m_framer;
+    NetworkPacket::Encoding m_encoding;
 
 };
 
@@ -21,18 +21,63 @@
 #include "uploadjob.h"
 
 #include <KLocalizedString>
+#include <QFileDevice>
+#include <QtEndian>
 
 #include "lanlinkprovider.h"
 #include "kdeconnectconfig.h"
 #include "core_debug.h"
+#include "payloadhasher.h"
 #include <daemon.h>
 
+#ifdef KDECONNECT_KTLS
+#include "kerneltlssocket.h"
+#endif
+
+#ifdef Q_OS_LINUX
+#include <fcntl.h>
+#endif
+
+//The socket is kept between the low watermark (one chunk) and the high watermark
+//(s_watermarkChunks chunks) of pending data, so it never runs dry while we read more
+static const int s_watermarkChunks = 4;
+
+//Chunks hold ~s_chunkDurationMs worth of data at the measured drain rate, between
+//a TLS record and s_maxChunkSize. The rate is measured over s_drainWindowMs.
+static const qint64 s_minChunkSize = 16 * 1024;
+static const qint64 s_maxChunkSize = 1024 * 1024;
+static const qint64 s_chunkDurationMs = 20;
+static const qint64 s_drainWindowMs = 100;
+
+const int UploadJob::s_defaultSendBufferSize = 1024 * 1024;
+
 UploadJob::UploadJob(const NetworkPacket& networkPacket)
     : KJob()
     , m_networkPacket(networkPacket)
     , m_input(networkPacket.payload())
     , m_socket(nullptr)
+    , m_kernelTlsSocket(nullptr)
+    , m_bytesWritten(0)
+    , m_chunkSize(s_minChunkSize)
+    , m_sendBufferSize(s_defaultSendBufferSize)
+    , m_drainedBytes(0)
+    , m_resumable(false)
+    , m_finishing(false)
+    , m_bytesQueued(0)
+    , m_bytesDrained(0)
+    , m_priority(BandwidthLimiter::Bulk)
+{
+}
+
+void UploadJob::setPayloadHash(const QString& algorithm)
 {
+    m_hash.reset(new QCryptographicHash(PayloadHasher::algorithm(algorithm)));
+}
+
+void UploadJob::setBandwidthLimiter(BandwidthLimiter* limiter, BandwidthLimiter::Priority priority)
+{
+    m_limiter = limiter;
+    m_priority = priority;
 }
 
 void UploadJob::setSocket(QSslSocket* socket)
@@ -41,6 +86,35 @@ void UploadJob::setSocket(QSslSocket* socket)
     m_socket->setParent(this);
 }
 
+#ifdef KDECONNECT_KTLS
+void UploadJob::setKernelTlsSocket(KernelTlsSocket* socket)
+{
+    m_kernelTlsSocket = socket;
+    m_kernelTlsSocket->setParent(this);
+    connect(m_kernelTlsSocket, &KernelTlsSocket::disconnected, this, [this]() {
+        //The other side went away before it got everything
+        if (m_input->isOpen()) {
+            failUpload();
+        }
+    });
+}
+#endif
+
+bool UploadJob::sendsFile() const
+{
+    return qobject_cast<QFileDevice*>(m_input.data());
+}
+
+QIODevice* UploadJob::socketDevice() const
+{
+#ifdef KDECONNECT_KTLS
+    if (m_kernelTlsSocket) {
+        return m_kernelTlsSocket;
+    }
+#endif
+    return m_socket;
+}
+
 void UploadJob::start()
 {
      if (!m_input->open(QIODevice::ReadOnly)) {
@@ -48,51 +122,364 @@ void UploadJob::start()
         return; //TODO: Handle error, clean up...
     }
     
-    if (!m_socket) {
+    if (!socketDevice()) {
         qCWarning(KDECONNECT_CORE) << "you must call setSocket() before calling start()";
         return;
     }
 
     connect(m_input.data(), &QIODevice::aboutToClose, this, &UploadJob::aboutToClose);
-    
-    bytesUploaded = 0;
-    setProcessedAmount(Bytes, bytesUploaded);
-    
+    adviseSequentialRead();
+
+    m_bytesWritten = 0;
+    setProcessedAmount(Bytes, m_bytesWritten);
+
+    if (m_socket) {
+        m_socket->setSocketOption(QAbstractSocket::SendBufferSizeSocketOption, m_sendBufferSize);
+    }
+
+    if (m_resumable) {
+        connect(socketDevice(), &QIODevice::readyRead, this, &UploadJob::offsetReceived);
+        offsetReceived();
+    } else {
+        startUpload();
+    }
+}
+
+void UploadJob::adviseSequentialRead()
+{
+    //Files aren't mapped: a file truncated while we send it (as editors do when saving)
+    //would raise SIGBUS. QSslSocket copies what we write anyway, so reading costs little more.
+    QFileDevice* file = qobject_cast<QFileDevice*>(m_input.data());
+    if (!file) {
+        return;
+    }
+
+#ifdef Q_OS_LINUX
+    //Let the kernel read ahead, it helps a lot with spinning disks and network mounts
+    posix_fadvise(file->handle(), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+}
+
+void UploadJob::offsetReceived()
+{
+    quint64 offset;
+    QIODevice* socket = socketDevice();
+    if (socket->bytesAvailable() < static_cast<qint64>(sizeof(offset))) {
+        return;
+    }
+    disconnect(socket, &QIODevice::readyRead, this, &UploadJob::offsetReceived);
+
+    socket->read(reinterpret_cast<char*>(&offset), sizeof(offset));
+    offset = qFromBigEndian(offset);
+
+    if (offset > 0) {
+        if (static_cast<qint64>(offset) >= m_networkPacket.payloadSize() || (m_hash && !hashFirstBytes(offset)) || !m_input->seek(offset)) {
+            qCWarning(KDECONNECT_CORE) << "UploadJob - can't resume the upload from offset" << offset;
+            setError(UserDefinedError);
+            setErrorText(i18n("Couldn't resume the transfer"));
+            m_input->close(); //Disconnects and emits the result, the receiver sees the file is incomplete
+            return;
+        }
+        qCDebug(KDECONNECT_CORE) << "UploadJob - resuming the upload from offset" << offset;
+        m_bytesWritten = offset;
+        setProcessedAmount(Bytes, m_bytesWritten);
+    }
+
+    startUpload();
+}
+
+bool UploadJob::hashFirstBytes(qint64 size)
+{
+    //The receiver checks the whole file, including the part it already has
+    if (!m_input->seek(0)) {
+        return false;
+    }
+    while (size > 0) {
+        const QByteArray data = m_input->read(qMin(size, s_maxChunkSize));
+        if (data.isEmpty()) {
+            return false;
+        }
+        m_hash->addData(data);
+        size -= data.size();
+    }
+    return true;
+}
+
+void UploadJob::startUpload()
+{
+#ifdef KDECONNECT_KTLS
+    if (m_kernelTlsSocket && sendsFile()) {
+        connect(m_kernelTlsSocket, &KernelTlsSocket::writable, this, &UploadJob::sendFileChunks);
+        if (m_limiter) {
+            connect(m_limiter.data(), &BandwidthLimiter::ready, this, &UploadJob::sendFileChunks);
+        }
+        sendFileChunks();
+        return;
+    } else if (m_kernelTlsSocket) {
+        //Anything else is written through it like through a QSslSocket
+        connect(m_kernelTlsSocket, &KernelTlsSocket::writable, this, &UploadJob::kernelTlsWritable);
+        if (m_limiter) {
+            connect(m_limiter.data(), &BandwidthLimiter::ready, this, &UploadJob::uploadNextPacket);
+        }
+        m_drainTimer.start();
+        uploadNextPacket();
+        return;
+    }
+#endif
+
     connect(m_socket, &QSslSocket::encryptedBytesWritten, this, &UploadJob::encryptedBytesWritten);
-        
+    connect(m_socket, &QAbstractSocket::disconnected, this, [this]() {
+        //The other side went away before it got everything
+        if (m_input->isOpen()) {
+            failUpload();
+        }
+    });
+    if (m_limiter) {
+        connect(m_limiter.data(), &BandwidthLimiter::ready, this, &UploadJob::uploadNextPacket);
+    }
+
+    m_drainTimer.start();
     uploadNextPacket();
 }
 
+qint64 UploadJob::pendingBytes() const
+{
+#ifdef KDECONNECT_KTLS
+    if (m_kernelTlsSocket) {
+        //What OpenSSL couldn't hand to the kernel yet
+        return m_kernelTlsSocket->bytesToWrite();
+    }
+#endif
+    //Plain text not encrypted yet plus encrypted data not sent yet
+    return m_socket->bytesToWrite() + m_socket->encryptedBytesToWrite();
+}
+
+void UploadJob::abortSocket()
+{
+    disconnect(socketDevice(), nullptr, this, nullptr);
+#ifdef KDECONNECT_KTLS
+    if (m_kernelTlsSocket) {
+        m_kernelTlsSocket->abort();
+        return;
+    }
+#endif
+    m_socket->abort();
+}
+
+qint64 UploadJob::allowedChunkSize(qint64 chunkSize) const
+{
+    if (!m_limiter || m_priority != BandwidthLimiter::Bulk) {
+        return chunkSize;
+    }
+    const qint64 allowance = m_limiter->allowance();
+    return (allowance < 0) ? chunkSize : qMin(chunkSize, allowance);
+}
+
 void UploadJob::uploadNextPacket()
 {
-    qint64 bytesAvailable = m_input->bytesAvailable();
+    if (!m_input->isOpen() || m_finishing) {
+        return; //Done, the limiter might still wake us up
+    }
 
-    if ( bytesAvailable > 0) {
-        qint64 bytesToSend = qMin(m_input->bytesAvailable(), (qint64)4096);
-        bytesUploading = m_socket->write(m_input->read(bytesToSend));
+    const qint64 highWatermark = s_watermarkChunks * m_chunkSize;
+    while (pendingBytes() < highWatermark) {
+        const qint64 maxSize = allowedChunkSize(m_chunkSize);
+        if (maxSize == 0) {
+            m_limiter->waitForAllowance();
+            return;
+        }
+
+        const qint64 written = writeNextChunk(maxSize);
+        if (written <= 0) {
+            if (!sentEverything()) {
+                abortSocket();
+                failUpload();
+                return;
+            }
+            //Everything is queued, we are done once the socket sent it, see socketDrained()
+            if (m_hash) {
+                const QByteArray hash = m_hash->result();
+                writeToSocket(hash.constData(), hash.size());
+            }
+            m_finishing = true;
+            if (pendingBytes() == 0) {
+                m_input->close();
+            }
+            return;
+        }
+        m_bytesWritten += written;
+        if (m_limiter) {
+            m_limiter->consume(written, m_priority);
+        }
     }
-    
-    if (bytesAvailable <= 0 || bytesUploading < 0) {
-        m_input->close();
-        disconnect(m_socket, &QSslSocket::encryptedBytesWritten, this, &UploadJob::encryptedBytesWritten);
+}
+
+qint64 UploadJob::writeNextChunk(qint64 maxSize)
+{
+    const qint64 bytesToSend = qMin(m_input->bytesAvailable(), maxSize);
+    if (bytesToSend <= 0) {
+        return -1;
+    }
+
+    //The buffer keeps its capacity, so it is only allocated for the first chunks
+    m_readBuffer.resize(static_cast<int>(bytesToSend));
+    const qint64 read = m_input->read(m_readBuffer.data(), bytesToSend);
+    if (read <= 0 || writeToSocket(m_readBuffer.constData(), read) != read) {
+        return -1;
+    }
+    if (m_hash) {
+        m_hash->addData(m_readBuffer.constData(), static_cast<int>(read));
+    }
+    return read;
+}
+
+qint64 UploadJob::writeToSocket(const char* data, qint64 size)
+{
+    const qint64 written = socketDevice()->write(data, size);
+    if (written > 0) {
+        m_bytesQueued += written;
     }
+    return written;
+}
+
+#ifdef KDECONNECT_KTLS
+void UploadJob::sendFileChunks()
+{
+    if (!m_input->isOpen()) {
+        return; //Done, the limiter might still wake us up
+    }
+
+    QFileDevice* file = static_cast<QFileDevice*>(m_input.data());
+    const qint64 size = file->size();
+    qint64 sent = 0;
+    while (m_bytesWritten < size) {
+        const qint64 maxSize = allowedChunkSize(s_maxChunkSize);
+        if (maxSize == 0) {
+            m_limiter->waitForAllowance();
+            return;
+        }
+
+        //The kernel encrypts and sends it straight from the page cache
+        sent = m_kernelTlsSocket->sendFile(file->handle(), m_bytesWritten, qMin(size - m_bytesWritten, maxSize));
+        if (sent == 0) {
+            return; //Continues once the socket is writable
+        }
+        if (sent < 0) {
+            break;
+        }
+
+        if (m_hash) {
+            file->seek(m_bytesWritten);
+            m_hash->addData(file->read(sent));
+        }
+        m_bytesWritten += sent;
+        if (m_limiter) {
+            m_limiter->consume(sent, m_priority);
+        }
+        setProcessedAmount(Bytes, m_bytesWritten);
+    }
+
+    //Either we are done or something failed, same as uploadNextPacket()
+    disconnect(m_kernelTlsSocket, &KernelTlsSocket::writable, this, &UploadJob::sendFileChunks);
+    if (sent < 0 || !sentEverything()) {
+        m_kernelTlsSocket->abort();
+        failUpload();
+        return;
+    }
+    if (m_hash) {
+        m_kernelTlsSocket->write(m_hash->result());
+    }
+    m_input->close();
+}
+#endif
+
+bool UploadJob::sentEverything() const
+{
+    const qint64 size = m_networkPacket.payloadSize();
+    return (size < 0) ? m_input->atEnd() : (m_bytesWritten == size);
+}
+
+void UploadJob::failUpload()
+{
+    //The connection is already aborted, so the other side can't take what it got for the whole payload
+    qCWarning(KDECONNECT_CORE) << "UploadJob - couldn't send the whole payload, stopped after" << m_bytesWritten
+                               << "of" << m_networkPacket.payloadSize() << "bytes" << m_input->errorString();
+    setError(UserDefinedError);
+    setErrorText(i18n("Couldn't send the whole file"));
+    setProcessedAmount(Bytes, m_bytesWritten);
+    m_input->close();
+}
+
+void UploadJob::adaptChunkSize(qint64 drainedBytes)
+{
+    m_drainedBytes += drainedBytes;
+    const qint64 elapsed = m_drainTimer.elapsed();
+    if (elapsed < s_drainWindowMs) {
+        return;
+    }
+
+    const qint64 chunkSize = m_drainedBytes * s_chunkDurationMs / elapsed;
+    m_chunkSize = qBound(s_minChunkSize, chunkSize - chunkSize % s_minChunkSize, s_maxChunkSize);
+    m_drainedBytes = 0;
+    m_drainTimer.restart();
 }
 
 void UploadJob::encryptedBytesWritten(qint64 bytes)
 {
-    Q_UNUSED(bytes);
-        
-    if (m_socket->encryptedBytesToWrite() == 0) {
-        bytesUploaded += bytesUploading;
-        setProcessedAmount(Bytes, bytesUploaded);
-    
+    adaptChunkSize(bytes);
+    socketDrained();
+}
+
+#ifdef KDECONNECT_KTLS
+void UploadJob::kernelTlsWritable()
+{
+    //It doesn't tell how much it sent, but we know what it still has
+    const qint64 drained = m_bytesQueued - pendingBytes();
+    adaptChunkSize(drained - m_bytesDrained);
+    m_bytesDrained = drained;
+    socketDrained();
+}
+#endif
+
+void UploadJob::socketDrained()
+{
+    setProcessedAmount(Bytes, qMax<qint64>(0, m_bytesWritten - pendingBytes()));
+
+    if (m_finishing) {
+        if (pendingBytes() == 0) {
+            m_input->close();
+        }
+        return;
+    }
+
+    if (pendingBytes() <= m_chunkSize) {
         uploadNextPacket();
     }
 }
 
 void UploadJob::aboutToClose()
 {
-    m_socket->disconnectFromHost();
+#ifdef KDECONNECT_KTLS
+    if (m_kernelTlsSocket) {
+        disconnect(m_kernelTlsSocket, nullptr, this, nullptr);
+        if (m_kernelTlsSocket->isOpen()) {
+            //The job is deleted right after the result, let the socket finish sending on its own
+            m_kernelTlsSocket->setParent(nullptr);
+            connect(m_kernelTlsSocket, &KernelTlsSocket::disconnected, m_kernelTlsSocket, &QObject::deleteLater);
+            m_kernelTlsSocket->disconnectFromHost();
+        }
+        emitResult();
+        return;
+    }
+#endif
+
+    disconnect(m_socket, nullptr, this, nullptr);
+    if (m_socket->state() != QAbstractSocket::UnconnectedState) {
+        //Same as above, the kernel might still be sending the last bytes
+        m_socket->setParent(nullptr);
+        connect(m_socket, &QAbstractSocket::disconnected, m_socket, &QObject::deleteLater);
+        m_socket->disconnectFromHost();
+    }
     emitResult();
 }
 
@@ -102,7 +489,7 @@ bool UploadJob::stop() {
     return true;
 }
 
-const NetworkPacket UploadJob::getNetworkPacket()
+const NetworkPacket& UploadJob::getNetworkPacket() const
 {
     return m_networkPacket;
 }
@@ -23,12 +23,18 @@
 
 #include <KJob>
 
+#include <QCryptographicHash>
+#include <QScopedPointer>
 #include <QIODevice>
 #include <QVariantMap>
 #include <QSslSocket>
 #include "server.h"
 #include <QElapsedTimer>
+#include <QPointer>
 #include <networkpacket.h>
+#include <bandwidthlimiter.h>
+
+class KernelTlsSocket;
 
 class KDECONNECTCORE_EXPORT UploadJob
     : public KJob
@@ -38,22 +44,70 @@ public:
     explicit UploadJob(const NetworkPacket& networkPacket);
 
     void setSocket(QSslSocket* socket);
+    //Used instead of the QSslSocket, see KernelTlsSocket
+    void setKernelTlsSocket(KernelTlsSocket* socket);
+    //Whether the payload is a file, which can be sent through a KernelTlsSocket
+    bool sendsFile() const;
     void start() override;
     bool stop();
-    const NetworkPacket getNetworkPacket();
+    const NetworkPacket& getNetworkPacket() const;
+
+    //Kernel send buffer for the payload socket, bigger buffers help on fast networks
+    void setSendBufferSize(int bytes) { m_sendBufferSize = bytes; }
+    //What is written to the socket at once, adapted to how fast it drains
+    qint64 chunkSize() const { return m_chunkSize; }
+    const static int s_defaultSendBufferSize;
+
+    //The receiver starts by telling us the offset to send the payload from, to resume a broken transfer
+    void setResumable(bool resumable) { m_resumable = resumable; }
+    //The payload is followed by its hash, of the whole payload even when resuming, see PayloadHasher
+    void setPayloadHash(const QString& algorithm);
+    //Bulk uploads wait for the limiter before every chunk
+    void setBandwidthLimiter(BandwidthLimiter* limiter, BandwidthLimiter::Priority priority);
 
 private:
+    qint64 pendingBytes() const;
+    void adaptChunkSize(qint64 drainedBytes);
+    void startUpload();
+    bool hashFirstBytes(qint64 size);
+    void adviseSequentialRead();
+    qint64 allowedChunkSize(qint64 chunkSize) const;
+    qint64 writeNextChunk(qint64 maxSize);
+    qint64 writeToSocket(const char* data, qint64 size);
+    void abortSocket();
+    //Some of what we wrote left, the socket might take more
+    void socketDrained();
+    QIODevice* socketDevice() const;
+    void sendFileChunks();
+    void kernelTlsWritable();
+    //Whether the whole payload went to the socket, only then the hash follows it
+    bool sentEverything() const;
+    void failUpload();
+
     const NetworkPacket m_networkPacket;
     QSharedPointer<QIODevice> m_input;
     QSslSocket* m_socket;
-    qint64 bytesUploading;
-    qint64 bytesUploaded;
+    KernelTlsSocket* m_kernelTlsSocket;
+    qint64 m_bytesWritten;
+    qint64 m_chunkSize;
+    int m_sendBufferSize;
+    QElapsedTimer m_drainTimer;
+    qint64 m_drainedBytes;
+    bool m_resumable;
+    bool m_finishing; //Everything is queued, waiting for the socket to send it
+    qint64 m_bytesQueued; //Written to the socket, including the hash
+    qint64 m_bytesDrained; //Of those, what the KernelTlsSocket already handed to the kernel
+    QScopedPointer<QCryptographicHash> m_hash;
+    QByteArray m_readBuffer; //The input is read into this, one chunk at a time
+    QPointer<BandwidthLimiter> m_limiter;
+    BandwidthLimiter::Priority m_priority;
 
     const static quint16 MIN_PORT = 1739;
     const static quint16 MAX_PORT = 1764;
     
 private Q_SLOTS:
     void uploadNextPacket();
+    void offsetReceived();
     void encryptedBytesWritten(qint64 bytes);
     void aboutToClose();
 };
@@ -35,11 +35,15 @@ QString LoopbackDeviceLink::name()
 
 bool LoopbackDeviceLink::sendPacket(NetworkPacket& input)
 {
+    input.inlinePayload(encoding(), inlinePayloadSize());
+
     NetworkPacket output((QString()));
-    NetworkPacket::unserialize(input.serialize(), &output);
+    NetworkPacket::unserialize(input.serialize(encoding(), compression()), &output, encoding());
 
     //LoopbackDeviceLink does not need deviceTransferInfo
-    if (input.hasPayload()) {
+    if (output.hasInlinePayload()) {
+        output.extractInlinePayload();
+    } else if (input.hasPayload()) {
         bool b = input.payload()->open(QIODevice::ReadOnly);
         Q_ASSERT(b);
         output.setPayload(input.payload(), input.payloadSize());
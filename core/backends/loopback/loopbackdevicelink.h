@@ -25,7 +25,7 @@
 
 class LoopbackLinkProvider;
 
-class LoopbackDeviceLink
+class KDECONNECTCORE_EXPORT LoopbackDeviceLink
     : public DeviceLink
 {
     Q_OBJECT
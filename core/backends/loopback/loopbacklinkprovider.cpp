@@ -36,6 +36,9 @@ LoopbackLinkProvider::~LoopbackLinkProvider()
 void LoopbackLinkProvider::onNetworkChange()
 {
     LoopbackDeviceLink* newLoopbackDeviceLink = new LoopbackDeviceLink(QStringLiteral("loopback"), this);
+    newLoopbackDeviceLink->setEncoding(NetworkPacket::negotiateEncoding(identityPacket));
+    newLoopbackDeviceLink->setCompression(NetworkPacket::negotiateCompression(identityPacket));
+    newLoopbackDeviceLink->setInlinePayloadSize(NetworkPacket::negotiateInlinePayloadSize(identityPacket));
     Q_EMIT onConnectionReceived(identityPacket, newLoopbackDeviceLink);
 
     if (loopbackDeviceLink) {
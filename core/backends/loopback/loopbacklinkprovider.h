@@ -25,7 +25,7 @@
 #include "loopbackdevicelink.h"
 #include <QPointer>
 
-class LoopbackLinkProvider
+class KDECONNECTCORE_EXPORT LoopbackLinkProvider
     : public LinkProvider
 {
     Q_OBJECT
@@ -0,0 +1,148 @@
+/**
+ * Copyright 2026 agent <agent@local>
+ * Copyright 2014 Alejandro Fiestas Olivares <afiestas@kde.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "packetframer.h"
+
+#include <QIODevice>
+#include <QtEndian>
+
+#include <cstring>
+
+#include "core_debug.h"
+
+//A broken or malicious peer could make us allocate anything otherwise
+const int PacketFramer::s_maxPacketLength = 64 * 1024 * 1024;
+
+static const int s_initialBufferSize = 64 * 1024;
+static const int s_headerSize = 4;
+
+PacketFramer::PacketFramer()
+    : m_packetStart(0)
+    , m_scanned(0)
+    , m_nextPacket(0)
+    , m_encoding(NetworkPacket::JsonEncoding)
+{
+    //Reserving also makes resize() keep the memory when the buffer is emptied
+    m_buffer.reserve(s_initialBufferSize);
+}
+
+qint64 PacketFramer::write(QIODevice* device, const QByteArray& packet, NetworkPacket::Encoding encoding)
+{
+    if (encoding == NetworkPacket::CborEncoding) {
+        uchar header[s_headerSize];
+        qToBigEndian<quint32>(packet.size(), header);
+        if (device->write(reinterpret_cast<const char*>(header), s_headerSize) != s_headerSize) {
+            return -1;
+        }
+    }
+    return device->write(packet);
+}
+
+bool PacketFramer::readFrom(QIODevice* device)
+{
+    //Nobody is looking at the buffer anymore, move the incomplete packet (if any) to the front
+    if (m_nextPacket == m_packets.size()) {
+        compact();
+    }
+
+    //Read in chunks so the size limit is enforced before buffering too much
+    qint64 available;
+    while ((available = device->bytesAvailable()) > 0) {
+        const int oldSize = m_buffer.size();
+        const int chunkSize = int(qMin<qint64>(available, s_initialBufferSize));
+        m_buffer.resize(oldSize + chunkSize);
+        const qint64 read = device->read(m_buffer.data() + oldSize, chunkSize);
+        m_buffer.resize(oldSize + qMax<qint64>(read, 0));
+        if (read <= 0) {
+            break;
+        }
+
+        const bool ok = (m_encoding == NetworkPacket::CborEncoding) ? splitLengthPrefixedPackets() : splitLines();
+        if (!ok) {
+            return false;
+        }
+    }
+    return true;
+}
+
+PacketFramer::PacketView PacketFramer::takePacket()
+{
+    Q_ASSERT(m_nextPacket < m_packets.size());
+    const QPair<int, int> packet = m_packets.at(m_nextPacket++);
+    return { m_buffer.constData() + packet.first, packet.second };
+}
+
+void PacketFramer::compact()
+{
+    m_packets.clear();
+    m_nextPacket = 0;
+    if (m_packetStart == 0) {
+        return;
+    }
+
+    const int remaining = m_buffer.size() - m_packetStart;
+    if (remaining > 0) {
+        std::memmove(m_buffer.data(), m_buffer.constData() + m_packetStart, remaining);
+    }
+    m_buffer.resize(remaining);
+    m_scanned -= m_packetStart;
+    m_packetStart = 0;
+}
+
+bool PacketFramer::splitLines()
+{
+    const char* data = m_buffer.constData();
+    const int size = m_buffer.size();
+
+    //memchr is vectorized by the libc, and we never search the same bytes twice
+    while (const char* newline = static_cast<const char*>(std::memchr(data + m_scanned, '\n', size - m_scanned))) {
+        const int end = int(newline - data) + 1;
+        const int length = end - m_packetStart;
+        if (length > s_maxPacketLength) {
+            return false;
+        }
+        if (length > 1) { //we don't want a single \n
+            m_packets.append(qMakePair(m_packetStart, length));
+        }
+        m_packetStart = m_scanned = end;
+    }
+    m_scanned = size;
+
+    return size - m_packetStart <= s_maxPacketLength;
+}
+
+bool PacketFramer::splitLengthPrefixedPackets()
+{
+    while (m_buffer.size() - m_packetStart >= s_headerSize) {
+        const quint32 length = qFromBigEndian<quint32>(reinterpret_cast<const uchar*>(m_buffer.constData() + m_packetStart));
+        if (length > quint32(s_maxPacketLength)) {
+            return false;
+        }
+        if (m_buffer.size() - m_packetStart - s_headerSize < int(length)) {
+            break; //We will be called again when the rest arrives
+        }
+        m_packets.append(qMakePair(m_packetStart + s_headerSize, int(length)));
+        m_packetStart += s_headerSize + int(length);
+    }
+    m_scanned = m_packetStart;
+
+    return true;
+}
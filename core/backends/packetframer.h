@@ -0,0 +1,84 @@
+/**
+ * Copyright 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef PACKETFRAMER_H
+#define PACKETFRAMER_H
+
+#include <QByteArray>
+#include <QPair>
+#include <QVector>
+
+#include <kdeconnectcore_export.h>
+#include "networkpacket.h"
+
+class QIODevice;
+
+/*
+ * Splits the data received from a link into packets: lines for JSON, 32 bit big
+ * endian length prefixed packets for CBOR. The same buffer is reused for all the
+ * reads and packets are handed out as views into it, so no allocation is needed
+ * per packet. Used by SocketLineReader and DeviceLineReader.
+ */
+class KDECONNECTCORE_EXPORT PacketFramer
+{
+public:
+    PacketFramer();
+
+    void setEncoding(NetworkPacket::Encoding encoding) { m_encoding = encoding; }
+
+    //Reads everything available in the device. Returns false if the peer is sending
+    //a packet bigger than s_maxPacketLength, the connection should be dropped then.
+    bool readFrom(QIODevice* device);
+
+    /*
+     * Points into the buffer, so it's only valid until the next call to readFrom().
+     * Not a QByteArray on purpose: it can't be kept around by mistake, toByteArray()
+     * makes the copy needed for that.
+     */
+    struct PacketView {
+        const char* data;
+        int size;
+
+        QByteArray toByteArray() const { return QByteArray(data, size); }
+    };
+
+    int packetCount() const { return m_packets.size() - m_nextPacket; }
+    PacketView takePacket();
+
+    static qint64 write(QIODevice* device, const QByteArray& packet, NetworkPacket::Encoding encoding);
+
+    const static int s_maxPacketLength;
+
+private:
+    void compact();
+    bool splitLines();
+    bool splitLengthPrefixedPackets();
+
+    QByteArray m_buffer;
+    int m_packetStart; //Where the packet being received starts in m_buffer
+    int m_scanned; //How much of m_buffer has been searched for a newline already
+    QVector<QPair<int, int>> m_packets; //Offset and size of the complete packets in m_buffer
+    int m_nextPacket;
+    NetworkPacket::Encoding m_encoding;
+
+};
+
+#endif
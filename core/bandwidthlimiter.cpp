@@ -0,0 +1,157 @@
+/**
+ * Copyright 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "bandwidthlimiter.h"
+
+#include "networkpacket.h"
+
+//How long Bulk writers yield after an interactive packet
+static const qint64 s_interactiveHoldMs = 1000;
+//Bulk writers are never slowed down more than this while yielding
+static const qint64 s_minYieldRate = 64 * 1024;
+//Tokens saved up while idle, also the least a waiting writer gets at once
+static const qint64 s_minBurstSize = 16 * 1024;
+static const qint64 s_burstDurationMs = 250;
+static const qint64 s_rateWindowMs = 1000;
+static const qint64 s_rateBucketMs = s_rateWindowMs / BandwidthLimiter::s_rateBuckets;
+
+BandwidthLimiter::Priority BandwidthLimiter::priorityOf(const NetworkPacket& np)
+{
+    return np.isBulk() ? Bulk : Interactive;
+}
+
+BandwidthLimiter::BandwidthLimiter(QObject* parent)
+    : QObject(parent)
+    , m_rateLimit(0)
+    , m_tokens(0)
+    , m_lastRefill(0)
+    , m_lastInteractive(-1)
+    , m_yieldRate(0)
+    , m_currentBucket(0)
+    , m_bucketBytes{}
+{
+    m_clock.start();
+    m_readyTimer.setSingleShot(true);
+    connect(&m_readyTimer, &QTimer::timeout, this, &BandwidthLimiter::ready);
+}
+
+void BandwidthLimiter::setRateLimit(qint64 bytesPerSecond)
+{
+    refill();
+    m_rateLimit = qMax<qint64>(0, bytesPerSecond);
+    m_tokens = qMin<double>(m_tokens, burstSize(m_rateLimit));
+
+    //Writers waiting for the old limit might go on already
+    Q_EMIT ready();
+}
+
+qint64 BandwidthLimiter::bulkRate() const
+{
+    const bool yielding = m_lastInteractive >= 0 && m_clock.elapsed() - m_lastInteractive < s_interactiveHoldMs;
+    if (!yielding) {
+        return m_rateLimit;
+    }
+    return (m_rateLimit > 0) ? qMin(m_rateLimit, m_yieldRate) : m_yieldRate;
+}
+
+qint64 BandwidthLimiter::burstSize(qint64 rate) const
+{
+    return qMax(s_minBurstSize, rate * s_burstDurationMs / 1000);
+}
+
+void BandwidthLimiter::refill()
+{
+    const qint64 now = m_clock.elapsed();
+    const qint64 rate = bulkRate();
+    if (rate > 0) {
+        m_tokens = qMin<double>(m_tokens + static_cast<double>(rate) * (now - m_lastRefill) / 1000, burstSize(rate));
+    }
+    m_lastRefill = now;
+}
+
+qint64 BandwidthLimiter::allowance()
+{
+    refill();
+    if (bulkRate() == 0) {
+        return -1;
+    }
+    return qMax<qint64>(0, static_cast<qint64>(m_tokens));
+}
+
+void BandwidthLimiter::consume(qint64 bytes, Priority priority)
+{
+    refill();
+    updateRates();
+
+    if (priority == Interactive) {
+        const qint64 now = m_clock.elapsed();
+        if (m_lastInteractive < 0 || now - m_lastInteractive >= s_interactiveHoldMs) {
+            //Half of what Bulk transfers were getting, so the interactive packets find the link free
+            m_yieldRate = qMax(s_minYieldRate, rate(Bulk) / 2);
+            m_tokens = qMin<double>(m_tokens, 0);
+        }
+        m_lastInteractive = now;
+    }
+
+    m_bucketBytes[priority][m_currentBucket % s_rateBuckets] += bytes;
+    if (bulkRate() > 0) {
+        //Interactive writes can leave a debt, Bulk writers pay it
+        m_tokens = qMax<double>(m_tokens - bytes, -burstSize(bulkRate()));
+    }
+}
+
+void BandwidthLimiter::waitForAllowance()
+{
+    if (m_readyTimer.isActive()) {
+        return;
+    }
+
+    refill();
+    const qint64 rate = bulkRate();
+    if (rate == 0) {
+        QMetaObject::invokeMethod(this, "ready", Qt::QueuedConnection);
+        return;
+    }
+
+    //Wait until a minimal burst can be sent, writing a few bytes at a time isn't worth it
+    const double missing = qMin(s_minBurstSize, burstSize(rate)) - m_tokens;
+    m_readyTimer.start(static_cast<int>(qBound<qint64>(1, static_cast<qint64>(missing * 1000 / rate) + 1, s_interactiveHoldMs)));
+}
+
+qint64 BandwidthLimiter::rate(Priority priority)
+{
+    updateRates();
+    qint64 bytes = 0;
+    for (int i = 0; i < s_rateBuckets; i++) {
+        bytes += m_bucketBytes[priority][i];
+    }
+    return bytes * 1000 / s_rateWindowMs;
+}
+
+void BandwidthLimiter::updateRates()
+{
+    //Sliding window, the buckets we moved past (at most all of them) are reused for what comes next
+    const qint64 bucket = m_clock.elapsed() / s_rateBucketMs;
+    for (qint64 b = qMax(m_currentBucket + 1, bucket - s_rateBuckets + 1); b <= bucket; b++) {
+        m_bucketBytes[Interactive][b % s_rateBuckets] = 0;
+        m_bucketBytes[Bulk][b % s_rateBuckets] = 0;
+    }
+    m_currentBucket = qMax(m_currentBucket, bucket);
+}
@@ -0,0 +1,92 @@
+/**
+ * Copyright 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef BANDWIDTHLIMITER_H
+#define BANDWIDTHLIMITER_H
+
+#include <QElapsedTimer>
+#include <QObject>
+#include <QTimer>
+
+#include "kdeconnectcore_export.h"
+
+class NetworkPacket;
+
+/*
+ * Token bucket shared by everything we send to a device.
+ *
+ * Interactive traffic (input, media controls, notifications...) is never held
+ * back, but it uses up tokens, so Bulk transfers (shared files) get what is left.
+ * While there is interactive traffic Bulk transfers slow down to half of their
+ * rate, even without a limit, so they don't make the link laggy.
+ */
+class KDECONNECTCORE_EXPORT BandwidthLimiter
+    : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum Priority { Interactive = 0, Bulk = 1 };
+
+    //Lower effort (DSCP CS1) for the sockets of Bulk transfers, Wi-Fi sends it as background traffic
+    static const int s_bulkTypeOfService = 0x20;
+    //rate() is measured over the last second, in this many slices
+    static const int s_rateBuckets = 10;
+
+    //See NetworkPacket::setBulk()
+    static Priority priorityOf(const NetworkPacket& np);
+
+    explicit BandwidthLimiter(QObject* parent = nullptr);
+
+    //In bytes per second, 0 for no limit
+    void setRateLimit(qint64 bytesPerSecond);
+    qint64 rateLimit() const { return m_rateLimit; }
+
+    //How much a Bulk writer can send right now, -1 if there is no limit
+    qint64 allowance();
+    //Every write to the device has to be accounted
+    void consume(qint64 bytes, Priority priority);
+    //ready() is emitted once Bulk writers can send again
+    void waitForAllowance();
+
+    //What was sent during the last second, in bytes per second
+    qint64 rate(Priority priority);
+
+Q_SIGNALS:
+    void ready();
+
+private:
+    qint64 bulkRate() const;
+    qint64 burstSize(qint64 rate) const;
+    void refill();
+    void updateRates();
+
+    qint64 m_rateLimit;
+    double m_tokens;
+    QElapsedTimer m_clock;
+    qint64 m_lastRefill;
+    qint64 m_lastInteractive; //-1 if there was none yet
+    qint64 m_yieldRate; //For Bulk writers while there is interactive traffic
+    qint64 m_currentBucket;
+    qint64 m_bucketBytes[2][s_rateBuckets]; //Bytes sent per priority, in the last s_rateBuckets slices of a second
+    QTimer m_readyTimer;
+};
+
+#endif
@@ -30,12 +30,12 @@ CompositeFileTransferJob::CompositeFileTransferJob(const QString& deviceId)
     : KCompositeJob()
     , m_deviceId(deviceId)
     , m_running(false)
-    , m_currentJobNum(1)
+    , m_maxConcurrentJobs(s_defaultMaxConcurrentJobs)
+    , m_currentJobNum(0)
+    , m_finishedJobs(0)
     , m_totalJobs(0)
-    , m_currentJobSendPayloadSize(0)
     , m_totalSendPayloadSize(0)
     , m_totalPayloadSize(0)
-    , m_currentJob(nullptr)
     , m_prevElapsedTime(0)
 {
     setCapabilities(Killable);
@@ -46,19 +46,31 @@ bool CompositeFileTransferJob::isRunning() const
     return m_running;
 }
 
+void CompositeFileTransferJob::setMaxConcurrentJobs(int maxConcurrentJobs)
+{
+    m_maxConcurrentJobs = qMax(1, maxConcurrentJobs);
+}
+
 void CompositeFileTransferJob::start()
 {
-    QMetaObject::invokeMethod(this, "startNextSubJob", Qt::QueuedConnection);
+    QMetaObject::invokeMethod(this, "startSubJobs", Qt::QueuedConnection);
     m_running = true;
 }
 
-void CompositeFileTransferJob::startNextSubJob()
+void CompositeFileTransferJob::startSubJobs()
 {
-    m_currentJob = qobject_cast<FileTransferJob*>(subjobs().at(0));
-    m_currentJobSendPayloadSize = 0;
-    emitDescription(m_currentJob->destination().toString());
-    m_currentJob->start();
-    connect(m_currentJob, QOverload<KJob*,KJob::Unit,qulonglong>::of(&FileTransferJob::processedAmount), this, &CompositeFileTransferJob::slotProcessedAmount);
+    if (!m_timer.isValid()) {
+        m_timer.start();
+    }
+
+    while (!m_pendingJobs.isEmpty() && m_runningJobs.size() < m_maxConcurrentJobs) {
+        FileTransferJob* job = m_pendingJobs.takeFirst();
+        m_currentJobNum++;
+        m_runningJobs.insert(job, 0);
+        emitDescription(job->destination().toString());
+        job->start();
+        connect(job, QOverload<KJob*,KJob::Unit,qulonglong>::of(&FileTransferJob::processedAmount), this, &CompositeFileTransferJob::slotProcessedAmount);
+    }
 }
 
 bool CompositeFileTransferJob::addSubjob(KJob* job)
@@ -79,11 +91,13 @@ bool CompositeFileTransferJob::addSubjob(KJob* job)
         QString filename = np->get<QString>(QStringLiteral("filename"));
         emitDescription(filename);
 
-        if (!hasSubjobs()) {
-            QMetaObject::invokeMethod(this, "startNextSubJob", Qt::QueuedConnection);
+        if (!KCompositeJob::addSubjob(job)) {
+            return false;
         }
 
-        return KCompositeJob::addSubjob(job);
+        m_pendingJobs.append(uploadJob);
+        QMetaObject::invokeMethod(this, "startSubJobs", Qt::QueuedConnection);
+        return true;
     } else {
         qCDebug(KDECONNECT_CORE) << "CompositeFileTransferJob::addSubjob() - you can only add FileTransferJob's, ignoring";
         return false;
@@ -94,17 +108,22 @@ bool CompositeFileTransferJob::addSubjob(KJob* job)
 bool CompositeFileTransferJob::doKill()
 {
     m_running = false;
-    if (m_currentJob) {
-        return m_currentJob->kill();
+
+    bool killed = true;
+    for (KJob* job : m_runningJobs.keys()) {
+        killed = job->kill() && killed;
     }
-    return true;
+    return killed;
 }
 
 void CompositeFileTransferJob::slotProcessedAmount(KJob *job, KJob::Unit unit, qulonglong amount)
 {
-    Q_UNUSED(job);
-    m_currentJobSendPayloadSize = amount;
-    quint64 uploaded = m_totalSendPayloadSize + m_currentJobSendPayloadSize;
+    m_runningJobs[job] = amount;
+
+    quint64 uploaded = m_totalSendPayloadSize;
+    for (quint64 received : qAsConst(m_runningJobs)) {
+        uploaded += received;
+    }
 
     if (uploaded == m_totalPayloadSize || m_prevElapsedTime == 0 || m_timer.elapsed() - m_prevElapsedTime >= 100) {
         m_prevElapsedTime = m_timer.elapsed();
@@ -126,15 +145,13 @@ void CompositeFileTransferJob::slotResult(KJob *job)
         return;
     }
 
-    m_totalSendPayloadSize += m_currentJobSendPayloadSize;
+    m_totalSendPayloadSize += m_runningJobs.take(job);
+    m_finishedJobs++;
 
-    setProcessedAmount(Files, m_currentJobNum);
+    setProcessedAmount(Files, m_finishedJobs);
 
-    if (m_currentJobNum < m_totalJobs) {
-        m_currentJobNum++;
-        if (!subjobs().empty()) {
-            startNextSubJob();
-        }
+    if (m_finishedJobs < m_totalJobs) {
+        startSubJobs();
     } else {
         emitResult();
     }
@@ -24,6 +24,7 @@
 #include "kdeconnectcore_export.h"
 #include <KCompositeJob>
 #include <QElapsedTimer>
+#include <QHash>
 
 class FileTransferJob;
 
@@ -39,25 +40,31 @@ public:
     bool isRunning() const;
     bool addSubjob(KJob* job) override;
 
+    //How many files are received at the same time, each over its own connection
+    void setMaxConcurrentJobs(int maxConcurrentJobs);
+    const static int s_defaultMaxConcurrentJobs = 4;
+
 protected:
     bool doKill() override;
 
 private Q_SLOTS:
     void slotProcessedAmount(KJob *job, KJob::Unit unit, qulonglong amount);
     void slotResult(KJob *job) override;
-    void startNextSubJob();
+    void startSubJobs();
 
 private:
     void emitDescription(const QString& currentFileName);
 
     QString m_deviceId;
     bool m_running;
+    int m_maxConcurrentJobs;
     int m_currentJobNum;
+    int m_finishedJobs;
     int m_totalJobs;
-    quint64 m_currentJobSendPayloadSize;
     quint64 m_totalSendPayloadSize;
     quint64 m_totalPayloadSize;
-    FileTransferJob *m_currentJob;
+    QList<FileTransferJob*> m_pendingJobs;
+    QHash<KJob*, quint64> m_runningJobs; //Bytes received by each started job
     QElapsedTimer m_timer;
     quint64 m_prevElapsedTime;
 
@@ -22,6 +22,8 @@
 
 #include <QDBusConnection>
 #include <QDBusMetaType>
+#include <QJsonDocument>
+#include <QJsonObject>
 #include <QNetworkAccessManager>
 #include <QDebug>
 #include <QPointer>
@@ -30,6 +32,7 @@
 #include "kdeconnectconfig.h"
 #include "networkpacket.h"
 #include "notificationserverinfo.h"
+#include "transferscheduler.h"
 
 #ifdef KDECONNECT_BLUETOOTH
     #include "backends/bluetooth/bluetoothlinkprovider.h"
@@ -56,6 +59,8 @@ struct DaemonPrivate
 
     QSet<QString> m_discoveryModeAcquisitions;
     bool m_testMode;
+
+    TransferScheduler m_transferScheduler;
 };
 
 Daemon* Daemon::instance()
@@ -72,6 +77,8 @@ Daemon::Daemon(QObject* parent, bool testMode)
     s_instance = this;
     d->m_testMode = testMode;
 
+    connect(&d->m_transferScheduler, &TransferScheduler::queueChanged, this, &Daemon::transfersChanged);
+
     // HACK init may call pure virtual functions from this class so it can't be called directly from the ctor
     QTimer::singleShot(0, this, &Daemon::init);
 }
@@ -93,6 +100,8 @@ void Daemon::init()
         #endif
     }
 
+    d->m_transferScheduler.setMaxActiveTransfers(KdeConnectConfig::instance()->maxActiveTransfers());
+
     //Read remembered paired devices
     const QStringList& list = KdeConnectConfig::instance()->trustedDevices();
     for (const QString& id : list) {
@@ -240,6 +249,11 @@ void Daemon::onDeviceStatusChanged()
 
     //qCDebug(KDECONNECT_CORE) << "Device" << device->name() << "status changed. Reachable:" << device->isReachable() << ". Paired: " << device->isPaired();
 
+    if (!device->isReachable()) {
+        //Its transfers won't make progress for now, let the other devices have their slots
+        d->m_transferScheduler.deviceUnreachable(device->id());
+    }
+
     if (!device->isReachable() && !device->isTrusted()) {
         //qCDebug(KDECONNECT_CORE) << "Destroying device" << device->name();
         removeDevice(device);
@@ -317,6 +331,34 @@ QStringList Daemon::pairingRequests() const
     return ret;
 }
 
+TransferScheduler* Daemon::transferScheduler()
+{
+    return &d->m_transferScheduler;
+}
+
+QString Daemon::transfers() const
+{
+    QJsonArray transfers = d->m_transferScheduler.queue();
+    for (int i = 0; i < transfers.size(); i++) {
+        QJsonObject transfer = transfers[i].toObject();
+        const Device* device = d->m_devices.value(transfer.value(QStringLiteral("deviceId")).toString());
+        transfer.insert(QStringLiteral("deviceName"), device ? device->name() : QString());
+        transfers[i] = transfer;
+    }
+    return QString::fromUtf8(QJsonDocument(transfers).toJson(QJsonDocument::Compact));
+}
+
+int Daemon::maxActiveTransfers() const
+{
+    return d->m_transferScheduler.maxActiveTransfers();
+}
+
+void Daemon::setMaxActiveTransfers(int maxActiveTransfers)
+{
+    d->m_transferScheduler.setMaxActiveTransfers(maxActiveTransfers);
+    KdeConnectConfig::instance()->setMaxActiveTransfers(d->m_transferScheduler.maxActiveTransfers());
+}
+
 Daemon::~Daemon()
 {
 
@@ -32,6 +32,7 @@ class NetworkPacket;
 class DeviceLink;
 class Device;
 class QNetworkAccessManager;
+class TransferScheduler;
 
 class KDECONNECTCORE_EXPORT Daemon
     : public QObject
@@ -60,6 +61,9 @@ public:
 
     QStringList pairingRequests() const;
 
+    //Shared by the uploads to all the devices
+    TransferScheduler* transferScheduler();
+
     Q_SCRIPTABLE QString selfId() const;
 public Q_SLOTS:
     Q_SCRIPTABLE void acquireDiscoveryMode(const QString& id);
@@ -78,6 +82,13 @@ public Q_SLOTS:
 
     Q_SCRIPTABLE QString deviceIdByName(const QString& name) const;
 
+    //JSON array with the running and queued file transfers to all the devices
+    Q_SCRIPTABLE QString transfers() const;
+
+    //How many files are sent at the same time, to all the devices together. Remembered across restarts
+    Q_SCRIPTABLE int maxActiveTransfers() const;
+    Q_SCRIPTABLE void setMaxActiveTransfers(int maxActiveTransfers);
+
     Q_SCRIPTABLE virtual void sendSimpleNotification(const QString &eventId, const QString &title, const QString &text, const QString &iconName) = 0;
 
 Q_SIGNALS:
@@ -87,6 +98,7 @@ Q_SIGNALS:
     Q_SCRIPTABLE void deviceListChanged(); //Emitted when any of deviceAdded, deviceRemoved or deviceVisibilityChanged is emitted
     Q_SCRIPTABLE void announcedNameChanged(const QString& announcedName);
     Q_SCRIPTABLE void pairingRequestsChanged();
+    Q_SCRIPTABLE void transfersChanged();
 
 private Q_SLOTS:
     void onNewDeviceLink(const NetworkPacket& identityPacket, DeviceLink* dl);
@@ -30,6 +30,7 @@
 #include <KLocalizedString>
 
 #include "core_debug.h"
+#include "bandwidthlimiter.h"
 #include "kdeconnectplugin.h"
 #include "pluginloader.h"
 #include "backends/devicelink.h"
@@ -65,10 +66,13 @@ public:
     QVector<DeviceLink *> m_deviceLinks;
     QHash<QString, KdeConnectPlugin *> m_plugins;
 
-    QMultiMap<QString, KdeConnectPlugin *> m_pluginsByIncomingCapability;
+    //Indexed by packet type atom, see PluginLoader::packetTypeAtom()
+    QVector<QVector<KdeConnectPlugin *>> m_pluginsByIncomingCapability;
     QSet<QString> m_supportedPlugins;
+    QSet<QString> m_incomingCapabilities;
     QSet<QString> m_allPlugins;
     QSet<PairingHandler *> m_pairRequests;
+    BandwidthLimiter m_bandwidthLimiter;
 };
 
 static void warn(const QString& info)
@@ -146,6 +150,31 @@ QStringList Device::supportedPlugins() const
     return d->m_supportedPlugins.toList();
 }
 
+bool Device::hasIncomingCapability(const QString& packetType) const
+{
+    return d->m_incomingCapabilities.contains(packetType);
+}
+
+BandwidthLimiter* Device::bandwidthLimiter() const
+{
+    return &d->m_bandwidthLimiter;
+}
+
+qint64 Device::uploadRateLimit() const
+{
+    return d->m_bandwidthLimiter.rateLimit();
+}
+
+qint64 Device::bulkUploadRate() const
+{
+    return d->m_bandwidthLimiter.rate(BandwidthLimiter::Bulk);
+}
+
+qint64 Device::interactiveUploadRate() const
+{
+    return d->m_bandwidthLimiter.rate(BandwidthLimiter::Interactive);
+}
+
 bool Device::hasPlugin(const QString& name) const
 {
     return d->m_plugins.contains(name);
@@ -159,7 +188,7 @@ QStringList Device::loadedPlugins() const
 void Device::reloadPlugins()
 {
     QHash<QString, KdeConnectPlugin*> newPluginMap, oldPluginMap = d->m_plugins;
-    QMultiMap<QString, KdeConnectPlugin*> newPluginsByIncomingCapability;
+    QVector<QVector<KdeConnectPlugin*>> newPluginsByIncomingCapability;
 
     if (isTrusted() && isReachable()) { //Do not load any plugin for unpaired devices, nor useless loading them for unreachable devices
 
@@ -180,7 +209,11 @@ void Device::reloadPlugins()
                 Q_ASSERT(plugin);
 
                 for (const QString& interface : incomingCapabilities) {
-                    newPluginsByIncomingCapability.insert(interface, plugin);
+                    const int atom = loader->internPacketType(interface);
+                    if (atom >= newPluginsByIncomingCapability.size()) {
+                        newPluginsByIncomingCapability.resize(atom + 1);
+                    }
+                    newPluginsByIncomingCapability[atom].append(plugin);
                 }
 
                 newPluginMap[pluginName] = plugin;
@@ -287,6 +320,7 @@ void Device::addLink(const NetworkPacket& identityPacket, DeviceLink* link)
             this, &Device::linkDestroyed);
 
     d->m_deviceLinks.append(link);
+    link->setBandwidthLimiter(&d->m_bandwidthLimiter);
 
     //Theoretically we will never add two links from the same provider (the provider should destroy
     //the old one before this is called), so we do not have to worry about destroying old links.
@@ -303,9 +337,11 @@ void Device::addLink(const NetworkPacket& identityPacket, DeviceLink* link)
                           , incomingCapabilities = identityPacket.get<QStringList>(QStringLiteral("incomingCapabilities")).toSet();
 
         d->m_supportedPlugins = PluginLoader::instance()->pluginsForCapabilities(incomingCapabilities, outgoingCapabilities);
+        d->m_incomingCapabilities = incomingCapabilities;
         //qDebug() << "new plugins for" << m_deviceName << m_supportedPlugins << incomingCapabilities << outgoingCapabilities;
     } else {
         d->m_supportedPlugins = PluginLoader::instance()->getPluginList().toSet();
+        d->m_incomingCapabilities.clear();
     }
 
     reloadPlugins();
@@ -399,7 +435,9 @@ void Device::privateReceivedPacket(const NetworkPacket& np)
 {
     Q_ASSERT(np.type() != PACKET_TYPE_PAIR);
     if (isTrusted()) {
-        const QList<KdeConnectPlugin*> plugins = d->m_pluginsByIncomingCapability.values(np.type());
+        const int atom = np.typeAtom();
+        const QVector<KdeConnectPlugin*> plugins = (atom >= 0 && atom < d->m_pluginsByIncomingCapability.size())
+                                                 ? d->m_pluginsByIncomingCapability.at(atom) : QVector<KdeConnectPlugin*>();
         if (plugins.isEmpty()) {
             qWarning() << "discarding unsupported packet" << np.type() << "for" << name();
         }
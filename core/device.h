@@ -28,6 +28,7 @@
 #include "networkpacket.h"
 #include "backends/devicelink.h"
 
+class BandwidthLimiter;
 class DeviceLink;
 class KdeConnectPlugin;
 
@@ -102,9 +103,18 @@ public:
 
     int protocolVersion();
     QStringList supportedPlugins() const;
+    //Whether the device told us it can receive packets of this type
+    bool hasIncomingCapability(const QString& packetType) const;
 
     QHostAddress getLocalIpAddress() const;
 
+    //Shared by everything we send to the device
+    BandwidthLimiter* bandwidthLimiter() const;
+    //In bytes per second, see BandwidthLimiter. 0 means no limit
+    Q_SCRIPTABLE qint64 uploadRateLimit() const;
+    Q_SCRIPTABLE qint64 bulkUploadRate() const;
+    Q_SCRIPTABLE qint64 interactiveUploadRate() const;
+
 public Q_SLOTS:
     ///sends a @p np packet to the device
     ///virtual for testing purposes.
@@ -21,17 +21,28 @@
 
 #include "filetransferjob.h"
 #include "daemon.h"
+#include "payloadhasher.h"
 #include <core_debug.h>
 
 #include <qalgorithms.h>
 #include <QFileInfo>
 #include <QDebug>
+#include <QSettings>
+#include <QSslSocket>
+#include <QtEndian>
 
 #include <KLocalizedString>
 
+#ifdef Q_OS_LINUX
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#endif
+
 FileTransferJob::FileTransferJob(const NetworkPacket* np, const QUrl& destination)
     : KJob()
     , m_origin(np->payload())
+    , m_payload(np->payload())
     , m_reply(nullptr)
     , m_from(QStringLiteral("KDE Connect"))
     , m_destination(destination)
@@ -39,6 +50,13 @@ FileTransferJob::FileTransferJob(const NetworkPacket* np, const QUrl& destinatio
     , m_written(0)
     , m_size(np->payloadSize())
     , m_np(np)
+    , m_sendsOffset(np->payloadTransferInfo().value(QStringLiteral("resumable")).toBool())
+    , m_resumable(false)
+    , m_lastModified(np->get<qint64>(QStringLiteral("lastModified")))
+    , m_offset(0)
+    , m_file(nullptr)
+    , m_hashAlgorithm(np->payloadTransferInfo().value(QStringLiteral("hash")).toString())
+    , m_hasher(nullptr)
 {
     Q_ASSERT(m_origin);
     //Disabled this assert: QBluetoothSocket doesn't report "->isReadable() == true" until it's connected
@@ -47,6 +65,11 @@ FileTransferJob::FileTransferJob(const NetworkPacket* np, const QUrl& destinatio
         qCWarning(KDECONNECT_CORE) << "Destination QUrl" << m_destination << "lacks a scheme. Setting its scheme to 'file'.";
         m_destination.setScheme(QStringLiteral("file"));
     }
+    m_resumable = m_sendsOffset && m_destination.isLocalFile() && m_size > 0;
+    if (!m_hashAlgorithm.isEmpty() && (m_size < 0 || !PayloadHasher::supportedAlgorithms().contains(m_hashAlgorithm))) {
+        qCWarning(KDECONNECT_CORE) << "Can't verify the payload with" << m_hashAlgorithm;
+        m_hashAlgorithm.clear();
+    }
 
     setCapabilities(Killable);
     qCDebug(KDECONNECT_CORE) << "FileTransferJob Downloading payload to" << destination << "size:" << m_size;
@@ -67,43 +90,219 @@ void FileTransferJob::doStart()
         return;
     }
 
+    if (m_resumable) {
+        m_offset = resumeOffset();
+    }
+
+    if (!m_hashAlgorithm.isEmpty()) {
+        //The hash covers the whole payload, what we already have of it is hashed first
+        m_hasher = new PayloadHasher(m_payload, m_size - m_offset, m_hashAlgorithm);
+        if (m_offset > 0 && !hashPartialFile()) {
+            qCWarning(KDECONNECT_CORE) << "Couldn't read" << partialFilePath() << ", receiving everything again";
+            QFile::remove(partialFilePath());
+            m_offset = 0;
+            delete m_hasher;
+            m_hasher = new PayloadHasher(m_payload, m_size, m_hashAlgorithm);
+        }
+        m_origin = QSharedPointer<QIODevice>(m_hasher);
+    }
+
+    if (m_sendsOffset) {
+        //Only once the connection is encrypted, before that a write would go out in plain text
+        QSslSocket* socket = qobject_cast<QSslSocket*>(m_payload.data());
+        if (socket && !socket->isEncrypted()) {
+            connect(socket, &QSslSocket::encrypted, this, &FileTransferJob::sendOffset);
+        } else {
+            sendOffset();
+        }
+    }
+
     if (m_origin->bytesAvailable())
         startTransfer();
     connect(m_origin.data(), &QIODevice::readyRead, this, &FileTransferJob::startTransfer);
 }
 
+qint64 FileTransferJob::resumeOffset()
+{
+    const QString partialPath = partialFilePath();
+    QSettings info(partialPath + QStringLiteral(".info"), QSettings::IniFormat);
+    const qint64 partialSize = QFileInfo(partialPath).size(); //0 if there is none
+
+    if (partialSize > 0 && partialSize < m_size
+            && info.value(QStringLiteral("size")).toLongLong() == m_size
+            && info.value(QStringLiteral("lastModified")).toLongLong() == m_lastModified) {
+        qCDebug(KDECONNECT_CORE) << "Resuming" << m_destination << "from" << partialSize << "bytes";
+        return partialSize;
+    }
+
+    //Nothing to resume, or it was a different file with the same name
+    QFile::remove(partialPath);
+    info.setValue(QStringLiteral("size"), m_size);
+    info.setValue(QStringLiteral("lastModified"), m_lastModified);
+    info.sync();
+    return 0;
+}
+
+bool FileTransferJob::hashPartialFile()
+{
+    QFile partialFile(partialFilePath());
+    return partialFile.open(QIODevice::ReadOnly) && m_hasher->hashPrefix(&partialFile, m_offset);
+}
+
+void FileTransferJob::sendOffset()
+{
+    const quint64 offset = qToBigEndian<quint64>(m_offset);
+    m_payload->write(reinterpret_cast<const char*>(&offset), sizeof(offset));
+}
+
 void FileTransferJob::startTransfer()
 {
     // Don't put each ready read
-    if (m_reply)
+    if (m_reply || m_file)
         return;
 
-    setProcessedAmount(Bytes, 0);
+    setProcessedAmount(Bytes, m_offset);
+    if (m_size >= 0) {
+        setTotalAmount(Bytes, m_size);
+    }
+
+    if (m_destination.isLocalFile()) {
+        //Local files are written directly, QNetworkAccessManager would copy everything through small buffers
+        if (!openFile()) {
+            return;
+        }
+        m_written = m_offset;
+        connect(m_origin.data(), &QIODevice::readyRead, this, &FileTransferJob::writeReceivedData);
+        connect(m_origin.data(), &QIODevice::readChannelFinished, this, [this]() {
+            if (m_size < 0 || m_written < m_size) {
+                transferFinished();
+            }
+        });
+        writeReceivedData();
+        return;
+    }
 
     QNetworkRequest req(m_destination);
     if (m_size >= 0) {
-        setTotalAmount(Bytes, m_size);
         req.setHeader(QNetworkRequest::ContentLengthHeader, m_size);
     }
     m_reply = Daemon::instance()->networkAccessManager()->put(req, m_origin.data());
 
     connect(m_reply, &QNetworkReply::uploadProgress, this, [this](qint64 bytesSent, qint64 /*bytesTotal*/) {
-        if (!m_timer.isValid())
-            m_timer.start();
-        setProcessedAmount(Bytes, bytesSent);
-
-        const auto elapsed = m_timer.elapsed();
-        if (elapsed > 0) {
-            emitSpeed((1000 * bytesSent) / elapsed);
-        }
-        
-        m_written = bytesSent;
+        transferProgress(bytesSent);
     });
     connect(m_reply, static_cast<void (QNetworkReply::*)(QNetworkReply::NetworkError)>(&QNetworkReply::error),
             this, &FileTransferJob::transferFailed);
     connect(m_reply, &QNetworkReply::finished, this, &FileTransferJob::transferFinished);
 }
 
+bool FileTransferJob::openFile()
+{
+    m_file = new QFile(m_resumable ? partialFilePath() : m_destination.toLocalFile(), this);
+
+    //We do our own buffering in m_buffer, so QFile doesn't need to copy everything once more
+    const QIODevice::OpenMode mode = QIODevice::WriteOnly | QIODevice::Unbuffered
+                                   | (m_offset > 0 ? QIODevice::Append : QIODevice::Truncate);
+    if (!m_file->open(mode)) {
+        setError(4);
+        setErrorText(i18n("Couldn't open %1: %2", m_file->fileName(), m_file->errorString()));
+        emitResult();
+        return false;
+    }
+
+    if (!preallocate()) {
+        m_file->close();
+        deleteDestinationFile();
+        setError(4);
+        setErrorText(i18n("Not enough space to receive %1", m_destination.toLocalFile()));
+        emitResult();
+        return false;
+    }
+
+    m_buffer.reserve(s_writeBufferSize);
+    return true;
+}
+
+bool FileTransferJob::preallocate()
+{
+#ifdef Q_OS_LINUX
+    //Reserve the blocks up front so the file isn't fragmented and a full disk is noticed before
+    //receiving anything. The size is kept as is, it tells how much of a partial file is there.
+    if (m_size > m_offset && fallocate(m_file->handle(), FALLOC_FL_KEEP_SIZE, m_offset, m_size - m_offset) != 0) {
+        if (errno == ENOSPC) {
+            qCWarning(KDECONNECT_CORE) << "Not enough space for" << m_file->fileName() << m_size << "bytes";
+            return false;
+        }
+        //Not every filesystem supports it, that's fine
+        qCDebug(KDECONNECT_CORE) << "Couldn't preallocate" << m_file->fileName() << strerror(errno);
+    }
+#endif
+    return true;
+}
+
+void FileTransferJob::writeReceivedData()
+{
+    while ((m_size < 0 || m_written < m_size) && m_origin->bytesAvailable() > 0) {
+        qint64 toRead = qMin<qint64>(m_origin->bytesAvailable(), s_writeBufferSize - m_buffer.size());
+        if (m_size >= 0) {
+            toRead = qMin(toRead, m_size - m_written);
+        }
+
+        const int oldSize = m_buffer.size();
+        m_buffer.resize(oldSize + static_cast<int>(toRead));
+        const qint64 read = m_origin->read(m_buffer.data() + oldSize, toRead);
+        m_buffer.resize(oldSize + static_cast<int>(qMax<qint64>(read, 0)));
+        if (read <= 0) {
+            break;
+        }
+
+        transferProgress(m_written + read);
+        if (m_buffer.size() >= s_writeBufferSize && !flushBuffer()) {
+            disconnect(m_origin.data(), nullptr, this, nullptr);
+            m_origin->close();
+            transferFinished();
+            return;
+        }
+    }
+
+    if (m_written == m_size) {
+        disconnect(m_origin.data(), nullptr, this, nullptr);
+        transferFinished();
+    }
+}
+
+bool FileTransferJob::flushBuffer()
+{
+    if (m_buffer.isEmpty()) {
+        return true;
+    }
+
+    const qint64 written = m_file->write(m_buffer);
+    if (written != m_buffer.size()) {
+        qCWarning(KDECONNECT_CORE) << "Couldn't write to" << m_file->fileName() << m_file->errorString();
+        //Only what made it to the file counts, so a resumable transfer continues from there
+        m_written -= m_buffer.size() - qMax<qint64>(written, 0);
+        m_buffer.resize(0);
+        return false;
+    }
+    m_buffer.resize(0);
+    return true;
+}
+
+void FileTransferJob::transferProgress(qint64 written)
+{
+    if (!m_timer.isValid())
+        m_timer.start();
+    setProcessedAmount(Bytes, written);
+
+    const auto elapsed = m_timer.elapsed();
+    if (elapsed > 0) {
+        emitSpeed((1000 * (written - m_offset)) / elapsed);
+    }
+
+    m_written = written;
+}
+
 void FileTransferJob::transferFailed(QNetworkReply::NetworkError error)
 {
     qCDebug(KDECONNECT_CORE) << "Couldn't transfer the file successfully" << error << m_reply->errorString();
@@ -116,14 +315,48 @@ void FileTransferJob::transferFailed(QNetworkReply::NetworkError error)
 
 void FileTransferJob::transferFinished()
 {
-    //TODO: MD5-check the file
+    if (m_file && m_file->isOpen()) {
+        flushBuffer();
+        m_file->close();
+    }
+
+    if (m_size == m_written && m_hasher) {
+        if (!m_hasher->isHashReady()) {
+            //The hash follows the payload, it may not be here yet
+            connect(m_hasher, &PayloadHasher::hashReady, this, &FileTransferJob::transferFinished, Qt::UniqueConnection);
+            return;
+        }
+        disconnect(m_hasher, &PayloadHasher::hashReady, this, &FileTransferJob::transferFinished);
+
+        if (!m_hasher->verify()) {
+            qCDebug(KDECONNECT_CORE) << "Received corrupted file" << m_destination << ", deleting";
+            deleteDestinationFile();
+            setError(5);
+            setErrorText(i18n("Received corrupted file from: %1", m_from));
+            emitResult();
+            return;
+        }
+    }
+
     if (m_size == m_written) {
+        if (m_resumable && !QFile::rename(partialFilePath(), m_destination.toLocalFile())) {
+            setError(4);
+            setErrorText(i18n("Couldn't move the received file to %1", m_destination.toLocalFile()));
+            emitResult();
+            return;
+        }
+        if (m_resumable) {
+            QFile::remove(partialFilePath() + QStringLiteral(".info"));
+        }
         qCDebug(KDECONNECT_CORE) << "Finished transfer" << m_destination;
         emitResult();
     } else {
-        qCDebug(KDECONNECT_CORE) << "Received incomplete file ("<< m_written << "/" << m_size << "bytes ), deleting";
-        
-        deleteDestinationFile();
+        if (m_resumable) {
+            qCDebug(KDECONNECT_CORE) << "Received incomplete file ("<< m_written << "/" << m_size << "bytes ), keeping it to resume";
+        } else {
+            qCDebug(KDECONNECT_CORE) << "Received incomplete file ("<< m_written << "/" << m_size << "bytes ), deleting";
+            deleteDestinationFile();
+        }
 
         setError(3);
         setErrorText(i18n("Received incomplete file from: %1", m_from));
@@ -133,7 +366,10 @@ void FileTransferJob::transferFinished()
 
 void FileTransferJob::deleteDestinationFile()
 {
-    if (m_destination.isLocalFile() && QFile::exists(m_destination.toLocalFile())) {
+    if (m_resumable) {
+        QFile::remove(partialFilePath());
+        QFile::remove(partialFilePath() + QStringLiteral(".info"));
+    } else if (m_destination.isLocalFile() && QFile::exists(m_destination.toLocalFile())) {
         QFile::remove(m_destination.toLocalFile());
     }
 }
@@ -143,8 +379,13 @@ bool FileTransferJob::doKill()
     if (m_reply) {
         m_reply->close();
     }
+    if (m_file) {
+        m_file->close();
+    }
     if (m_origin) {
+        disconnect(m_origin.data(), nullptr, this, nullptr);
         m_origin->close();
+        m_payload->close();
     }
 
     deleteDestinationFile();
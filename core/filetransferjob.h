@@ -25,6 +25,7 @@
 #include <KJob>
 
 #include <QElapsedTimer>
+#include <QFile>
 #include <QIODevice>
 #include <QSharedPointer>
 #include <QUrl>
@@ -33,11 +34,20 @@
 #include "kdeconnectcore_export.h"
 
 class NetworkPacket;
+class PayloadHasher;
 /**
  * @short It will stream a device into a url destination
  *
  * Given a QIODevice, the file transfer job will use the system's QNetworkAccessManager
  * for putting the stream into the requested location.
+ *
+ * If the sender supports it ("resumable" in the payloadTransferInfo) local files are
+ * received into a .part file that is kept when the transfer breaks. When the same file
+ * is sent again we tell the sender the size of what we have and it only sends the rest.
+ *
+ * Payloads followed by their hash ("hash" in the payloadTransferInfo) are verified
+ * while they are received, see PayloadHasher. The hash is of the whole file, so the
+ * start of a resumed file is checked too.
  */
 class KDECONNECTCORE_EXPORT FileTransferJob
     : public KJob
@@ -64,11 +74,21 @@ protected:
 
 private:
     void startTransfer();
+    bool openFile();
+    bool preallocate();
+    void writeReceivedData();
+    bool flushBuffer();
+    void transferProgress(qint64 written);
     void transferFailed(QNetworkReply::NetworkError error);
     void transferFinished();
     void deleteDestinationFile();
+    qint64 resumeOffset();
+    bool hashPartialFile();
+    void sendOffset();
+    QString partialFilePath() const { return m_destination.toLocalFile() + QStringLiteral(".part"); }
 
-    QSharedPointer<QIODevice> m_origin;
+    QSharedPointer<QIODevice> m_origin; //What the file is read from, the payload or its PayloadHasher
+    QSharedPointer<QIODevice> m_payload;
     QNetworkReply* m_reply;
     QString m_from;
     QUrl m_destination;
@@ -77,6 +97,16 @@ private:
     qint64 m_written;
     qint64 m_size;
     const NetworkPacket* m_np;
+    bool m_sendsOffset; //The sender waits for the offset before sending anything
+    bool m_resumable;
+    qint64 m_lastModified; //Of the file being sent, tells whether a partial file can be resumed
+    qint64 m_offset;
+    QFile* m_file; //Local destinations are written directly, otherwise m_reply writes it
+    QByteArray m_buffer; //Received data not written to m_file yet
+    QString m_hashAlgorithm;
+    PayloadHasher* m_hasher;
+
+    static const int s_writeBufferSize = 1024 * 1024;
 };
 
 #endif
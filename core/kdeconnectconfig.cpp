@@ -32,11 +32,13 @@
 #include <QHostInfo>
 #include <QSettings>
 #include <QSslCertificate>
+#include <QSslKey>
 #include <QtCrypto>
 
 #include "core_debug.h"
 #include "dbushelper.h"
 #include "daemon.h"
+#include "transferscheduler.h"
 
 const QFile::Permissions strictPermissions = QFile::ReadOwner | QFile::WriteOwner | QFile::ReadUser | QFile::WriteUser;
 
@@ -103,6 +105,17 @@ void KdeConnectConfig::setName(const QString& name)
     d->m_config->sync();
 }
 
+int KdeConnectConfig::maxActiveTransfers()
+{
+    return d->m_config->value(QStringLiteral("maxActiveTransfers"), TransferScheduler::s_defaultMaxActiveTransfers).toInt();
+}
+
+void KdeConnectConfig::setMaxActiveTransfers(int maxActiveTransfers)
+{
+    d->m_config->setValue(QStringLiteral("maxActiveTransfers"), maxActiveTransfers);
+    d->m_config->sync();
+}
+
 QString KdeConnectConfig::deviceType()
 {
     return QStringLiteral("desktop"); // TODO
@@ -128,6 +141,11 @@ QSslCertificate KdeConnectConfig::certificate()
     return d->m_certificate;
 }
 
+QSslKey KdeConnectConfig::privateKey()
+{
+    return QSslKey(d->m_privateKey.toPEM().toLatin1(), QSsl::Rsa);
+}
+
 QDir KdeConnectConfig::baseConfigDir()
 {
     QString configPath = QStandardPaths::writableLocation(QStandardPaths::ConfigLocation);
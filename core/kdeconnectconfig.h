@@ -26,6 +26,7 @@
 #include "kdeconnectcore_export.h"
 
 class QSslCertificate;
+class QSslKey;
 
 class KDECONNECTCORE_EXPORT KdeConnectConfig
 {
@@ -48,9 +49,14 @@ public:
     QString privateKeyPath();
     QString certificatePath();
     QSslCertificate certificate();
+    QSslKey privateKey(); //Parsed from memory, unlike privateKeyPath() it doesn't need to read any file
 
     void setName(const QString& name);
 
+    //See TransferScheduler
+    int maxActiveTransfers();
+    void setMaxActiveTransfers(int maxActiveTransfers);
+
     /*
      * Trusted devices
      */
@@ -20,13 +20,20 @@
 
 #include "kdeconnectplugin.h"
 
+#include <QBitArray>
+
 #include "core_debug.h"
+#include "pluginloader.h"
+
+//In older Qt released, qAsConst isnt available
+#include "qtcompat_p.h"
 
 struct KdeConnectPluginPrivate
 {
     Device* m_device;
     QString m_pluginName;
     QSet<QString> m_outgoingCapabilties;
+    QBitArray m_outgoingCapabilityAtoms; //Indexed by packet type atom, see PluginLoader::packetTypeAtom()
     KdeConnectPluginConfig* m_config;
     QString iconName;
 };
@@ -38,6 +45,13 @@ KdeConnectPlugin::KdeConnectPlugin(QObject* parent, const QVariantList& args)
     d->m_device = qvariant_cast< Device* >(args.at(0));
     d->m_pluginName = args.at(1).toString();
     d->m_outgoingCapabilties = args.at(2).toStringList().toSet();
+    for (const QString& type : qAsConst(d->m_outgoingCapabilties)) {
+        const int atom = PluginLoader::instance()->internPacketType(type);
+        if (atom >= d->m_outgoingCapabilityAtoms.size()) {
+            d->m_outgoingCapabilityAtoms.resize(atom + 1);
+        }
+        d->m_outgoingCapabilityAtoms.setBit(atom);
+    }
     d->m_config = nullptr;
     d->iconName = args.at(3).toString();
 }
@@ -70,7 +84,8 @@ Device const* KdeConnectPlugin::device() const
 
 bool KdeConnectPlugin::sendPacket(NetworkPacket& np) const
 {
-    if(!d->m_outgoingCapabilties.contains(np.type())) {
+    const int atom = np.typeAtom();
+    if (atom < 0 || atom >= d->m_outgoingCapabilityAtoms.size() || !d->m_outgoingCapabilityAtoms.testBit(atom)) {
         qCWarning(KDECONNECT_CORE) << metaObject()->className() << "tried to send an unsupported packet type" << np.type() << ". Supported:" << d->m_outgoingCapabilties;
         return false;
     }
@@ -21,14 +21,29 @@
 #include "networkpacket.h"
 #include "core_debug.h"
 
-#include <QMetaObject>
-#include <QMetaProperty>
+#include <QBuffer>
 #include <QByteArray>
 #include <QDataStream>
 #include <QDateTime>
+#include <QtEndian>
+#include <QJsonArray>
 #include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonValue>
 #include <QDebug>
 
+#if QT_VERSION >= QT_VERSION_CHECK(5, 12, 0)
+#include <QCborMap>
+#include <QCborStreamReader>
+#include <QCborStreamWriter>
+#include <QCborValue>
+#endif
+
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
 #include "dbushelper.h"
 #include "filetransferjob.h"
 #include "pluginloader.h"
@@ -46,22 +61,87 @@ QDebug operator<<(QDebug s, const NetworkPacket& pkg)
 
 const int NetworkPacket::s_protocolVersion = 7;
 
+const int NetworkPacket::s_compressionThreshold = 1024;
+
+//Enough for notification icons and thumbnails, without making packets slow to parse
+const qint64 NetworkPacket::s_maxInlinePayloadSize = 32 * 1024;
+
+//Big enough for most packets, so serialize() doesn't need to reallocate
+static const int s_serializeReserveSize = 512;
+
+//Fast, and bodies are mostly text that compresses well anyway
+static const int s_compressionLevel = 1;
+
+//Refuse to inflate bodies that claim to be bigger than this
+static const quint32 s_maxInflatedBodySize = 64 * 1024 * 1024;
+
 NetworkPacket::NetworkPacket(const QString& type, const QVariantMap& body)
     : m_id(QString::number(QDateTime::currentMSecsSinceEpoch()))
     , m_type(type)
-    , m_body(body)
+    , m_typeAtom(s_typeAtomNotLookedUp)
+    , m_body(new Body)
     , m_payload()
     , m_payloadSize(0)
+    , m_bulk(false)
 {
+    m_body->map = body;
 }
 
-NetworkPacket::NetworkPacket(const NetworkPacket& other)
-    : m_id(other.m_id)
-    , m_type(other.m_type)
-    , m_body(QVariantMap(other.m_body))
-    , m_payload(other.m_payload)
+NetworkPacket::NetworkPacket(NetworkPacket&& other) noexcept
+    : m_id(std::move(other.m_id))
+    , m_type(std::move(other.m_type))
+    , m_typeAtom(other.m_typeAtom)
+    , m_body(emptyBody())
+    , m_payload(std::move(other.m_payload))
     , m_payloadSize(other.m_payloadSize)
+    , m_payloadTransferInfo(std::move(other.m_payloadTransferInfo))
+    , m_bulk(other.m_bulk)
+{
+    m_body.swap(other.m_body);
+    other.m_typeAtom = s_typeAtomNotLookedUp;
+    other.m_payloadSize = 0;
+}
+
+NetworkPacket& NetworkPacket::operator=(NetworkPacket&& other) noexcept
+{
+    m_id = std::move(other.m_id);
+    m_type = std::move(other.m_type);
+    m_typeAtom = other.m_typeAtom;
+    m_body.swap(other.m_body);
+    other.m_body = emptyBody();
+    m_payload = std::move(other.m_payload);
+    m_payloadSize = other.m_payloadSize;
+    m_payloadTransferInfo = std::move(other.m_payloadTransferInfo);
+    m_bulk = other.m_bulk;
+    other.m_typeAtom = s_typeAtomNotLookedUp;
+    other.m_payloadSize = 0;
+    return *this;
+}
+
+//Left behind by moves, so they don't need to allocate. It's shared, so the
+//non-const accessors always detach from it before modifying anything
+QExplicitlySharedDataPointer<NetworkPacket::Body> NetworkPacket::emptyBody()
+{
+    static const QExplicitlySharedDataPointer<Body> body(new Body);
+    return body;
+}
+
+QVariantMap& NetworkPacket::body()
+{
+    if (!m_body->serialized.isNull()) {
+        parseBody();
+    }
+    m_body.detach();
+    return m_body->map;
+}
+
+void NetworkPacket::setBody(const QVariantMap& b)
 {
+    if (m_body->ref.load() != 1) {
+        m_body = new Body;
+    }
+    m_body->map = b;
+    m_body->serialized = QByteArray();
 }
 
 void NetworkPacket::createIdentityPacket(NetworkPacket* np)
@@ -69,6 +149,7 @@ void NetworkPacket::createIdentityPacket(NetworkPacket* np)
     KdeConnectConfig* config = KdeConnectConfig::instance();
     np->m_id = QString::number(QDateTime::currentMSecsSinceEpoch());
     np->m_type = PACKET_TYPE_IDENTITY;
+    np->m_typeAtom = s_typeAtomNotLookedUp;
     np->m_payload = QSharedPointer<QIODevice>();
     np->m_payloadSize = 0;
     np->set(QStringLiteral("deviceId"), config->deviceId());
@@ -77,101 +158,990 @@ void NetworkPacket::createIdentityPacket(NetworkPacket* np)
     np->set(QStringLiteral("protocolVersion"),  NetworkPacket::s_protocolVersion);
     np->set(QStringLiteral("incomingCapabilities"), PluginLoader::instance()->incomingCapabilities());
     np->set(QStringLiteral("outgoingCapabilities"), PluginLoader::instance()->outgoingCapabilities());
+#if QT_VERSION >= QT_VERSION_CHECK(5, 12, 0)
+    np->set(QStringLiteral("encodings"), QStringList{QStringLiteral("json"), QStringLiteral("cbor")});
+#endif
+    np->set(QStringLiteral("compressions"), QStringList{QStringLiteral("deflate")});
+    np->set(QStringLiteral("inlinePayloadSize"), s_maxInlinePayloadSize);
 
     //qCDebug(KDECONNECT_CORE) << "createIdentityPacket" << np->serialize();
 }
 
-template<class T>
-QVariantMap qobject2qvariant(const T* object)
+int NetworkPacket::typeAtom() const
 {
-    QVariantMap map;
-    auto metaObject = T::staticMetaObject;
-    for(int i = metaObject.propertyOffset(); i < metaObject.propertyCount(); ++i) {
-        QMetaProperty prop = metaObject.property(i);
-        map.insert(QString::fromLatin1(prop.name()), prop.readOnGadget(object));
+    //Looked up once per packet, the routing itself only uses the integer
+    if (m_typeAtom == s_typeAtomNotLookedUp) {
+        m_typeAtom = PluginLoader::instance()->packetTypeAtom(m_type);
     }
+    return m_typeAtom;
+}
+
+NetworkPacket::Encoding NetworkPacket::negotiateEncoding(const NetworkPacket& identityPacket)
+{
+#if QT_VERSION >= QT_VERSION_CHECK(5, 12, 0)
+    //We support every encoding, so it's up to what the other side lists
+    const QStringList encodings = identityPacket.get<QStringList>(QStringLiteral("encodings"));
+    if (encodings.contains(QStringLiteral("cbor"))) {
+        return CborEncoding;
+    }
+#else
+    Q_UNUSED(identityPacket);
+#endif
+    return JsonEncoding;
+}
+
+NetworkPacket::Compression NetworkPacket::negotiateCompression(const NetworkPacket& identityPacket)
+{
+    const QStringList compressions = identityPacket.get<QStringList>(QStringLiteral("compressions"));
+    return compressions.contains(QStringLiteral("deflate")) ? DeflateCompression : NoCompression;
+}
 
-    return map;
+qint64 NetworkPacket::negotiateInlinePayloadSize(const NetworkPacket& identityPacket)
+{
+    //Older clients don't list it, and then nothing is sent inline
+    return qBound<qint64>(0, identityPacket.get<qint64>(QStringLiteral("inlinePayloadSize")), s_maxInlinePayloadSize);
 }
 
-QByteArray NetworkPacket::serialize() const
+// Writes JSON straight into the output buffer, skipping the QVariantMap and
+// QJsonDocument intermediate steps. The output must stay byte-identical to
+// QJsonDocument::toJson(QJsonDocument::Compact), since that is what the other
+// clients (and our own tests) expect.
+static void writeJsonValue(QByteArray& out, const QVariant& value);
+static void writeJsonValue(QByteArray& out, const QJsonValue& value);
+
+static void writeJsonString(QByteArray& out, const QString& string)
 {
-    //Object -> QVariant
-    //QVariantMap variant;
-    //variant["id"] = mId;
-    //variant["type"] = mType;
-    //variant["body"] = mBody;
-    QVariantMap variant = qobject2qvariant(this);
+    static const char hexDigits[] = "0123456789abcdef";
 
-    if (hasPayload()) {
-        //qCDebug(KDECONNECT_CORE) << "Serializing payloadTransferInfo";
-        variant[QStringLiteral("payloadSize")] = payloadSize();
-        variant[QStringLiteral("payloadTransferInfo")] = m_payloadTransferInfo;
+    const QByteArray utf8 = string.toUtf8();
+    out.append('"');
+    for (const char c : utf8) {
+        const uchar u = static_cast<uchar>(c);
+        if (u >= 0x20 && u != '"' && u != '\\') {
+            out.append(c);
+            continue;
+        }
+        out.append('\\');
+        switch (u) {
+        case '"':  out.append('"'); break;
+        case '\\': out.append('\\'); break;
+        case '\b': out.append('b'); break;
+        case '\f': out.append('f'); break;
+        case '\n': out.append('n'); break;
+        case '\r': out.append('r'); break;
+        case '\t': out.append('t'); break;
+        default:
+            out.append("u00", 3);
+            out.append(hexDigits[u >> 4]);
+            out.append(hexDigits[u & 0xf]);
+        }
     }
+    out.append('"');
+}
 
-    //QVariant -> json
-    auto jsonDocument = QJsonDocument::fromVariant(variant);
-    QByteArray json = jsonDocument.toJson(QJsonDocument::Compact);
-    if (json.isEmpty()) {
-        qCDebug(KDECONNECT_CORE) << "Serialization error:";
+static void writeJsonDouble(QByteArray& out, double d)
+{
+    if (!qIsFinite(d)) {
+        out.append("null", 4); // See RFC4627#section2.4
+        return;
+    }
+#if QT_VERSION >= QT_VERSION_CHECK(5, 7, 0)
+    const double abs = std::abs(d);
+    out.append(QByteArray::number(d, abs == static_cast<quint64>(abs) ? 'f' : 'g', QLocale::FloatingPointShortest));
+#else
+    out.append(QByteArray::number(d, 'g', std::numeric_limits<double>::digits10 + 2));
+#endif
+}
+
+static void writeJsonInteger(QByteArray& out, const QVariant& value)
+{
+    // Integers that a double can represent exactly are printed the same way
+    // by every Qt version, anything bigger goes through QJsonValue.
+    const qint64 maxExactInteger = Q_INT64_C(1) << 53;
+    if (value.userType() == QMetaType::ULongLong) {
+        const qulonglong v = value.toULongLong();
+        if (v <= static_cast<qulonglong>(maxExactInteger)) {
+            out.append(QByteArray::number(v));
+            return;
+        }
     } else {
-        /*if (!isEncrypted()) {
-            //qCDebug(KDECONNECT_CORE) << "Serialized packet:" << json;
-        }*/
-        json.append('\n');
+        const qint64 v = value.toLongLong();
+        if (v <= maxExactInteger && v >= -maxExactInteger) {
+            out.append(QByteArray::number(v));
+            return;
+        }
+    }
+    writeJsonValue(out, QJsonValue::fromVariant(value));
+}
+
+static void writeJsonObject(QByteArray& out, const QVariantMap& map)
+{
+    // QVariantMap is ordered by key just like QJsonObject, so no sorting is needed
+    out.append('{');
+    for (auto it = map.constBegin(), end = map.constEnd(); it != end; ++it) {
+        if (it != map.constBegin()) {
+            out.append(',');
+        }
+        writeJsonString(out, it.key());
+        out.append(':');
+        writeJsonValue(out, it.value());
     }
+    out.append('}');
+}
+
+static void writeJsonValue(QByteArray& out, const QVariant& value)
+{
+    switch (value.userType()) {
+    case QMetaType::UnknownType:
+        out.append("null", 4);
+        break;
+    case QMetaType::Bool:
+        if (value.toBool()) {
+            out.append("true", 4);
+        } else {
+            out.append("false", 5);
+        }
+        break;
+    case QMetaType::Int:
+    case QMetaType::UInt:
+    case QMetaType::LongLong:
+    case QMetaType::ULongLong:
+        writeJsonInteger(out, value);
+        break;
+    case QMetaType::Double:
+    case QMetaType::Float:
+        writeJsonDouble(out, value.toDouble());
+        break;
+    case QMetaType::QString:
+        writeJsonString(out, value.toString());
+        break;
+    case QMetaType::QStringList: {
+        const QStringList list = value.toStringList();
+        out.append('[');
+        for (int i = 0; i < list.size(); ++i) {
+            if (i > 0) {
+                out.append(',');
+            }
+            writeJsonString(out, list.at(i));
+        }
+        out.append(']');
+        break;
+    }
+    case QMetaType::QVariantList: {
+        const QVariantList list = value.toList();
+        out.append('[');
+        for (int i = 0; i < list.size(); ++i) {
+            if (i > 0) {
+                out.append(',');
+            }
+            writeJsonValue(out, list.at(i));
+        }
+        out.append(']');
+        break;
+    }
+    case QMetaType::QVariantMap:
+        writeJsonObject(out, value.toMap());
+        break;
+    default:
+        // Less common types (QByteArray, QJsonDocument, QVariantHash, short...): let Qt
+        // decide how they map to JSON so the output doesn't change
+        writeJsonValue(out, QJsonValue::fromVariant(value));
+        break;
+    }
+}
+
+static void writeJsonValue(QByteArray& out, const QJsonValue& value)
+{
+    switch (value.type()) {
+    case QJsonValue::Bool:
+        writeJsonValue(out, QVariant(value.toBool()));
+        break;
+    case QJsonValue::Double: {
+        // Qt >= 5.15 keeps integers apart from doubles, respect that
+        const QVariant variant = value.toVariant();
+        if (variant.userType() == QMetaType::LongLong) {
+            out.append(QByteArray::number(variant.toLongLong()));
+        } else {
+            writeJsonDouble(out, value.toDouble());
+        }
+        break;
+    }
+    case QJsonValue::String:
+        writeJsonString(out, value.toString());
+        break;
+    case QJsonValue::Array: {
+        const QJsonArray array = value.toArray();
+        out.append('[');
+        for (int i = 0; i < array.size(); ++i) {
+            if (i > 0) {
+                out.append(',');
+            }
+            writeJsonValue(out, array.at(i));
+        }
+        out.append(']');
+        break;
+    }
+    case QJsonValue::Object: {
+        const QJsonObject object = value.toObject();
+        out.append('{');
+        for (auto it = object.constBegin(), end = object.constEnd(); it != end; ++it) {
+            if (it != object.constBegin()) {
+                out.append(',');
+            }
+            writeJsonString(out, it.key());
+            out.append(':');
+            writeJsonValue(out, it.value());
+        }
+        out.append('}');
+        break;
+    }
+    case QJsonValue::Null:
+    case QJsonValue::Undefined:
+        out.append("null", 4);
+        break;
+    }
+}
+
+QByteArray NetworkPacket::serialize(Encoding encoding, Compression compression) const
+{
+    if (encoding == CborEncoding) {
+        return serializeCbor(compression);
+    }
+
+    //Keys are written in the same (sorted) order QJsonObject would use:
+    //body, deflatedBody, id, payloadSize, payloadTransferInfo, type
+    QByteArray json;
+    json.reserve(s_serializeReserveSize);
+
+    json.append("{\"body\":", 8);
+    writeJsonObject(json, body());
+    if (compression == DeflateCompression) {
+        //What was just written is deflated, so the body is only serialized once
+        const QByteArray deflatedBody = deflateBody(json.constData() + 8, json.size() - 8);
+        if (!deflatedBody.isNull()) {
+            json.truncate(8);
+            json.append("{},\"deflatedBody\":\"", 19);
+            json.append(deflatedBody.toBase64());
+            json.append('"');
+        }
+    }
+    json.append(",\"id\":", 6);
+    writeJsonString(json, m_id);
+    json.append(",\"payloadSize\":", 15);
+    writeJsonInteger(json, QVariant(m_payloadSize));
+    json.append(",\"payloadTransferInfo\":", 23);
+    writeJsonObject(json, m_payloadTransferInfo);
+    json.append(",\"type\":", 8);
+    writeJsonString(json, m_type);
+    json.append("}\n", 2);
 
     return json;
 }
 
-template <class T>
-void qvariant2qobject(const QVariantMap& variant, T* object)
+// Minimal JSON scanner used by unserialize(): it only finds where each top-level
+// value starts and ends, the values themselves are parsed later (or never).
+// All the functions return the position right after what they skipped, or -1
+// if the input is malformed.
+static int skipJsonWhitespace(const char* data, int pos, int size)
 {
-    for ( QVariantMap::const_iterator iter = variant.begin(); iter != variant.end(); ++iter )
-    {
-        const int propertyIndex = T::staticMetaObject.indexOfProperty(iter.key().toLatin1());
-        if (propertyIndex < 0) {
-            qCWarning(KDECONNECT_CORE) << "missing property" << object << iter.key();
+    while (pos < size && (data[pos] == ' ' || data[pos] == '\t' || data[pos] == '\n' || data[pos] == '\r')) {
+        ++pos;
+    }
+    return pos;
+}
+
+static int skipJsonString(const char* data, int pos, int size)
+{
+    Q_ASSERT(data[pos] == '"');
+    for (++pos; pos < size; ++pos) {
+        if (data[pos] == '\\') {
+            ++pos;
+        } else if (data[pos] == '"') {
+            return pos + 1;
+        }
+    }
+    return -1;
+}
+
+static int skipJsonValue(const char* data, int pos, int size)
+{
+    if (pos >= size) {
+        return -1;
+    }
+
+    if (data[pos] == '"') {
+        return skipJsonString(data, pos, size);
+    }
+
+    if (data[pos] == '{' || data[pos] == '[') {
+        int depth = 0;
+        while (pos < size) {
+            const char c = data[pos];
+            if (c == '"') {
+                pos = skipJsonString(data, pos, size);
+                if (pos < 0) {
+                    return -1;
+                }
+                continue;
+            }
+            if (c == '{' || c == '[') {
+                ++depth;
+            } else if (c == '}' || c == ']') {
+                if (--depth == 0) {
+                    return pos + 1;
+                }
+            }
+            ++pos;
+        }
+        return -1;
+    }
+
+    //Numbers, true, false and null
+    const int start = pos;
+    while (pos < size && data[pos] != ',' && data[pos] != '}' && data[pos] != ']'
+           && data[pos] != ' ' && data[pos] != '\t' && data[pos] != '\n' && data[pos] != '\r') {
+        ++pos;
+    }
+    return pos > start ? pos : -1;
+}
+
+// Strict counterpart of skipJsonValue(), used for the body. The body is only parsed
+// when it's accessed, but malformed packets must still be rejected by unserialize(),
+// as plugins would otherwise see an empty body. Accepts exactly what QJsonDocument
+// accepts, without building any value.
+static const int s_maxJsonDepth = 1024; //Same as QJsonDocument
+
+static int validateJsonValue(const char* data, int pos, int size, int depth);
+
+static int validateJsonUtf8(const char* data, int pos, int size)
+{
+    const uchar c = data[pos];
+    int length;
+    uint codePoint;
+    if (c >= 0xc2 && c <= 0xdf) {
+        length = 2;
+        codePoint = c & 0x1f;
+    } else if (c >= 0xe0 && c <= 0xef) {
+        length = 3;
+        codePoint = c & 0x0f;
+    } else if (c >= 0xf0 && c <= 0xf4) {
+        length = 4;
+        codePoint = c & 0x07;
+    } else {
+        return -1;
+    }
+    if (pos + length > size) {
+        return -1;
+    }
+    for (int i = 1; i < length; ++i) {
+        const uchar continuation = data[pos + i];
+        if ((continuation & 0xc0) != 0x80) {
+            return -1;
+        }
+        codePoint = (codePoint << 6) | (continuation & 0x3f);
+    }
+    //Overlong forms, surrogates and values past U+10FFFF
+    static const uint minCodePoint[] = { 0, 0, 0x80, 0x800, 0x10000 };
+    if (codePoint < minCodePoint[length] || (codePoint >= 0xd800 && codePoint <= 0xdfff) || codePoint > 0x10ffff) {
+        return -1;
+    }
+    return pos + length;
+}
+
+static int validateJsonString(const char* data, int pos, int size)
+{
+    if (pos >= size || data[pos] != '"') {
+        return -1;
+    }
+    ++pos;
+    while (pos < size) {
+        const uchar c = data[pos];
+        if (c == '"') {
+            return pos + 1;
+        } else if (c < 0x20) {
+            return -1;
+        } else if (c >= 0x80) {
+            pos = validateJsonUtf8(data, pos, size);
+            if (pos < 0) {
+                return -1;
+            }
             continue;
+        } else if (c == '\\') {
+            if (++pos >= size) {
+                return -1;
+            }
+            if (data[pos] == 'u') {
+                if (pos + 4 >= size) {
+                    return -1;
+                }
+                for (int i = 1; i <= 4; ++i) {
+                    if (!isxdigit(static_cast<uchar>(data[pos + i]))) {
+                        return -1;
+                    }
+                }
+                pos += 4;
+            } else if (data[pos] == '\0' || !strchr("\"\\/bfnrt", data[pos])) {
+                return -1;
+            }
         }
+        ++pos;
+    }
+    return -1;
+}
 
-        QMetaProperty property = T::staticMetaObject.property(propertyIndex);
-        bool ret = property.writeOnGadget(object, *iter);
-        if (!ret) {
-            qCWarning(KDECONNECT_CORE) << "couldn't set" << object << "->" << property.name() << '=' << *iter;
+static int skipJsonDigits(const char* data, int pos, int size)
+{
+    const int start = pos;
+    while (pos < size && data[pos] >= '0' && data[pos] <= '9') {
+        ++pos;
+    }
+    return pos > start ? pos : -1;
+}
+
+static int validateJsonNumber(const char* data, int pos, int size)
+{
+    if (pos < size && data[pos] == '-') {
+        ++pos;
+    }
+    if (pos < size && data[pos] == '0') {
+        ++pos;
+    } else if ((pos = skipJsonDigits(data, pos, size)) < 0) {
+        return -1;
+    }
+    if (pos < size && data[pos] == '.') {
+        if ((pos = skipJsonDigits(data, pos + 1, size)) < 0) {
+            return -1;
         }
     }
+    if (pos < size && (data[pos] == 'e' || data[pos] == 'E')) {
+        ++pos;
+        if (pos < size && (data[pos] == '+' || data[pos] == '-')) {
+            ++pos;
+        }
+        if ((pos = skipJsonDigits(data, pos, size)) < 0) {
+            return -1;
+        }
+    }
+    return pos;
 }
 
-bool NetworkPacket::unserialize(const QByteArray& a, NetworkPacket* np)
+static int validateJsonLiteral(const char* data, int pos, int size, const char* literal)
 {
-    //Json -> QVariant
-    QJsonParseError parseError;
-    auto parser = QJsonDocument::fromJson(a, &parseError);
-    if (parser.isNull()) {
-        qCDebug(KDECONNECT_CORE) << "Unserialization error:" << parseError.errorString();
+    const int length = strlen(literal);
+    if (size - pos < length || memcmp(data + pos, literal, length) != 0) {
+        return -1;
+    }
+    return pos + length;
+}
+
+//Objects and arrays
+static int validateJsonContainer(const char* data, int pos, int size, int depth)
+{
+    if (depth >= s_maxJsonDepth) {
+        return -1;
+    }
+    const bool isObject = data[pos] == '{';
+    const char end = isObject ? '}' : ']';
+
+    pos = skipJsonWhitespace(data, pos + 1, size);
+    if (pos < size && data[pos] == end) {
+        return pos + 1;
+    }
+    while (pos < size) {
+        if (isObject) {
+            pos = validateJsonString(data, pos, size);
+            if (pos < 0) {
+                return -1;
+            }
+            pos = skipJsonWhitespace(data, pos, size);
+            if (pos >= size || data[pos] != ':') {
+                return -1;
+            }
+            pos = skipJsonWhitespace(data, pos + 1, size);
+        }
+        pos = validateJsonValue(data, pos, size, depth + 1);
+        if (pos < 0) {
+            return -1;
+        }
+        pos = skipJsonWhitespace(data, pos, size);
+        if (pos < size && data[pos] == end) {
+            return pos + 1;
+        } else if (pos >= size || data[pos] != ',') {
+            return -1;
+        }
+        pos = skipJsonWhitespace(data, pos + 1, size);
+    }
+    return -1;
+}
+
+static int validateJsonValue(const char* data, int pos, int size, int depth)
+{
+    if (pos >= size) {
+        return -1;
+    }
+    switch (data[pos]) {
+    case '{':
+    case '[':
+        return validateJsonContainer(data, pos, size, depth);
+    case '"':
+        return validateJsonString(data, pos, size);
+    case 't':
+        return validateJsonLiteral(data, pos, size, "true");
+    case 'f':
+        return validateJsonLiteral(data, pos, size, "false");
+    case 'n':
+        return validateJsonLiteral(data, pos, size, "null");
+    default:
+        return validateJsonNumber(data, pos, size);
+    }
+}
+
+//The whole of data has to be a single object
+static bool isValidJsonObject(const QByteArray& json)
+{
+    const int size = json.size();
+    int pos = skipJsonWhitespace(json.constData(), 0, size);
+    if (pos >= size || json[pos] != '{') {
         return false;
     }
+    pos = validateJsonContainer(json.constData(), pos, size, 0);
+    return pos >= 0 && skipJsonWhitespace(json.constData(), pos, size) == size;
+}
 
-    auto variant = parser.toVariant().toMap();
-    qvariant2qobject(variant, np);
+// Parses a single JSON value that is not an object, QJsonDocument only accepts
+// objects and arrays at the top level in Qt5
+static QVariant parseJsonScalar(const QByteArray& json)
+{
+    QByteArray array;
+    array.reserve(json.size() + 2);
+    array.append('[').append(json).append(']');
+    return QJsonDocument::fromJson(array).array().at(0).toVariant();
+}
 
-    np->m_payloadSize = variant[QStringLiteral("payloadSize")].toInt(); //Will return 0 if was not present, which is ok
+static QString parseJsonString(const QByteArray& json)
+{
+    //Fast path for strings without escape sequences, which is all of them in practice
+    if (json.size() >= 2 && json.startsWith('"') && !json.contains('\\')) {
+        return QString::fromUtf8(json.constData() + 1, json.size() - 2);
+    }
+    return parseJsonScalar(json).toString();
+}
+
+// Known types are looked up straight from the serialized bytes, so the packet gets
+// its atom and shares the interned string without allocating a new one
+static QString parseJsonType(const QByteArray& json, int* atom)
+{
+    //Escaped types are left for NetworkPacket::typeAtom() to look up
+    if (json.size() >= 2 && json.startsWith('"') && !json.contains('\\')) {
+        const PluginLoader* loader = PluginLoader::instance();
+        *atom = loader->packetTypeAtom(QByteArray::fromRawData(json.constData() + 1, json.size() - 2));
+        if (*atom >= 0) {
+            return loader->packetType(*atom);
+        }
+    }
+    return parseJsonString(json);
+}
+
+//qCompress() format: the inflated size as a 32 bits big endian integer, followed by a zlib stream
+static QByteArray inflateBody(const QByteArray& deflated)
+{
+    if (deflated.size() < 4) {
+        return QByteArray();
+    }
+    const quint32 inflatedSize = qFromBigEndian<quint32>(reinterpret_cast<const uchar*>(deflated.constData()));
+    if (inflatedSize > s_maxInflatedBodySize) {
+        qCWarning(KDECONNECT_CORE) << "Refusing to inflate a body of" << inflatedSize << "bytes";
+        return QByteArray();
+    }
+    return qUncompress(deflated);
+}
+
+bool NetworkPacket::unserialize(const QByteArray& a, NetworkPacket* np, Encoding encoding)
+{
+    if (encoding == CborEncoding) {
+        return unserializeCbor(a, np);
+    }
+
+    //Only the fields needed to route the packet (id, type and payload info) are parsed
+    //here. The body is kept serialized until somebody reads it, see parseBody().
+    const char* data = a.constData();
+    const int size = a.size();
+
+    QString id;
+    QString type;
+    int typeAtom = s_typeAtomNotLookedUp;
+    QByteArray serializedBody;
+    QByteArray deflatedBody;
+    QByteArray serializedPayloadSize;
+    QVariantMap payloadTransferInfo;
+
+    int pos = skipJsonWhitespace(data, 0, size);
+    if (pos >= size || data[pos] != '{') {
+        qCDebug(KDECONNECT_CORE) << "Unserialization error: packet is not a JSON object";
+        return false;
+    }
+    pos = skipJsonWhitespace(data, pos + 1, size);
+
+    while (pos < size && data[pos] != '}') {
+        if (data[pos] != '"') {
+            qCDebug(KDECONNECT_CORE) << "Unserialization error: expected a key at offset" << pos;
+            return false;
+        }
+        const int keyEnd = skipJsonString(data, pos, size);
+        if (keyEnd < 0) {
+            qCDebug(KDECONNECT_CORE) << "Unserialization error: unterminated key";
+            return false;
+        }
+        const QByteArray key = QByteArray::fromRawData(data + pos + 1, keyEnd - pos - 2);
+
+        pos = skipJsonWhitespace(data, keyEnd, size);
+        if (pos >= size || data[pos] != ':') {
+            qCDebug(KDECONNECT_CORE) << "Unserialization error: expected ':' at offset" << pos;
+            return false;
+        }
+        pos = skipJsonWhitespace(data, pos + 1, size);
+        const bool isBody = (key == "body");
+        const int valueEnd = isBody ? (pos < size && data[pos] == '{' ? validateJsonContainer(data, pos, size, 0) : -1)
+                                    : skipJsonValue(data, pos, size);
+        if (valueEnd < 0) {
+            qCDebug(KDECONNECT_CORE) << "Unserialization error: malformed value for" << key;
+            return false;
+        }
+        const QByteArray value = QByteArray::fromRawData(data + pos, valueEnd - pos);
+
+        if (isBody) {
+            serializedBody = QByteArray(value.constData(), value.size()); //Deep copy, value points into a
+        } else if (key == "deflatedBody") {
+            deflatedBody = QByteArray::fromBase64(parseJsonString(value).toLatin1());
+        } else if (key == "id") {
+            id = parseJsonString(value);
+        } else if (key == "type") {
+            type = parseJsonType(value, &typeAtom);
+        } else if (key == "payloadSize") {
+            serializedPayloadSize = value;
+        } else if (key == "payloadTransferInfo") {
+            payloadTransferInfo = QJsonDocument::fromJson(value).object().toVariantMap();
+        }
+
+        pos = skipJsonWhitespace(data, valueEnd, size);
+        if (pos < size && data[pos] == ',') {
+            pos = skipJsonWhitespace(data, pos + 1, size);
+        } else if (pos >= size || data[pos] != '}') {
+            qCDebug(KDECONNECT_CORE) << "Unserialization error: expected ',' or '}' at offset" << pos;
+            return false;
+        }
+    }
+    if (pos >= size) {
+        qCDebug(KDECONNECT_CORE) << "Unserialization error: unterminated packet";
+        return false;
+    }
+
+    if (!deflatedBody.isNull()) {
+        serializedBody = inflateBody(deflatedBody);
+        if (!isValidJsonObject(serializedBody)) {
+            qCDebug(KDECONNECT_CORE) << "Unserialization error: malformed deflated body";
+            return false;
+        }
+    }
+
+    if (!id.isNull()) {
+        np->m_id = id;
+    }
+    if (!type.isNull()) {
+        np->m_type = type;
+        np->m_typeAtom = typeAtom;
+    }
+    if (!serializedBody.isNull()) {
+        np->setBody(QVariantMap());
+        np->m_body->serialized = serializedBody;
+        np->m_body->serializedEncoding = JsonEncoding;
+    }
+
+    bool ok;
+    np->m_payloadSize = serializedPayloadSize.toLongLong(&ok);
+    if (!ok && !serializedPayloadSize.isEmpty()) {
+        np->m_payloadSize = parseJsonScalar(serializedPayloadSize).toLongLong();
+    } //Will be 0 if was not present, which is ok
     if (np->m_payloadSize == -1) {
-        np->m_payloadSize = np->get<int>(QStringLiteral("size"), -1);
+        np->m_payloadSize = np->get<qint64>(QStringLiteral("size"), -1);
     }
-    np->m_payloadTransferInfo = variant[QStringLiteral("payloadTransferInfo")].toMap(); //Will return an empty qvariantmap if was not present, which is ok
+    np->m_payloadTransferInfo = payloadTransferInfo; //Will be an empty qvariantmap if was not present, which is ok
 
-    //Ids containing characters that are not allowed as dbus paths would make app crash
-    if (np->m_body.contains(QStringLiteral("deviceId")))
-    {
-        QString deviceId = np->get<QString>(QStringLiteral("deviceId"));
-        DbusHelper::filterNonExportableCharacters(deviceId);
-        np->set(QStringLiteral("deviceId"), deviceId);
+    return true;
+}
+
+#if QT_VERSION >= QT_VERSION_CHECK(5, 12, 0)
+static void writeCborValue(QCborStreamWriter& writer, const QVariant& value);
+
+static void writeCborMap(QCborStreamWriter& writer, const QVariantMap& map)
+{
+    writer.startMap(map.size());
+    for (auto it = map.constBegin(), end = map.constEnd(); it != end; ++it) {
+        writer.append(QStringView(it.key()));
+        writeCborValue(writer, it.value());
+    }
+    writer.endMap();
+}
+
+static void writeCborValue(QCborStreamWriter& writer, const QVariant& value)
+{
+    switch (value.userType()) {
+    case QMetaType::UnknownType:
+        writer.appendNull();
+        break;
+    case QMetaType::Bool:
+        writer.append(value.toBool());
+        break;
+    case QMetaType::Int:
+    case QMetaType::UInt:
+    case QMetaType::LongLong:
+        writer.append(static_cast<qint64>(value.toLongLong()));
+        break;
+    case QMetaType::ULongLong:
+        writer.append(static_cast<quint64>(value.toULongLong()));
+        break;
+    case QMetaType::Double:
+    case QMetaType::Float:
+        writer.append(value.toDouble());
+        break;
+    case QMetaType::QString: {
+        const QString string = value.toString();
+        writer.append(QStringView(string));
+        break;
+    }
+    case QMetaType::QStringList: {
+        const QStringList list = value.toStringList();
+        writer.startArray(list.size());
+        for (const QString& string : list) {
+            writer.append(QStringView(string));
+        }
+        writer.endArray();
+        break;
+    }
+    case QMetaType::QVariantList: {
+        const QVariantList list = value.toList();
+        writer.startArray(list.size());
+        for (const QVariant& item : list) {
+            writeCborValue(writer, item);
+        }
+        writer.endArray();
+        break;
+    }
+    case QMetaType::QVariantMap:
+        writeCborMap(writer, value.toMap());
+        break;
+    default:
+        QCborValue::fromVariant(value).toCbor(writer);
+        break;
+    }
+}
+
+static QString readCborString(QCborStreamReader& reader)
+{
+    QString string;
+    auto chunk = reader.readString();
+    while (chunk.status == QCborStreamReader::Ok) {
+        string += chunk.data;
+        chunk = reader.readString();
+    }
+    return string;
+}
+
+QByteArray NetworkPacket::serializeCbor(Compression compression) const
+{
+    QByteArray cbor;
+    cbor.reserve(s_serializeReserveSize);
+    QBuffer buffer(&cbor);
+    buffer.open(QIODevice::WriteOnly);
+    QCborStreamWriter writer(&buffer);
+
+    //The header of the map is written by hand, so a body that was serialized on its own,
+    //to try deflating it, can be written as is instead of being serialized again
+    static const char mapOfFivePairs = char(0xa5);
+    buffer.putChar(mapOfFivePairs);
+    writer.append(QLatin1String("id"));
+    writer.append(QStringView(m_id));
+    writer.append(QLatin1String("type"));
+    writer.append(QStringView(m_type));
+    if (compression == DeflateCompression) {
+        QByteArray serializedBody;
+        QCborStreamWriter bodyWriter(&serializedBody);
+        writeCborMap(bodyWriter, body());
+
+        const QByteArray deflatedBody = deflateBody(serializedBody.constData(), serializedBody.size());
+        if (deflatedBody.isNull()) {
+            writer.append(QLatin1String("body"));
+            buffer.write(serializedBody);
+        } else {
+            writer.append(QLatin1String("deflatedBody"));
+            writer.appendByteString(deflatedBody.constData(), deflatedBody.size());
+        }
+    } else {
+        writer.append(QLatin1String("body"));
+        writeCborMap(writer, body());
+    }
+    writer.append(QLatin1String("payloadSize"));
+    writer.append(static_cast<qint64>(m_payloadSize));
+    writer.append(QLatin1String("payloadTransferInfo"));
+    writeCborMap(writer, m_payloadTransferInfo);
+
+    return cbor;
+}
+
+bool NetworkPacket::unserializeCbor(const QByteArray& cbor, NetworkPacket* np)
+{
+    //Same idea as the JSON version: the body is skipped and only parsed on demand
+    QCborStreamReader reader(cbor);
+    if (!reader.isMap() || !reader.enterContainer()) {
+        qCDebug(KDECONNECT_CORE) << "Unserialization error: packet is not a CBOR map";
+        return false;
+    }
+
+    QString id;
+    QString type;
+    QByteArray serializedBody;
+    QByteArray deflatedBody;
+    QVariant payloadSize;
+    QVariantMap payloadTransferInfo;
+
+    while (reader.lastError() == QCborError::NoError && reader.hasNext()) {
+        if (!reader.isString()) {
+            reader.next(); //Skip the key and its value, we only use string keys
+            reader.next();
+            continue;
+        }
+        const QString key = readCborString(reader);
+
+        if (key == QLatin1String("body")) {
+            //Skipping it checks its structure, the map itself is only built on demand
+            if (!reader.isMap()) {
+                qCDebug(KDECONNECT_CORE) << "Unserialization error: the body is not a CBOR map";
+                return false;
+            }
+            const qint64 start = reader.currentOffset();
+            reader.next();
+            serializedBody = cbor.mid(start, reader.currentOffset() - start);
+        } else if (key == QLatin1String("deflatedBody")) {
+            deflatedBody = QCborValue::fromCbor(reader).toByteArray();
+        } else if (key == QLatin1String("id")) {
+            id = reader.isString() ? readCborString(reader) : QCborValue::fromCbor(reader).toVariant().toString();
+        } else if (key == QLatin1String("type")) {
+            type = reader.isString() ? readCborString(reader) : QCborValue::fromCbor(reader).toVariant().toString();
+        } else if (key == QLatin1String("payloadSize")) {
+            payloadSize = QCborValue::fromCbor(reader).toVariant();
+        } else if (key == QLatin1String("payloadTransferInfo")) {
+            payloadTransferInfo = QCborValue::fromCbor(reader).toMap().toVariantMap();
+        } else {
+            reader.next();
+        }
     }
 
+    if (reader.lastError() != QCborError::NoError || !reader.leaveContainer()) {
+        qCDebug(KDECONNECT_CORE) << "Unserialization error:" << reader.lastError().toString();
+        return false;
+    }
+
+    if (!deflatedBody.isNull()) {
+        serializedBody = inflateBody(deflatedBody);
+        QCborStreamReader bodyReader(serializedBody);
+        if (!bodyReader.isMap() || !bodyReader.next() || bodyReader.currentOffset() != serializedBody.size()) {
+            qCDebug(KDECONNECT_CORE) << "Unserialization error: malformed deflated body";
+            return false;
+        }
+    }
+
+    if (!id.isNull()) {
+        np->m_id = id;
+    }
+    if (!type.isNull()) {
+        //Same as the JSON version, the packet shares the interned string
+        const PluginLoader* loader = PluginLoader::instance();
+        np->m_typeAtom = loader->packetTypeAtom(type);
+        np->m_type = np->m_typeAtom >= 0 ? loader->packetType(np->m_typeAtom) : type;
+    }
+    if (!serializedBody.isNull()) {
+        np->setBody(QVariantMap());
+        np->m_body->serialized = serializedBody;
+        np->m_body->serializedEncoding = CborEncoding;
+    }
+
+    np->m_payloadSize = payloadSize.toLongLong(); //Will return 0 if was not present, which is ok
+    if (np->m_payloadSize == -1) {
+        np->m_payloadSize = np->get<qint64>(QStringLiteral("size"), -1);
+    }
+    np->m_payloadTransferInfo = payloadTransferInfo;
+
     return true;
+}
+#else
+QByteArray NetworkPacket::serializeCbor(Compression compression) const
+{
+    //Never negotiated when built without CBOR support
+    qCWarning(KDECONNECT_CORE) << "CBOR encoding is not supported, falling back to JSON";
+    return serialize(JsonEncoding, compression);
+}
+
+bool NetworkPacket::unserializeCbor(const QByteArray& cbor, NetworkPacket* np)
+{
+    Q_UNUSED(cbor);
+    Q_UNUSED(np);
+    qCWarning(KDECONNECT_CORE) << "CBOR encoding is not supported";
+    return false;
+}
+#endif
+
+//Returns a null QByteArray if the body is too small to be worth compressing
+QByteArray NetworkPacket::deflateBody(const char* serializedBody, int size)
+{
+    if (size < s_compressionThreshold) {
+        return QByteArray();
+    }
+    const QByteArray deflated = qCompress(reinterpret_cast<const uchar*>(serializedBody), size, s_compressionLevel);
+    if (deflated.size() >= size) {
+        return QByteArray();
+    }
+    return deflated;
+}
+
+void NetworkPacket::parseBody() const
+{
+    Q_ASSERT(!m_body->serialized.isNull());
+
+    //Already validated by unserialize(), so this is not expected to fail
+    Body* body = m_body.data();
+    const QByteArray serializedBody = body->serialized;
+    body->serialized = QByteArray();
+
+#if QT_VERSION >= QT_VERSION_CHECK(5, 12, 0)
+    if (body->serializedEncoding == CborEncoding) {
+        QCborParserError parseError;
+        const QCborValue value = QCborValue::fromCbor(serializedBody, &parseError);
+        if (!value.isMap()) {
+            qCWarning(KDECONNECT_CORE) << "Could not parse the body of" << m_type << ":" << parseError.errorString();
+            body->map.clear();
+            return;
+        }
+        body->map = value.toMap().toVariantMap();
+    } else
+#endif
+    {
+        QJsonParseError parseError;
+        const QJsonDocument document = QJsonDocument::fromJson(serializedBody, &parseError);
+        if (!document.isObject()) {
+            qCWarning(KDECONNECT_CORE) << "Could not parse the body of" << m_type << ":" << parseError.errorString();
+            body->map.clear();
+            return;
+        }
+        body->map = document.object().toVariantMap();
+    }
 
+    //Ids containing characters that are not allowed as dbus paths would make app crash
+    auto deviceIdIt = body->map.find(QStringLiteral("deviceId"));
+    if (deviceIdIt != body->map.end()) {
+        QString deviceId = deviceIdIt->toString();
+        DbusHelper::filterNonExportableCharacters(deviceId);
+        *deviceIdIt = deviceId;
+    }
 }
 
 FileTransferJob* NetworkPacket::createPayloadTransferJob(const QUrl& destination) const
@@ -179,3 +1149,45 @@ FileTransferJob* NetworkPacket::createPayloadTransferJob(const QUrl& destination
     return new FileTransferJob(this, destination);
 }
 
+bool NetworkPacket::inlinePayload(Encoding encoding, qint64 maxSize)
+{
+    //Sequential devices might not have everything available yet, and an open device
+    //could be in use, so those are left for the link to transfer
+    if (!m_payload || m_payloadSize <= 0 || m_payloadSize > maxSize || m_payload->isSequential() || m_payload->isOpen()) {
+        return false;
+    }
+
+    if (!m_payload->open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    const QByteArray data = m_payload->read(m_payloadSize);
+    m_payload->close();
+    if (data.size() != m_payloadSize) {
+        return false;
+    }
+
+    //JSON has no binary type
+    if (encoding == CborEncoding) {
+        m_payloadTransferInfo = {{QStringLiteral("inline"), data}};
+    } else {
+        m_payloadTransferInfo = {{QStringLiteral("inline"), QString::fromLatin1(data.toBase64())}};
+    }
+    return true;
+}
+
+void NetworkPacket::extractInlinePayload()
+{
+    const QVariant data = m_payloadTransferInfo.value(QStringLiteral("inline"));
+
+    QBuffer* buffer = new QBuffer();
+    if (data.userType() == QMetaType::QString) {
+        buffer->setData(QByteArray::fromBase64(data.toString().toLatin1()));
+    } else {
+        buffer->setData(data.toByteArray());
+    }
+    buffer->open(QIODevice::ReadOnly);
+
+    m_payload = QSharedPointer<QIODevice>(buffer);
+    m_payloadSize = buffer->size();
+}
+
@@ -28,6 +28,7 @@
 #include <QVariant>
 #include <QIODevice>
 #include <QSharedPointer>
+#include <QSharedData>
 #include <QUrl>
 
 #include "kdeconnectcore_export.h"
@@ -47,29 +48,65 @@ public:
 
     const static int s_protocolVersion;
 
+    /**
+     * Wire format of the packets. JSON is what every client understands and is always
+     * used for identity packets, CBOR can be used after the handshake if both sides
+     * list it in the "encodings" field of their identity packets.
+     */
+    enum Encoding { JsonEncoding, CborEncoding };
+
+    /**
+     * Bodies bigger than s_compressionThreshold can be sent deflated if the other side lists
+     * "deflate" in the "compressions" field of its identity packet. Receiving them is always
+     * supported, and transparent for the users of the packet.
+     */
+    enum Compression { NoCompression, DeflateCompression };
+    const static int s_compressionThreshold;
+
+    /**
+     * Payloads up to the size the other side lists in the "inlinePayloadSize" field of its
+     * identity packet can be sent inside the packet, in its payloadTransferInfo. Once
+     * received they are available through payload() like any other.
+     */
+    const static qint64 s_maxInlinePayloadSize;
+
     explicit NetworkPacket(const QString& type = QStringLiteral("empty"), const QVariantMap& body = {});
-    NetworkPacket(const NetworkPacket& other); // Copy constructor, required for QMetaType and queued signals
+    //Copies share the body (parsed or not) until one of them modifies it, so they are cheap
+    NetworkPacket(const NetworkPacket& other) = default; // Copy constructor, required for QMetaType and queued signals
+    //A moved-from packet is left without id and type and with an empty body, but it stays usable
+    NetworkPacket(NetworkPacket&& other) noexcept;
+    NetworkPacket& operator=(const NetworkPacket& other) = default;
+    NetworkPacket& operator=(NetworkPacket&& other) noexcept;
 
     static void createIdentityPacket(NetworkPacket*);
+    static Encoding negotiateEncoding(const NetworkPacket& identityPacket);
+    static Compression negotiateCompression(const NetworkPacket& identityPacket);
+    static qint64 negotiateInlinePayloadSize(const NetworkPacket& identityPacket);
 
-    QByteArray serialize() const;
-    static bool unserialize(const QByteArray& json, NetworkPacket* out);
+    //JSON packets include their trailing '\n', CBOR packets are framed by the link
+    QByteArray serialize(Encoding encoding = JsonEncoding, Compression compression = NoCompression) const;
+    static bool unserialize(const QByteArray& data, NetworkPacket* out, Encoding encoding = JsonEncoding);
 
     const QString& id() const { return m_id; }
     const QString& type() const { return m_type; }
-    QVariantMap& body() { return m_body; }
-    const QVariantMap& body() const { return m_body; }
+    int typeAtom() const; //See PluginLoader::packetTypeAtom()
+    //Received packets keep their body serialized until it's accessed for the first time
+    QVariantMap& body();
+    const QVariantMap& body() const { if (!m_body->serialized.isNull()) parseBody(); return m_body->map; }
 
     //Get and set info from body. Note that id and type can not be accessed through these.
     template<typename T> T get(const QString& key, const T& defaultValue = {}) const {
-        return m_body.value(key,defaultValue).template value<T>(); //Important note: Awesome template syntax is awesome
+        return body().value(key,defaultValue).template value<T>(); //Important note: Awesome template syntax is awesome
     }
-    template<typename T> void set(const QString& key, const T& value) { m_body[key] = QVariant(value); }
-    bool has(const QString& key) const { return m_body.contains(key); }
+    template<typename T> void set(const QString& key, const T& value) { body()[key] = QVariant(value); }
+    bool has(const QString& key) const { return body().contains(key); }
 
     QSharedPointer<QIODevice> payload() const { return m_payload; }
     void setPayload(const QSharedPointer<QIODevice>& device, qint64 payloadSize) { m_payload = device; m_payloadSize = payloadSize; Q_ASSERT(m_payloadSize >= -1); }
     bool hasPayload() const { return (m_payloadSize != 0); }
+    //Not sent, set by the plugins on bulk transfers so the links let other packets go first
+    bool isBulk() const { return m_bulk; }
+    void setBulk(bool bulk) { m_bulk = bulk; }
     qint64 payloadSize() const { return m_payloadSize; } //-1 means it is an endless stream
     FileTransferJob* createPayloadTransferJob(const QUrl& destination) const;
 
@@ -77,21 +114,44 @@ public:
     QVariantMap payloadTransferInfo() const { return m_payloadTransferInfo; }
     void setPayloadTransferInfo(const QVariantMap& map) { m_payloadTransferInfo = map; }
     bool hasPayloadTransferInfo() const { return !m_payloadTransferInfo.isEmpty(); }
+    //Returns false, without touching the payload, if it's too big or can't be read at once
+    bool inlinePayload(Encoding encoding, qint64 maxSize);
+    bool hasInlinePayload() const { return m_payloadTransferInfo.contains(QStringLiteral("inline")); }
+    void extractInlinePayload();
 
 private:
 
     void setId(const QString& id) { m_id = id; }
-    void setType(const QString& t) { m_type = t; }
-    void setBody(const QVariantMap& b) { m_body = b; }
+    void setType(const QString& t) { m_type = t; m_typeAtom = s_typeAtomNotLookedUp; }
+    void setBody(const QVariantMap& b);
     void setPayloadSize(qint64 s) { m_payloadSize = s; }
 
+    QByteArray serializeCbor(Compression compression) const;
+    static QByteArray deflateBody(const char* serializedBody, int size);
+    static bool unserializeCbor(const QByteArray& cbor, NetworkPacket* out);
+    void parseBody() const;
+
+    const static int s_typeAtomNotLookedUp = -2;
+
     QString m_id;
     QString m_type;
-    QVariantMap m_body;
-	
+    mutable int m_typeAtom;
+
+    //Shared between copies of the packet, only detached by the non-const accessors.
+    //Parsing a serialized body fills the shared map, so it is only parsed once for all
+    //the copies (packets are only used from the main thread).
+    struct Body : public QSharedData {
+        QVariantMap map;
+        QByteArray serialized; //Not null while the body hasn't been parsed yet
+        Encoding serializedEncoding = JsonEncoding;
+    };
+    QExplicitlySharedDataPointer<Body> m_body; //Never null
+    static QExplicitlySharedDataPointer<Body> emptyBody();
+
     QSharedPointer<QIODevice> m_payload;
     qint64 m_payloadSize;
     QVariantMap m_payloadTransferInfo;
+    bool m_bulk;
 
 };
 
@@ -0,0 +1,148 @@
+/**
+ * Copyright 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "payloadhasher.h"
+
+#include <QTimer>
+
+#include "core_debug.h"
+
+//For hashPrefix(), the prefix can be gigabytes
+static const int s_prefixChunkSize = 1024 * 1024;
+
+QStringList PayloadHasher::supportedAlgorithms()
+{
+    return {QStringLiteral("sha256")};
+}
+
+QString PayloadHasher::negotiateAlgorithm(const QStringList& algorithms)
+{
+    for (const QString& algorithm : supportedAlgorithms()) {
+        if (algorithms.contains(algorithm)) {
+            return algorithm;
+        }
+    }
+    return QString();
+}
+
+QCryptographicHash::Algorithm PayloadHasher::algorithm(const QString& name)
+{
+    Q_ASSERT(supportedAlgorithms().contains(name));
+    Q_UNUSED(name);
+    return QCryptographicHash::Sha256;
+}
+
+PayloadHasher::PayloadHasher(const QSharedPointer<QIODevice>& payload, qint64 size, const QString& algorithm)
+    : m_payload(payload)
+    , m_remaining(size)
+    , m_hash(PayloadHasher::algorithm(algorithm))
+    , m_hashSize(QCryptographicHash::hash(QByteArray(), PayloadHasher::algorithm(algorithm)).size())
+    , m_payloadFinished(false)
+{
+    open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+    connect(m_payload.data(), &QIODevice::readyRead, this, &PayloadHasher::payloadReadyRead);
+    connect(m_payload.data(), &QIODevice::readChannelFinished, this, &PayloadHasher::payloadFinished);
+}
+
+bool PayloadHasher::hashPrefix(QIODevice* device, qint64 size)
+{
+    QByteArray buffer(static_cast<int>(qMin<qint64>(size, s_prefixChunkSize)), Qt::Uninitialized);
+    for (qint64 left = size; left > 0;) {
+        const qint64 read = device->read(buffer.data(), qMin<qint64>(left, buffer.size()));
+        if (read <= 0) {
+            qCWarning(KDECONNECT_CORE) << "PayloadHasher - couldn't read the start of the payload" << device->errorString();
+            return false;
+        }
+        m_hash.addData(buffer.constData(), static_cast<int>(read));
+        left -= read;
+    }
+    return true;
+}
+
+qint64 PayloadHasher::bytesAvailable() const
+{
+    return qMin(m_payload->bytesAvailable(), m_remaining) + QIODevice::bytesAvailable();
+}
+
+bool PayloadHasher::isHashReady() const
+{
+    return m_remaining == 0 && (m_payloadFinished || m_payload->bytesAvailable() >= m_hashSize);
+}
+
+bool PayloadHasher::verify()
+{
+    const QByteArray expected = m_payload->read(m_hashSize);
+    if (expected != m_hash.result()) {
+        qCWarning(KDECONNECT_CORE) << "PayloadHasher - the payload doesn't match its hash";
+        return false;
+    }
+    return true;
+}
+
+qint64 PayloadHasher::readData(char* data, qint64 maxSize)
+{
+    if (m_remaining == 0) {
+        return -1;
+    }
+
+    const qint64 read = m_payload->read(data, qMin(maxSize, m_remaining));
+    if (read <= 0) {
+        return read;
+    }
+
+    m_hash.addData(data, static_cast<int>(read));
+    m_remaining -= read;
+    if (m_remaining == 0) {
+        //Whoever reads us is probably still inside read()
+        QTimer::singleShot(0, this, [this]() {
+            Q_EMIT readChannelFinished();
+            if (isHashReady()) {
+                Q_EMIT hashReady();
+            }
+        });
+    }
+    return read;
+}
+
+qint64 PayloadHasher::writeData(const char* data, qint64 maxSize)
+{
+    Q_UNUSED(data);
+    Q_UNUSED(maxSize);
+    return -1;
+}
+
+void PayloadHasher::payloadReadyRead()
+{
+    if (m_remaining > 0) {
+        Q_EMIT readyRead();
+    } else if (isHashReady()) {
+        Q_EMIT hashReady();
+    }
+}
+
+void PayloadHasher::payloadFinished()
+{
+    m_payloadFinished = true;
+    if (m_remaining > 0) {
+        Q_EMIT readChannelFinished();
+    } else {
+        Q_EMIT hashReady(); //verify() will fail if the hash didn't arrive
+    }
+}
@@ -0,0 +1,83 @@
+/**
+ * Copyright 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef PAYLOADHASHER_H
+#define PAYLOADHASHER_H
+
+#include <QCryptographicHash>
+#include <QIODevice>
+#include <QSharedPointer>
+#include <QStringList>
+
+#include "kdeconnectcore_export.h"
+
+/*
+ * Reads a payload that is followed by its hash ("hash" in the payloadTransferInfo)
+ * and hashes it on the way, so it can be verified without reading the file again.
+ * It ends after the payload size, the hash is then checked with verify().
+ * The hash always covers the whole payload. When a transfer is resumed, the part
+ * that is already here is added with hashPrefix() before reading the rest.
+ */
+class KDECONNECTCORE_EXPORT PayloadHasher
+    : public QIODevice
+{
+    Q_OBJECT
+
+public:
+    //For the "payloadHashes" field of the identity packet
+    static QStringList supportedAlgorithms();
+    //Empty if we don't support any of the algorithms
+    static QString negotiateAlgorithm(const QStringList& algorithms);
+    static QCryptographicHash::Algorithm algorithm(const QString& name);
+
+    //@p size is what is left to read of the payload
+    PayloadHasher(const QSharedPointer<QIODevice>& payload, qint64 size, const QString& algorithm);
+
+    //Hashes the first @p size bytes of @p device, the start of the payload we already have
+    bool hashPrefix(QIODevice* device, qint64 size);
+
+    bool isSequential() const override { return true; }
+    qint64 bytesAvailable() const override;
+    bool atEnd() const override { return m_remaining == 0; }
+
+    //Whether verify() can be called: the payload was read and the hash arrived, or never will
+    bool isHashReady() const;
+    bool verify();
+
+Q_SIGNALS:
+    void hashReady();
+
+protected:
+    qint64 readData(char* data, qint64 maxSize) override;
+    qint64 writeData(const char* data, qint64 maxSize) override;
+
+private Q_SLOTS:
+    void payloadReadyRead();
+    void payloadFinished();
+
+private:
+    QSharedPointer<QIODevice> m_payload;
+    qint64 m_remaining;
+    QCryptographicHash m_hash;
+    int m_hashSize;
+    bool m_payloadFinished;
+};
+
+#endif
@@ -27,6 +27,7 @@
 #include "core_debug.h"
 #include "device.h"
 #include "kdeconnectplugin.h"
+#include "networkpackettypes.h"
 
 //In older Qt released, qAsConst isnt available
 #include "qtcompat_p.h"
@@ -40,9 +41,31 @@ PluginLoader* PluginLoader::instance()
 PluginLoader::PluginLoader()
 {
     const QVector<KPluginMetaData> data = KPluginLoader::findPlugins(QStringLiteral("kdeconnect/"));
+    //Every type in networkpackettypes.h, the rest comes from the plugins
+    for (const QString& type : {PACKET_TYPE_IDENTITY, PACKET_TYPE_PAIR, PACKET_TYPE_PAYLOAD}) {
+        internPacketType(type);
+    }
+
     for (const KPluginMetaData& metadata : data) {
         plugins[metadata.pluginId()] = metadata;
+
+        const QStringList incoming = KPluginMetaData::readStringList(metadata.rawData(), QStringLiteral("X-KdeConnect-SupportedPacketType"));
+        const QStringList outgoing = KPluginMetaData::readStringList(metadata.rawData(), QStringLiteral("X-KdeConnect-OutgoingPacketType"));
+        for (const QString& type : incoming + outgoing) {
+            internPacketType(type);
+        }
+    }
+}
+
+int PluginLoader::internPacketType(const QString& type)
+{
+    auto it = m_packetTypeAtoms.constFind(type);
+    if (it == m_packetTypeAtoms.constEnd()) {
+        it = m_packetTypeAtoms.insert(type, m_packetTypes.size());
+        m_packetTypeAtomsUtf8.insert(type.toUtf8(), it.value());
+        m_packetTypes.append(type);
     }
+    return it.value();
 }
 
 QStringList PluginLoader::getPluginList() const
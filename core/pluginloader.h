@@ -24,6 +24,7 @@
 #include <QObject>
 #include <QHash>
 #include <QString>
+#include <QVector>
 
 #include <KPluginMetaData>
 
@@ -44,9 +45,25 @@ public:
     QStringList outgoingCapabilities() const;
     QSet<QString> pluginsForCapabilities(const QSet<QString>& incoming, const QSet<QString>& outgoing);
 
+    /**
+     * Packet types are interned into small consecutive integers ("atoms"), so
+     * packets can be routed with array lookups instead of string comparisons.
+     * All the types in networkpackettypes.h and in the plugins metadata are
+     * interned on construction. packetTypeAtom() returns -1 for unknown types.
+     */
+    int packetTypeAtom(const QString& type) const { return m_packetTypeAtoms.value(type, -1); }
+    //For received packets, looked up from the UTF-8 bytes before any QString is created
+    int packetTypeAtom(const QByteArray& type) const { return m_packetTypeAtomsUtf8.value(type, -1); }
+    //The interned string, shared by all the packets of that type
+    const QString& packetType(int atom) const { return m_packetTypes.at(atom); }
+    int internPacketType(const QString& type);
+
 private:
     PluginLoader();
     QHash<QString, KPluginMetaData> plugins;
+    QHash<QString, int> m_packetTypeAtoms;
+    QHash<QByteArray, int> m_packetTypeAtomsUtf8;
+    QVector<QString> m_packetTypes; //Indexed by atom
 
 
 };
@@ -0,0 +1,257 @@
+/**
+ * Copyright 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "transferscheduler.h"
+
+#include <KJob>
+#include <QJsonObject>
+
+TransferScheduler::TransferScheduler(QObject* parent)
+    : QObject(parent)
+    , m_maxActiveTransfers(s_defaultMaxActiveTransfers)
+    , m_stallTimeoutMs(0)
+    , m_turn(0)
+    , m_schedulePending(false)
+{
+    setStallTimeout(s_defaultStallTimeoutMs);
+    connect(&m_stallTimer, &QTimer::timeout, this, &TransferScheduler::checkStalled);
+    m_clock.start();
+}
+
+void TransferScheduler::setMaxActiveTransfers(int maxActiveTransfers)
+{
+    m_maxActiveTransfers = qMax(1, maxActiveTransfers);
+    scheduleLater();
+}
+
+void TransferScheduler::enqueue(KJob* job, const QString& deviceId, const QString& name, qint64 size, QObject* group, int groupLimit)
+{
+    m_transfers.append({job, deviceId, name, size, group, qMax(1, groupLimit), Pending, 0, 0});
+
+    connect(job, &KJob::finished, this, &TransferScheduler::remove);
+    connect(job, &QObject::destroyed, this, &TransferScheduler::remove);
+
+    Q_EMIT queueChanged();
+    scheduleLater();
+}
+
+void TransferScheduler::setStallTimeout(int stallTimeoutMs)
+{
+    m_stallTimeoutMs = stallTimeoutMs;
+    //A transfer stalls a bit later than the timeout at most
+    m_stallTimer.setInterval(qMax(1, stallTimeoutMs / 4));
+}
+
+void TransferScheduler::deviceUnreachable(const QString& deviceId)
+{
+    bool changed = false;
+    for (Transfer& transfer : m_transfers) {
+        if (transfer.state == Active && transfer.deviceId == deviceId) {
+            transfer.state = Stalled;
+            changed = true;
+        }
+    }
+
+    if (changed) {
+        Q_EMIT queueChanged();
+        scheduleLater();
+    }
+}
+
+void TransferScheduler::checkStalled()
+{
+    bool changed = false;
+    for (Transfer& transfer : m_transfers) {
+        if (transfer.state == Pending) {
+            continue;
+        }
+
+        const qulonglong sent = transfer.job->processedAmount(KJob::Bytes);
+        if (sent != transfer.sent) {
+            transfer.sent = sent;
+            transfer.sentTime = m_clock.elapsed();
+            if (transfer.state == Stalled) {
+                transfer.state = Active;
+                changed = true;
+            }
+        } else if (transfer.state == Active && m_clock.elapsed() - transfer.sentTime >= m_stallTimeoutMs) {
+            transfer.state = Stalled;
+            changed = true;
+        }
+    }
+
+    if (changed) {
+        Q_EMIT queueChanged();
+        scheduleLater();
+    }
+}
+
+void TransferScheduler::remove(QObject* job)
+{
+    for (int i = 0; i < m_transfers.size(); i++) {
+        if (m_transfers[i].job == job) {
+            m_transfers.removeAt(i);
+            disconnect(job, nullptr, this, nullptr);
+            if (m_transfers.isEmpty()) {
+                m_stallTimer.stop();
+            }
+
+            Q_EMIT queueChanged();
+            scheduleLater();
+            return;
+        }
+    }
+}
+
+void TransferScheduler::scheduleLater()
+{
+    //Not right away, the job that just finished is still emitting its result
+    if (!m_schedulePending) {
+        m_schedulePending = true;
+        QMetaObject::invokeMethod(this, "schedule", Qt::QueuedConnection);
+    }
+}
+
+void TransferScheduler::schedule()
+{
+    m_schedulePending = false;
+
+    bool started = false;
+    while (activeTransfers() < m_maxActiveTransfers) {
+        const int next = nextTransfer();
+        if (next < 0) {
+            break;
+        }
+
+        Transfer& transfer = m_transfers[next];
+        transfer.state = Active;
+        transfer.sent = transfer.job->processedAmount(KJob::Bytes);
+        transfer.sentTime = m_clock.elapsed();
+        m_lastServed[transfer.deviceId] = ++m_turn;
+        started = true;
+
+        //The receiver may queue more transfers, don't keep the reference around
+        Q_EMIT transferAllowed(transfer.job);
+    }
+
+    if (started) {
+        if (!m_stallTimer.isActive()) {
+            m_stallTimer.start();
+        }
+        Q_EMIT queueChanged();
+    }
+}
+
+int TransferScheduler::nextTransfer() const
+{
+    int next = -1;
+    int nextActive = 0;
+    quint64 nextServed = 0;
+
+    for (int i = 0; i < m_transfers.size(); i++) {
+        const Transfer& transfer = m_transfers[i];
+        //Stalled transfers don't take one of our slots, but still count for their group, or it
+        //would start all its files while the other device doesn't read the first ones
+        if (transfer.state != Pending || startedCount(transfer.group) >= transfer.groupLimit) {
+            continue;
+        }
+
+        //Devices that never got a slot have waited the longest
+        const int active = activeCount(transfer.deviceId);
+        const quint64 served = m_lastServed.value(transfer.deviceId);
+        if (next < 0 || active < nextActive || (active == nextActive && served < nextServed)) {
+            next = i;
+            nextActive = active;
+            nextServed = served;
+        }
+    }
+
+    return next;
+}
+
+int TransferScheduler::activeCount(const QString& deviceId) const
+{
+    int count = 0;
+    for (const Transfer& transfer : m_transfers) {
+        if (transfer.state == Active && transfer.deviceId == deviceId) {
+            count++;
+        }
+    }
+    return count;
+}
+
+int TransferScheduler::startedCount(QObject* group) const
+{
+    int count = 0;
+    for (const Transfer& transfer : m_transfers) {
+        if (transfer.state != Pending && transfer.group == group) {
+            count++;
+        }
+    }
+    return count;
+}
+
+int TransferScheduler::pendingTransfers() const
+{
+    int count = 0;
+    for (const Transfer& transfer : m_transfers) {
+        if (transfer.state == Pending) {
+            count++;
+        }
+    }
+    return count;
+}
+
+int TransferScheduler::activeTransfers() const
+{
+    int count = 0;
+    for (const Transfer& transfer : m_transfers) {
+        if (transfer.state == Active) {
+            count++;
+        }
+    }
+    return count;
+}
+
+QJsonArray TransferScheduler::queue() const
+{
+    static const QHash<int, QString> stateNames = {
+        {Active, QStringLiteral("active")},
+        {Stalled, QStringLiteral("stalled")},
+        {Pending, QStringLiteral("pending")}
+    };
+
+    QJsonArray queue;
+    for (State state : {Active, Stalled, Pending}) {
+        for (const Transfer& transfer : m_transfers) {
+            if (transfer.state != state) {
+                continue;
+            }
+            queue.append(QJsonObject {
+                {QStringLiteral("deviceId"), transfer.deviceId},
+                {QStringLiteral("name"), transfer.name},
+                {QStringLiteral("size"), transfer.size},
+                {QStringLiteral("sent"), state != Pending ? qint64(transfer.job->processedAmount(KJob::Bytes)) : qint64(0)},
+                {QStringLiteral("state"), stateNames.value(state)}
+            });
+        }
+    }
+    return queue;
+}
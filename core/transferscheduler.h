@@ -0,0 +1,121 @@
+/**
+ * Copyright 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef TRANSFERSCHEDULER_H
+#define TRANSFERSCHEDULER_H
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QJsonArray>
+#include <QList>
+#include <QObject>
+#include <QPointer>
+#include <QTimer>
+
+#include "kdeconnectcore_export.h"
+
+class KJob;
+
+/*
+ * Daemon wide queue for the files we send, so sharing to many devices at
+ * once doesn't start a stream per file and device competing for the disk and
+ * the uplink.
+ *
+ * Only a few transfers run at the same time. When one finishes the slot goes
+ * to the device with the fewest running transfers, and among those to the one
+ * that waited the longest, so a big batch to a device doesn't hold up others.
+ *
+ * A transfer that sends nothing for a while, or whose device goes away, gives
+ * its slot up, so a device that never connects can't block the others. It
+ * keeps its place in its group and takes a slot again once data flows.
+ */
+class KDECONNECTCORE_EXPORT TransferScheduler
+    : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit TransferScheduler(QObject* parent = nullptr);
+
+    //Across all the devices
+    void setMaxActiveTransfers(int maxActiveTransfers);
+    int maxActiveTransfers() const { return m_maxActiveTransfers; }
+    const static int s_defaultMaxActiveTransfers = 4;
+
+    //transferAllowed() is emitted once the job can start. At most groupLimit jobs of the same
+    //group run at once. The slot is freed when the job finishes or is deleted, or while it stalls
+    void enqueue(KJob* job, const QString& deviceId, const QString& name, qint64 size, QObject* group, int groupLimit);
+
+    //How long a running transfer can go without sending anything before it gives its slot up
+    void setStallTimeout(int stallTimeoutMs);
+    const static int s_defaultStallTimeoutMs = 30000;
+    //The running transfers to the device give their slots up right away
+    void deviceUnreachable(const QString& deviceId);
+
+    int pendingTransfers() const;
+    int activeTransfers() const;
+
+    //Active transfers first, then stalled and pending ones, each in the order they were queued
+    QJsonArray queue() const;
+
+Q_SIGNALS:
+    void transferAllowed(KJob* job);
+    void queueChanged();
+
+private Q_SLOTS:
+    void schedule();
+    void checkStalled();
+
+private:
+    enum State {
+        Pending,
+        Active,
+        Stalled //Started, but without a slot
+    };
+
+    struct Transfer {
+        KJob* job;
+        QString deviceId;
+        QString name;
+        qint64 size;
+        QObject* group;
+        int groupLimit;
+        State state;
+        qulonglong sent; //When checkStalled() last looked
+        qint64 sentTime; //When it last sent something, on m_clock
+    };
+
+    void scheduleLater();
+    void remove(QObject* job);
+    int nextTransfer() const;
+    int activeCount(const QString& deviceId) const;
+    int startedCount(QObject* group) const;
+
+    int m_maxActiveTransfers;
+    int m_stallTimeoutMs;
+    QTimer m_stallTimer;
+    QElapsedTimer m_clock;
+    QList<Transfer> m_transfers; //In the order they were queued
+    QHash<QString, quint64> m_lastServed; //Device id to the turn it last got a slot
+    quint64 m_turn;
+    bool m_schedulePending;
+};
+
+#endif
@@ -0,0 +1,278 @@
+/**
+ * Copyright 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "archiveextractjob.h"
+#include "directoryarchive.h"
+#include "share_debug.h"
+
+#include <QDataStream>
+#include <QDateTime>
+#include <QtEndian>
+
+#include <KLocalizedString>
+
+#include <core/payloadhasher.h>
+
+static const qint64 s_bufferSize = 64 * 1024;
+
+ArchiveExtractJob::ArchiveExtractJob(const NetworkPacket& np, const QString& destination)
+    : KJob()
+    , m_payload(np.payload())
+    , m_origin(np.payload())
+    , m_hasher(nullptr)
+    , m_hashAlgorithm(np.payloadTransferInfo().value(QStringLiteral("hash")).toString())
+    , m_destination(destination)
+    , m_from(QStringLiteral("KDE Connect"))
+    , m_size(np.payloadSize())
+    , m_received(0)
+    , m_fileRemaining(0)
+    , m_fileLastModified(0)
+    , m_files(0)
+    , m_finished(false)
+{
+    Q_ASSERT(m_payload);
+    if (!m_hashAlgorithm.isEmpty() && (m_size < 0 || !PayloadHasher::supportedAlgorithms().contains(m_hashAlgorithm))) {
+        qCWarning(KDECONNECT_PLUGIN_SHARE) << "Can't verify the archive with" << m_hashAlgorithm;
+        m_hashAlgorithm.clear();
+    }
+
+    setCapabilities(Killable);
+}
+
+void ArchiveExtractJob::start()
+{
+    QMetaObject::invokeMethod(this, "doStart", Qt::QueuedConnection);
+}
+
+void ArchiveExtractJob::doStart()
+{
+    if (m_destination.exists() || !m_destination.mkpath(QStringLiteral("."))) {
+        fail(2, i18n("Couldn't create the folder %1", m_destination.path()));
+        return;
+    }
+
+    Q_EMIT description(this, i18n("Receiving folder from %1", m_from), { i18n("Folder"), m_destination.path() });
+    if (m_size >= 0) {
+        setTotalAmount(Bytes, m_size);
+    }
+
+    //The loopback link hands us the archive itself
+    if (!m_payload->isOpen()) {
+        m_payload->open(QIODevice::ReadOnly);
+    }
+    if (!m_hashAlgorithm.isEmpty()) {
+        m_hasher = new PayloadHasher(m_payload, m_size, m_hashAlgorithm);
+        m_origin = QSharedPointer<QIODevice>(m_hasher);
+    }
+
+    connect(m_origin.data(), &QIODevice::readyRead, this, &ArchiveExtractJob::dataReceived);
+    connect(m_origin.data(), &QIODevice::readChannelFinished, this, [this]() {
+        dataReceived();
+        if (!m_finished && !error()) {
+            transferFinished();
+        }
+    });
+    dataReceived();
+}
+
+QByteArray ArchiveExtractJob::readPayload(qint64 maxSize)
+{
+    const QByteArray data = m_origin->read(maxSize);
+    m_received += data.size();
+    return data;
+}
+
+void ArchiveExtractJob::dataReceived()
+{
+    while (!m_finished && !error() && m_origin->bytesAvailable() > 0) {
+        const bool progressed = (m_fileRemaining > 0) ? writeEntryData() : readEntryHeader();
+        if (!progressed) {
+            break;
+        }
+    }
+
+    if (error()) {
+        return;
+    }
+    setProcessedAmount(Bytes, m_received);
+    //Everything the sender announced arrived, whether or not it was the whole archive
+    if (m_finished || (m_size >= 0 && m_received >= m_size)) {
+        transferFinished();
+    }
+}
+
+bool ArchiveExtractJob::readEntryHeader()
+{
+    //Its path, which comes first, tells how long the header is
+    if (m_header.size() < 2) {
+        m_header += readPayload(2 - m_header.size());
+        if (m_header.size() < 2) {
+            return false;
+        }
+    }
+    const quint16 pathLength = qFromBigEndian<quint16>(reinterpret_cast<const uchar*>(m_header.constData()));
+    if (pathLength == 0) {
+        m_finished = true;
+        return true;
+    }
+
+    const int headerSize = DirectoryArchive::s_headerSize + pathLength;
+    m_header += readPayload(headerSize - m_header.size());
+    if (m_header.size() < headerSize) {
+        return false;
+    }
+
+    QDataStream stream(m_header);
+    quint8 type;
+    quint32 permissions;
+    qint64 lastModified;
+    qint64 size;
+    stream.skipRawData(2);
+    QByteArray path(pathLength, Qt::Uninitialized);
+    stream.readRawData(path.data(), pathLength);
+    stream >> type >> permissions >> lastModified >> size;
+    m_header.clear();
+
+    return startEntry(QString::fromUtf8(path), type, permissions, lastModified, size);
+}
+
+bool ArchiveExtractJob::startEntry(const QString& path, quint8 type, quint32 permissions, qint64 lastModified, qint64 size)
+{
+    //Nothing may end up outside of the destination
+    const QString relativePath = QDir::cleanPath(path);
+    if (relativePath.isEmpty() || QDir::isAbsolutePath(relativePath) || relativePath == QLatin1String("..")
+        || relativePath.startsWith(QLatin1String("../")) || type > DirectoryArchive::Directory || size < 0) {
+        qCWarning(KDECONNECT_PLUGIN_SHARE) << "Invalid entry in the received archive" << path;
+        fail(3, i18n("Received invalid folder from: %1", m_from));
+        return false;
+    }
+
+    if (type == DirectoryArchive::Directory) {
+        if (!m_destination.mkpath(relativePath)) {
+            fail(4, i18n("Couldn't create the folder %1", m_destination.filePath(relativePath)));
+            return false;
+        }
+        return true;
+    }
+
+    m_file.setFileName(m_destination.filePath(relativePath));
+    if (!m_destination.mkpath(QFileInfo(relativePath).path()) || !m_file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        fail(4, i18n("Couldn't open %1: %2", m_file.fileName(), m_file.errorString()));
+        return false;
+    }
+
+    //We want to be able to do something with the file, whatever it was on the other side
+    m_filePermissions = QFileDevice::Permissions(permissions) | QFileDevice::ReadOwner | QFileDevice::WriteOwner;
+    m_fileLastModified = lastModified;
+    m_fileRemaining = size;
+    if (m_fileRemaining == 0) {
+        finishEntry();
+    }
+    return true;
+}
+
+bool ArchiveExtractJob::writeEntryData()
+{
+    const QByteArray data = readPayload(qMin(m_fileRemaining, s_bufferSize));
+    if (data.isEmpty()) {
+        return false;
+    }
+
+    if (m_file.write(data) != data.size()) {
+        fail(4, i18n("Couldn't write %1: %2", m_file.fileName(), m_file.errorString()));
+        return false;
+    }
+
+    m_fileRemaining -= data.size();
+    if (m_fileRemaining == 0) {
+        finishEntry();
+    }
+    return true;
+}
+
+void ArchiveExtractJob::finishEntry()
+{
+    m_file.setFileTime(QDateTime::fromMSecsSinceEpoch(m_fileLastModified), QFileDevice::FileModificationTime);
+    m_file.close();
+    m_file.setPermissions(m_filePermissions);
+
+    m_files++;
+    setProcessedAmount(Files, m_files);
+}
+
+void ArchiveExtractJob::transferFinished()
+{
+    if (!m_finished) {
+        //The files that arrived completely are kept
+        qCDebug(KDECONNECT_PLUGIN_SHARE) << "Received incomplete folder (" << m_received << "/" << m_size << "bytes )";
+        if (m_file.isOpen()) {
+            m_file.close();
+            m_file.remove();
+        }
+        fail(3, i18n("Received incomplete folder from: %1", m_from));
+        return;
+    }
+
+    if (m_hasher) {
+        if (!m_hasher->isHashReady()) {
+            //The hash follows the payload, it may not be here yet
+            connect(m_hasher, &PayloadHasher::hashReady, this, &ArchiveExtractJob::transferFinished, Qt::UniqueConnection);
+            return;
+        }
+        if (!m_hasher->verify()) {
+            qCDebug(KDECONNECT_PLUGIN_SHARE) << "Received corrupted folder" << m_destination.path() << ", deleting";
+            m_destination.removeRecursively();
+            fail(5, i18n("Received corrupted folder from: %1", m_from));
+            return;
+        }
+    }
+
+    disconnect(m_origin.data(), nullptr, this, nullptr);
+    if (m_hasher) {
+        disconnect(m_hasher, nullptr, this, nullptr);
+    }
+    qCDebug(KDECONNECT_PLUGIN_SHARE) << "Received folder" << m_destination.path() << "with" << m_files << "files";
+    emitResult();
+}
+
+void ArchiveExtractJob::fail(int error, const QString& errorText)
+{
+    disconnect(m_origin.data(), nullptr, this, nullptr);
+    if (m_hasher) {
+        disconnect(m_hasher, nullptr, this, nullptr);
+    }
+
+    setError(error);
+    setErrorText(errorText);
+    emitResult();
+}
+
+bool ArchiveExtractJob::doKill()
+{
+    disconnect(m_origin.data(), nullptr, this, nullptr);
+    m_payload->close();
+
+    if (m_file.isOpen()) {
+        m_file.close();
+        m_file.remove();
+    }
+    return true;
+}
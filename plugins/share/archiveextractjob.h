@@ -0,0 +1,82 @@
+/**
+ * Copyright 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef ARCHIVEEXTRACTJOB_H
+#define ARCHIVEEXTRACTJOB_H
+
+#include <KJob>
+
+#include <QDir>
+#include <QFile>
+#include <QSharedPointer>
+
+#include <core/networkpacket.h>
+
+class PayloadHasher;
+
+/*
+ * Unpacks a folder sent as a DirectoryArchive into @p destination as it arrives
+ */
+class ArchiveExtractJob
+    : public KJob
+{
+    Q_OBJECT
+
+public:
+    ArchiveExtractJob(const NetworkPacket& np, const QString& destination);
+    void start() override;
+    QString destination() const { return m_destination.path(); }
+    void setOriginName(const QString& from) { m_from = from; }
+
+protected:
+    bool doKill() override;
+
+private Q_SLOTS:
+    void doStart();
+
+private:
+    void dataReceived();
+    QByteArray readPayload(qint64 maxSize);
+    bool readEntryHeader();
+    bool startEntry(const QString& path, quint8 type, quint32 permissions, qint64 lastModified, qint64 size);
+    bool writeEntryData();
+    void finishEntry();
+    void transferFinished();
+    void fail(int error, const QString& errorText);
+
+    QSharedPointer<QIODevice> m_payload;
+    QSharedPointer<QIODevice> m_origin; //The payload or its PayloadHasher
+    PayloadHasher* m_hasher;
+    QString m_hashAlgorithm;
+    QDir m_destination;
+    QString m_from;
+    qint64 m_size;
+    qint64 m_received;
+    QByteArray m_header; //Of the next entry, until it is complete
+    QFile m_file;
+    qint64 m_fileRemaining;
+    qint64 m_fileLastModified;
+    QFileDevice::Permissions m_filePermissions;
+    int m_files;
+    bool m_finished; //The end of the archive was received
+};
+
+#endif
@@ -0,0 +1,234 @@
+/**
+ * Copyright 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "deltaapplyjob.h"
+#include "filedelta.h"
+#include "share_debug.h"
+
+#include <QDataStream>
+#include <QtEndian>
+
+#include <KLocalizedString>
+
+static const qint64 s_bufferSize = 1024 * 1024;
+
+DeltaApplyJob::DeltaApplyJob(const NetworkPacket& np, const QString& destination)
+    : KJob()
+    , m_payload(np.payload())
+    , m_base(destination)
+    , m_file(destination)
+    , m_hash(QCryptographicHash::Sha256)
+    , m_expectedHash(QByteArray::fromHex(np.get<QByteArray>(QStringLiteral("sha256"))))
+    , m_from(QStringLiteral("KDE Connect"))
+    , m_size(np.payloadSize())
+    , m_received(0)
+    , m_written(0)
+    , m_literalRemaining(0)
+{
+    Q_ASSERT(m_payload);
+    setTotalAmount(Bytes, np.get<qint64>(QStringLiteral("size")));
+    setCapabilities(Killable);
+}
+
+void DeltaApplyJob::start()
+{
+    QMetaObject::invokeMethod(this, "doStart", Qt::QueuedConnection);
+}
+
+void DeltaApplyJob::doStart()
+{
+    Q_EMIT description(this, i18n("Receiving changes from %1", m_from), { i18n("File"), m_file.fileName() });
+
+    //Without a copy of our own every operation has to be a literal
+    if (m_base.exists() && !m_base.open(QIODevice::ReadOnly)) {
+        fail(4, i18n("Couldn't read %1: %2", m_base.fileName(), m_base.errorString()));
+        return;
+    }
+    if (!m_file.open(QIODevice::WriteOnly)) {
+        fail(4, i18n("Couldn't open %1: %2", m_file.fileName(), m_file.errorString()));
+        return;
+    }
+
+    //The loopback link hands us the stream itself
+    if (!m_payload->isOpen()) {
+        m_payload->open(QIODevice::ReadOnly);
+    }
+
+    connect(m_payload.data(), &QIODevice::readyRead, this, &DeltaApplyJob::dataReceived);
+    connect(m_payload.data(), &QIODevice::readChannelFinished, this, [this]() {
+        dataReceived();
+        if (m_received < m_size && !error()) {
+            transferFinished();
+        }
+    });
+    dataReceived();
+}
+
+QByteArray DeltaApplyJob::readPayload(qint64 maxSize)
+{
+    //A hash of the transfer may follow, the hash of the whole file is what we check
+    const QByteArray data = m_payload->read(qMin(maxSize, m_size - m_received));
+    m_received += data.size();
+    return data;
+}
+
+void DeltaApplyJob::dataReceived()
+{
+    while (!error() && m_received < m_size && m_payload->bytesAvailable() > 0) {
+        const bool progressed = (m_literalRemaining > 0) ? writeLiteral() : readOperation();
+        if (!progressed) {
+            break;
+        }
+    }
+
+    if (error()) {
+        return;
+    }
+    setProcessedAmount(Bytes, m_written);
+    if (m_received >= m_size) {
+        transferFinished();
+    }
+}
+
+bool DeltaApplyJob::readOperation()
+{
+    if (m_header.isEmpty()) {
+        m_header = readPayload(1);
+        if (m_header.isEmpty()) {
+            return false;
+        }
+    }
+
+    const quint8 type = static_cast<quint8>(m_header.at(0));
+    const int headerSize = FileDelta::s_operationHeaderSize + (type == FileDelta::Copy ? 8 : 0);
+    m_header += readPayload(headerSize - m_header.size());
+    if (m_header.size() < headerSize) {
+        return false;
+    }
+
+    QDataStream stream(m_header);
+    stream.skipRawData(1);
+    qint64 offset = 0;
+    qint64 length;
+    if (type == FileDelta::Copy) {
+        stream >> offset;
+    }
+    stream >> length;
+    m_header.clear();
+
+    if (type > FileDelta::Literal || offset < 0 || length < 0) {
+        fail(3, i18n("Received invalid changes from: %1", m_from));
+        return false;
+    }
+
+    if (type == FileDelta::Copy) {
+        return copyFromBase(offset, length);
+    }
+    m_literalRemaining = length;
+    return true;
+}
+
+bool DeltaApplyJob::copyFromBase(qint64 offset, qint64 length)
+{
+    if (!m_base.isOpen() || offset + length > m_base.size() || !m_base.seek(offset)) {
+        qCWarning(KDECONNECT_PLUGIN_SHARE) << "Can't copy" << length << "bytes at" << offset << "from" << m_base.fileName();
+        fail(3, i18n("Received invalid changes from: %1", m_from));
+        return false;
+    }
+
+    while (length > 0) {
+        const QByteArray data = m_base.read(qMin(length, s_bufferSize));
+        if (data.isEmpty()) {
+            fail(4, i18n("Couldn't read %1: %2", m_base.fileName(), m_base.errorString()));
+            return false;
+        }
+        if (!write(data)) {
+            return false;
+        }
+        length -= data.size();
+    }
+    return true;
+}
+
+bool DeltaApplyJob::writeLiteral()
+{
+    const QByteArray data = readPayload(qMin(m_literalRemaining, s_bufferSize));
+    if (data.isEmpty()) {
+        return false;
+    }
+    m_literalRemaining -= data.size();
+    return write(data);
+}
+
+bool DeltaApplyJob::write(const QByteArray& data)
+{
+    if (m_file.write(data) != data.size()) {
+        fail(4, i18n("Couldn't write %1: %2", m_file.fileName(), m_file.errorString()));
+        return false;
+    }
+    m_hash.addData(data);
+    m_written += data.size();
+    return true;
+}
+
+void DeltaApplyJob::transferFinished()
+{
+    if (m_received < m_size || m_literalRemaining > 0 || !m_header.isEmpty()) {
+        qCDebug(KDECONNECT_PLUGIN_SHARE) << "Received incomplete changes (" << m_received << "/" << m_size << "bytes )";
+        fail(3, i18n("Received incomplete file from: %1", m_from));
+        return;
+    }
+
+    if (m_hash.result() != m_expectedHash) {
+        qCDebug(KDECONNECT_PLUGIN_SHARE) << "Rebuilt" << m_file.fileName() << "doesn't match the sender's copy, keeping ours";
+        fail(5, i18n("Received corrupted file from: %1", m_from));
+        return;
+    }
+
+    disconnect(m_payload.data(), nullptr, this, nullptr);
+    m_base.close();
+    if (!m_file.commit()) {
+        setError(4);
+        setErrorText(i18n("Couldn't write %1: %2", m_file.fileName(), m_file.errorString()));
+    }
+    emitResult();
+}
+
+void DeltaApplyJob::fail(int error, const QString& errorText)
+{
+    disconnect(m_payload.data(), nullptr, this, nullptr);
+    m_file.cancelWriting(); //Our copy stays as it was
+    m_base.close();
+
+    setError(error);
+    setErrorText(errorText);
+    emitResult();
+}
+
+bool DeltaApplyJob::doKill()
+{
+    disconnect(m_payload.data(), nullptr, this, nullptr);
+    m_payload->close();
+
+    m_file.cancelWriting();
+    m_base.close();
+    return true;
+}
@@ -0,0 +1,78 @@
+/**
+ * Copyright 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef DELTAAPPLYJOB_H
+#define DELTAAPPLYJOB_H
+
+#include <KJob>
+
+#include <QCryptographicHash>
+#include <QFile>
+#include <QSaveFile>
+#include <QSharedPointer>
+
+#include <core/networkpacket.h>
+
+/*
+ * Rebuilds a file from the DeltaStream in the payload and the copy we already have
+ * at @p destination, which is only replaced once the result matches the sender's hash
+ */
+class DeltaApplyJob
+    : public KJob
+{
+    Q_OBJECT
+
+public:
+    DeltaApplyJob(const NetworkPacket& np, const QString& destination);
+    void start() override;
+    QString destination() const { return m_file.fileName(); }
+    void setOriginName(const QString& from) { m_from = from; }
+
+protected:
+    bool doKill() override;
+
+private Q_SLOTS:
+    void doStart();
+
+private:
+    void dataReceived();
+    QByteArray readPayload(qint64 maxSize);
+    bool readOperation();
+    bool copyFromBase(qint64 offset, qint64 length);
+    bool writeLiteral();
+    bool write(const QByteArray& data);
+    void transferFinished();
+    void fail(int error, const QString& errorText);
+
+    QSharedPointer<QIODevice> m_payload;
+    QFile m_base;
+    QSaveFile m_file;
+    QCryptographicHash m_hash;
+    QByteArray m_expectedHash;
+    QString m_from;
+    qint64 m_size;
+    qint64 m_received;
+    qint64 m_written;
+    QByteArray m_header; //Of the next operation, until it is complete
+    qint64 m_literalRemaining;
+};
+
+#endif
@@ -0,0 +1,148 @@
+/**
+ * Copyright 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "directoryarchive.h"
+#include "share_debug.h"
+
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QDirIterator>
+
+#include <KLocalizedString>
+
+DirectoryArchive::DirectoryArchive(const QString& path, QObject* parent)
+    : QIODevice(parent)
+    , m_nextEntry(0)
+    , m_fileRemaining(0)
+    , m_size(0)
+    , m_remaining(0)
+    , m_fileCount(0)
+{
+    //Symlinks are left out, they could point anywhere on our side
+    const QDir root(path);
+    QDirIterator it(path, QDir::Dirs | QDir::Files | QDir::Hidden | QDir::NoDotAndDotDot | QDir::NoSymLinks, QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        it.next();
+        const QFileInfo info = it.fileInfo();
+        const QByteArray relativePath = root.relativeFilePath(info.absoluteFilePath()).toUtf8();
+        if (relativePath.size() > 0xFFFF) {
+            qCWarning(KDECONNECT_PLUGIN_SHARE) << "Path too long to be shared, skipping" << info.absoluteFilePath();
+            continue;
+        }
+
+        const bool isDir = info.isDir();
+        m_entries.append({info.absoluteFilePath(), relativePath, isDir ? Directory : File, static_cast<quint32>(info.permissions()),
+                          info.lastModified().toMSecsSinceEpoch(), isDir ? 0 : info.size()});
+        m_size += s_headerSize + relativePath.size() + m_entries.constLast().size;
+        if (!isDir) {
+            m_fileCount++;
+        }
+    }
+
+    m_size += 2; //The empty path at the end
+    m_remaining = m_size;
+}
+
+qint64 DirectoryArchive::bytesAvailable() const
+{
+    //Everything is there to be read
+    return m_remaining + QIODevice::bytesAvailable();
+}
+
+void DirectoryArchive::nextEntry()
+{
+    m_file.close();
+    m_header.clear();
+    QDataStream stream(&m_header, QIODevice::WriteOnly);
+
+    if (m_nextEntry == m_entries.size()) {
+        stream << quint16(0);
+        return;
+    }
+
+    const Entry& entry = m_entries.at(m_nextEntry++);
+    stream << quint16(entry.path.size());
+    stream.writeRawData(entry.path.constData(), entry.path.size());
+    stream << quint8(entry.type) << entry.permissions << entry.lastModified << entry.size;
+
+    if (entry.type == File) {
+        m_file.setFileName(entry.absolutePath);
+        m_fileRemaining = entry.size;
+        if (!m_file.open(QIODevice::ReadOnly)) {
+            fail(entry.absolutePath, m_file.errorString());
+        }
+    }
+}
+
+void DirectoryArchive::fail(const QString& path, const QString& reason)
+{
+    qCWarning(KDECONNECT_PLUGIN_SHARE) << "Couldn't read" << path << reason;
+    m_failedPath = path;
+    setErrorString(i18n("Couldn't read %1: %2", path, reason));
+    m_file.close();
+    m_header.clear();
+    m_remaining = 0;
+}
+
+qint64 DirectoryArchive::readData(char* data, qint64 maxSize)
+{
+    qint64 read = 0;
+    while (read < maxSize && m_remaining > 0) {
+        if (m_header.isEmpty() && m_fileRemaining == 0) {
+            nextEntry();
+            if (!m_failedPath.isEmpty()) {
+                break;
+            }
+        }
+
+        qint64 chunk;
+        if (!m_header.isEmpty()) {
+            chunk = qMin<qint64>(maxSize - read, m_header.size());
+            memcpy(data + read, m_header.constData(), chunk);
+            m_header.remove(0, static_cast<int>(chunk));
+        } else {
+            chunk = m_file.read(data + read, qMin(maxSize - read, m_fileRemaining));
+            if (chunk <= 0) {
+                //Its size was already announced, the other side would get something else
+                fail(m_file.fileName(), (chunk < 0) ? m_file.errorString() : i18n("The file got smaller while it was being sent"));
+                break;
+            }
+            m_fileRemaining -= chunk;
+        }
+
+        read += chunk;
+        m_remaining -= chunk;
+    }
+
+    if (m_remaining == 0) {
+        m_file.close();
+    }
+    //What was read before failing is still handed out, the error comes with the next read
+    return (read == 0 && !m_failedPath.isEmpty()) ? -1 : read;
+}
+
+qint64 DirectoryArchive::writeData(const char* data, qint64 maxSize)
+{
+    Q_UNUSED(data);
+    Q_UNUSED(maxSize);
+    return -1;
+}
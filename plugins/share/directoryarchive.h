@@ -0,0 +1,92 @@
+/**
+ * Copyright 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef DIRECTORYARCHIVE_H
+#define DIRECTORYARCHIVE_H
+
+#include <QFile>
+#include <QIODevice>
+#include <QVector>
+
+/*
+ * Streams a directory tree as a single payload, see PACKET_TYPE_SHARE_ARCHIVE.
+ * Every entry is a header followed by the contents of the file, if it is one:
+ *
+ *   quint16  length of the path
+ *   char[]   path relative to the shared directory, UTF-8 with '/' separators
+ *   quint8   EntryType
+ *   quint32  QFileDevice::Permissions
+ *   qint64   last modification, in ms since the epoch
+ *   qint64   size of the contents, 0 for directories
+ *
+ * All in big endian. An empty path ends the archive. The size of the whole
+ * archive is known up front; files that grow while being sent are cut to the
+ * size they had when the tree was read. If a file can't be read or shrank, the
+ * archive can't be completed, so reading it fails from there on.
+ */
+class DirectoryArchive
+    : public QIODevice
+{
+    Q_OBJECT
+
+public:
+    enum EntryType : quint8 { File = 0, Directory = 1 };
+    static const int s_headerSize = 2 + 1 + 4 + 8 + 8; //Without the path
+
+    explicit DirectoryArchive(const QString& path, QObject* parent = nullptr);
+
+    bool isSequential() const override { return true; }
+    qint64 size() const override { return m_size; }
+    qint64 bytesAvailable() const override;
+    bool atEnd() const override { return m_remaining == 0 && QIODevice::bytesAvailable() == 0; }
+    int fileCount() const { return m_fileCount; }
+    //The file that made reading fail, see errorString() for why
+    QString failedPath() const { return m_failedPath; }
+
+protected:
+    qint64 readData(char* data, qint64 maxSize) override;
+    qint64 writeData(const char* data, qint64 maxSize) override;
+
+private:
+    struct Entry {
+        QString absolutePath;
+        QByteArray path;
+        EntryType type;
+        quint32 permissions;
+        qint64 lastModified;
+        qint64 size;
+    };
+
+    void nextEntry();
+    void fail(const QString& path, const QString& reason);
+
+    QVector<Entry> m_entries;
+    int m_nextEntry;
+    QByteArray m_header; //Not read yet
+    QFile m_file;
+    qint64 m_fileRemaining;
+    qint64 m_size;
+    qint64 m_remaining;
+    int m_fileCount;
+    QString m_failedPath;
+};
+
+#endif
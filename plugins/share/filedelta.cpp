@@ -0,0 +1,348 @@
+/**
+ * Copyright 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "filedelta.h"
+#include "share_debug.h"
+
+#include <QDataStream>
+#include <QtEndian>
+
+#include <KLocalizedString>
+
+#include <cmath>
+
+static const int s_minBlockSize = 2048;
+static const int s_maxBlockSize = 128 * 1024;
+static const qint64 s_sliceSize = 4 * 1024 * 1024; //Processed at once, before going back to the event loop
+static const qint64 s_maxCopyLength = 64 * 1024 * 1024; //So the receiver doesn't block on a single copy
+
+int FileDelta::blockSize(qint64 size)
+{
+    //Like rsync: bigger files get bigger blocks, so their signature stays small
+    const qint64 blockSize = static_cast<qint64>(std::sqrt(static_cast<double>(size))) & ~qint64(1023);
+    return static_cast<int>(qBound<qint64>(s_minBlockSize, blockSize, s_maxBlockSize));
+}
+
+static void checksumHalves(const uchar* data, int size, quint32& a, quint32& b)
+{
+    a = 0;
+    b = 0;
+    for (int i = 0; i < size; i++) {
+        a += data[i];
+        b += static_cast<quint32>(size - i) * data[i];
+    }
+}
+
+static quint32 combineHalves(quint32 a, quint32 b)
+{
+    return (a & 0xFFFF) | (b << 16);
+}
+
+quint32 FileDelta::weakChecksum(const char* data, int size)
+{
+    quint32 a, b;
+    checksumHalves(reinterpret_cast<const uchar*>(data), size, a, b);
+    return combineHalves(a, b);
+}
+
+FileSignatureJob::FileSignatureJob(const QString& path, int blockSize)
+    : KJob()
+    , m_file(path)
+    , m_blockSize(blockSize)
+    , m_hash(QCryptographicHash::Sha256)
+{
+}
+
+void FileSignatureJob::start()
+{
+    QMetaObject::invokeMethod(this, "signNextSlice", Qt::QueuedConnection);
+}
+
+void FileSignatureJob::signNextSlice()
+{
+    if (!m_file.isOpen()) {
+        if (!m_file.open(QIODevice::ReadOnly)) {
+            setError(UserDefinedError);
+            setErrorText(i18n("Couldn't read %1: %2", m_file.fileName(), m_file.errorString()));
+            emitResult();
+            return;
+        }
+        m_signature.reserve(static_cast<int>((m_file.size() / m_blockSize + 1) * FileDelta::s_signatureEntrySize));
+    }
+
+    for (qint64 signedSize = 0; signedSize < s_sliceSize; signedSize += m_blockSize) {
+        const QByteArray block = m_file.read(m_blockSize);
+        if (block.isEmpty()) {
+            if (m_file.error() != QFileDevice::NoError) {
+                setError(UserDefinedError);
+                setErrorText(i18n("Couldn't read %1: %2", m_file.fileName(), m_file.errorString()));
+            }
+            m_file.close();
+            emitResult();
+            return;
+        }
+
+        m_hash.addData(block);
+        uchar weak[4];
+        qToBigEndian(FileDelta::weakChecksum(block.constData(), block.size()), weak);
+        m_signature.append(reinterpret_cast<const char*>(weak), sizeof(weak));
+        m_signature += QCryptographicHash::hash(block, QCryptographicHash::Md5);
+    }
+
+    QMetaObject::invokeMethod(this, "signNextSlice", Qt::QueuedConnection);
+}
+
+FileDeltaJob::FileDeltaJob(const QString& path, const QByteArray& signature, int blockSize, const QByteArray& hash)
+    : KJob()
+    , m_file(path)
+    , m_size(0)
+    , m_signature(signature)
+    , m_blockSize(blockSize)
+    , m_receiverHash(hash)
+    , m_hash(QCryptographicHash::Sha256)
+    , m_hashed(0)
+    , m_pos(0)
+    , m_literalStart(0)
+    , m_a(0)
+    , m_b(0)
+    , m_windowValid(false)
+    , m_copiedSize(0)
+    , m_unchanged(false)
+{
+    if (m_blockSize > 0) {
+        const int blocks = m_signature.size() / FileDelta::s_signatureEntrySize;
+        m_blocks.reserve(blocks);
+        for (int i = 0; i < blocks; i++) {
+            const uchar* entry = reinterpret_cast<const uchar*>(m_signature.constData()) + i * FileDelta::s_signatureEntrySize;
+            m_blocks.insert(qFromBigEndian<quint32>(entry), i);
+        }
+    }
+}
+
+void FileDeltaJob::start()
+{
+    QMetaObject::invokeMethod(this, "matchNextSlice", Qt::QueuedConnection);
+}
+
+void FileDeltaJob::matchNextSlice()
+{
+    if (!m_file.isOpen()) {
+        if (!m_file.open(QIODevice::ReadOnly)) {
+            setError(UserDefinedError);
+            setErrorText(i18n("Couldn't read %1: %2", m_file.fileName(), m_file.errorString()));
+            emitResult();
+            return;
+        }
+        m_size = m_file.size();
+    }
+
+    //The slice and the block that can start at its end. The file isn't mapped: reading a mapping
+    //raises SIGBUS if the file shrinks meanwhile or lives on a network filesystem that goes away.
+    const qint64 sliceEnd = qMin(m_size, m_pos + s_sliceSize);
+    const qint64 bufferSize = qMin(m_size, sliceEnd + m_blockSize) - m_pos;
+    m_buffer.resize(static_cast<int>(bufferSize));
+    if (!m_file.seek(m_pos) || m_file.read(m_buffer.data(), bufferSize) != bufferSize) {
+        setError(UserDefinedError);
+        setErrorText(i18n("Couldn't read %1: %2", m_file.fileName(), m_file.errorString()));
+        m_file.close();
+        emitResult();
+        return;
+    }
+    const uchar* buffer = reinterpret_cast<const uchar*>(m_buffer.constData());
+    const qint64 bufferStart = m_pos;
+
+    while (m_pos < sliceEnd && m_pos + m_blockSize <= m_size && !m_blocks.isEmpty()) {
+        const uchar* window = buffer + (m_pos - bufferStart);
+        if (!m_windowValid) {
+            checksumHalves(window, m_blockSize, m_a, m_b);
+            m_windowValid = true;
+        }
+
+        const int block = findBlock(window, combineHalves(m_a, m_b));
+        if (block >= 0) {
+            addOperation(FileDelta::Literal, m_literalStart, m_pos - m_literalStart);
+            addOperation(FileDelta::Copy, static_cast<qint64>(block) * m_blockSize, m_blockSize);
+            m_pos += m_blockSize;
+            m_literalStart = m_pos;
+            m_windowValid = false;
+            continue;
+        }
+
+        //Slide the window by one byte
+        if (m_pos + m_blockSize < m_size) {
+            const uchar out = window[0];
+            const uchar in = window[m_blockSize];
+            m_a = m_a - out + in;
+            m_b = m_b - static_cast<quint32>(m_blockSize) * out + m_a;
+        }
+        m_pos++;
+    }
+    if (m_pos + m_blockSize > m_size || m_blocks.isEmpty()) {
+        //No whole block left to find, the rest is sent as it is
+        m_pos = qMax(m_pos, sliceEnd);
+    }
+
+    m_hash.addData(m_buffer.constData() + (m_hashed - bufferStart), static_cast<int>(m_pos - m_hashed));
+    m_hashed = m_pos;
+
+    if (m_pos >= m_size) {
+        finish();
+    } else {
+        QMetaObject::invokeMethod(this, "matchNextSlice", Qt::QueuedConnection);
+    }
+}
+
+int FileDeltaJob::findBlock(const uchar* data, quint32 weak) const
+{
+    auto it = m_blocks.constFind(weak);
+    if (it == m_blocks.constEnd()) {
+        return -1;
+    }
+
+    //Only worth it for the few windows whose rolling checksum matches
+    const QByteArray strong = QCryptographicHash::hash(QByteArray::fromRawData(reinterpret_cast<const char*>(data), m_blockSize), QCryptographicHash::Md5);
+    for (; it != m_blocks.constEnd() && it.key() == weak; ++it) {
+        const char* entry = m_signature.constData() + it.value() * FileDelta::s_signatureEntrySize;
+        if (memcmp(entry + 4, strong.constData(), 16) == 0) {
+            return it.value();
+        }
+    }
+    return -1;
+}
+
+void FileDeltaJob::addOperation(FileDelta::OperationType type, qint64 offset, qint64 length)
+{
+    if (length == 0) {
+        return;
+    }
+
+    if (type == FileDelta::Copy) {
+        m_copiedSize += length;
+    }
+
+    //Consecutive blocks of the receiver's copy are copied at once
+    if (!m_operations.isEmpty()) {
+        Operation& last = m_operations.last();
+        if (last.type == type && last.offset + last.length == offset && (type == FileDelta::Literal || last.length + length <= s_maxCopyLength)) {
+            last.length += length;
+            return;
+        }
+    }
+    m_operations.append({type, offset, length});
+}
+
+void FileDeltaJob::finish()
+{
+    addOperation(FileDelta::Literal, m_literalStart, m_size - m_literalStart);
+    m_unchanged = (m_hash.result() == m_receiverHash);
+
+    m_buffer.clear();
+    m_file.close();
+
+    qCDebug(KDECONNECT_PLUGIN_SHARE) << "Delta of" << m_file.fileName() << ":" << m_copiedSize << "of" << m_size << "bytes found in the receiver's copy";
+    emitResult();
+}
+
+DeltaStream::DeltaStream(const QString& path, const QVector<FileDeltaJob::Operation>& operations, QObject* parent)
+    : QIODevice(parent)
+    , m_file(path)
+    , m_operations(operations)
+    , m_nextOperation(0)
+    , m_literalRemaining(0)
+    , m_size(0)
+    , m_remaining(0)
+{
+    for (const FileDeltaJob::Operation& operation : operations) {
+        if (operation.type == FileDelta::Copy) {
+            m_size += FileDelta::s_operationHeaderSize + 8;
+        } else {
+            m_size += FileDelta::s_operationHeaderSize + operation.length;
+        }
+    }
+    m_remaining = m_size;
+}
+
+bool DeltaStream::open(OpenMode mode)
+{
+    if (!m_file.open(QIODevice::ReadOnly)) {
+        qCWarning(KDECONNECT_PLUGIN_SHARE) << "Couldn't read" << m_file.fileName() << m_file.errorString();
+        return false;
+    }
+    return QIODevice::open(mode);
+}
+
+void DeltaStream::nextOperation()
+{
+    m_header.clear();
+    QDataStream stream(&m_header, QIODevice::WriteOnly);
+
+    const FileDeltaJob::Operation& operation = m_operations.at(m_nextOperation++);
+    stream << quint8(operation.type);
+    if (operation.type == FileDelta::Copy) {
+        stream << operation.offset << operation.length;
+    } else {
+        stream << operation.length;
+        m_file.seek(operation.offset);
+        m_literalRemaining = operation.length;
+    }
+}
+
+qint64 DeltaStream::readData(char* data, qint64 maxSize)
+{
+    qint64 read = 0;
+    while (read < maxSize && m_remaining > 0) {
+        if (m_header.isEmpty() && m_literalRemaining == 0) {
+            nextOperation();
+        }
+
+        qint64 chunk;
+        if (!m_header.isEmpty()) {
+            chunk = qMin<qint64>(maxSize - read, m_header.size());
+            memcpy(data + read, m_header.constData(), chunk);
+            m_header.remove(0, static_cast<int>(chunk));
+        } else {
+            chunk = qMin(maxSize - read, m_literalRemaining);
+            const qint64 fromFile = m_file.read(data + read, chunk);
+            if (fromFile > 0) {
+                chunk = fromFile;
+            } else {
+                //The file changed since it was matched, the receiver will see it doesn't verify
+                memset(data + read, 0, chunk);
+            }
+            m_literalRemaining -= chunk;
+        }
+
+        read += chunk;
+        m_remaining -= chunk;
+    }
+
+    if (m_remaining == 0) {
+        m_file.close();
+    }
+    return read;
+}
+
+qint64 DeltaStream::writeData(const char* data, qint64 maxSize)
+{
+    Q_UNUSED(data);
+    Q_UNUSED(maxSize);
+    return -1;
+}
@@ -0,0 +1,176 @@
+/**
+ * Copyright 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef FILEDELTA_H
+#define FILEDELTA_H
+
+#include <KJob>
+
+#include <QCryptographicHash>
+#include <QFile>
+#include <QIODevice>
+#include <QMultiHash>
+#include <QVector>
+
+/*
+ * Rsync-like synchronization of a file the other device already has a copy of,
+ * see PACKET_TYPE_SHARE_SYNC.
+ *
+ * The receiver splits its copy in blocks and sends the signature of each one,
+ * with FileSignatureJob:
+ *
+ *   quint32  rolling checksum of the block
+ *   char[16] MD5 of the block
+ *
+ * The sender finds those blocks in its file with FileDeltaJob, at any offset,
+ * and sends a DeltaStream of operations to rebuild it:
+ *
+ *   quint8   Copy, qint64 offset in the receiver's copy, qint64 length
+ *   quint8   Literal, qint64 length, followed by that many bytes
+ *
+ * All in big endian. The SHA-256 of both files tells whether anything has to
+ * be sent at all, and verifies the rebuilt file.
+ */
+namespace FileDelta {
+    enum OperationType : quint8 { Copy = 0, Literal = 1 };
+
+    static const int s_signatureEntrySize = 4 + 16;
+    static const int s_operationHeaderSize = 1 + 8; //Copies have the length too
+
+    //Of the blocks to sign, for a file that will be about @p size bytes long
+    int blockSize(qint64 size);
+    quint32 weakChecksum(const char* data, int size);
+}
+
+/*
+ * Signs a local file in slices, so big files don't block the event loop
+ */
+class FileSignatureJob
+    : public KJob
+{
+    Q_OBJECT
+
+public:
+    FileSignatureJob(const QString& path, int blockSize);
+    void start() override;
+
+    int blockSize() const { return m_blockSize; }
+    QByteArray signature() const { return m_signature; }
+    QByteArray hash() const { return m_hash.result(); } //SHA-256 of the whole file
+
+private Q_SLOTS:
+    void signNextSlice();
+
+private:
+    QFile m_file;
+    int m_blockSize;
+    QByteArray m_signature;
+    QCryptographicHash m_hash;
+};
+
+/*
+ * Finds the blocks of a signature in a local file, in slices as well
+ */
+class FileDeltaJob
+    : public KJob
+{
+    Q_OBJECT
+
+public:
+    struct Operation {
+        FileDelta::OperationType type;
+        qint64 offset; //In the receiver's copy for Copy, in our file for Literal
+        qint64 length;
+    };
+
+    //@p hash of the receiver's copy, empty if it has none
+    FileDeltaJob(const QString& path, const QByteArray& signature, int blockSize, const QByteArray& hash);
+    void start() override;
+
+    QString path() const { return m_file.fileName(); }
+    QVector<Operation> operations() const { return m_operations; }
+    QByteArray hash() const { return m_hash.result(); } //SHA-256 of our file
+    //The receiver's copy is the same as our file, nothing has to be sent
+    bool unchanged() const { return m_unchanged; }
+    //What was found in the receiver's copy
+    qint64 copiedSize() const { return m_copiedSize; }
+
+private Q_SLOTS:
+    void matchNextSlice();
+
+private:
+    int findBlock(const uchar* data, quint32 weak) const;
+    void addOperation(FileDelta::OperationType type, qint64 offset, qint64 length);
+    void finish();
+
+    QFile m_file;
+    QByteArray m_buffer; //The slice being matched
+    qint64 m_size;
+    QByteArray m_signature;
+    QMultiHash<quint32, int> m_blocks; //By their rolling checksum
+    int m_blockSize;
+    QByteArray m_receiverHash;
+    QCryptographicHash m_hash;
+    qint64 m_hashed;
+    qint64 m_pos; //Start of the window
+    qint64 m_literalStart;
+    quint32 m_a; //The two halves of the rolling checksum of the window
+    quint32 m_b;
+    bool m_windowValid;
+    QVector<Operation> m_operations;
+    qint64 m_copiedSize;
+    bool m_unchanged;
+};
+
+/*
+ * Serializes the operations of a FileDeltaJob, reading the literal data from its file
+ */
+class DeltaStream
+    : public QIODevice
+{
+    Q_OBJECT
+
+public:
+    DeltaStream(const QString& path, const QVector<FileDeltaJob::Operation>& operations, QObject* parent = nullptr);
+
+    bool open(OpenMode mode) override;
+    bool isSequential() const override { return true; }
+    qint64 size() const override { return m_size; }
+    qint64 bytesAvailable() const override { return m_remaining + QIODevice::bytesAvailable(); }
+    bool atEnd() const override { return m_remaining == 0 && QIODevice::bytesAvailable() == 0; }
+
+protected:
+    qint64 readData(char* data, qint64 maxSize) override;
+    qint64 writeData(const char* data, qint64 maxSize) override;
+
+private:
+    void nextOperation();
+
+    QFile m_file;
+    QVector<FileDeltaJob::Operation> m_operations;
+    int m_nextOperation;
+    QByteArray m_header; //Not read yet
+    qint64 m_literalRemaining;
+    qint64 m_size;
+    qint64 m_remaining;
+};
+
+#endif
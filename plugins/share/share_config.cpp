@@ -38,6 +38,7 @@ ShareConfig::ShareConfig(QWidget* parent, const QVariantList& args)
     m_ui->commentLabel->setText(i18n("&percnt;1 in the path will be replaced with the specific device name."));
 
     connect(m_ui->kurlrequester, SIGNAL(textChanged(QString)), this, SLOT(changed()));
+    connect(m_ui->rateLimitSpinBox, SIGNAL(valueChanged(int)), this, SLOT(changed()));
 }
 
 ShareConfig::~ShareConfig()
@@ -50,6 +51,7 @@ void ShareConfig::defaults()
     KCModule::defaults();
 
     m_ui->kurlrequester->setText(QStandardPaths::writableLocation(QStandardPaths::DownloadLocation));
+    m_ui->rateLimitSpinBox->setValue(0);
 
     Q_EMIT changed(true);
 }
@@ -60,6 +62,7 @@ void ShareConfig::load()
 
     const auto standardPath = QStandardPaths::writableLocation(QStandardPaths::DownloadLocation);
     m_ui->kurlrequester->setText(config()->get<QString>(QStringLiteral("incoming_path"), standardPath));
+    m_ui->rateLimitSpinBox->setValue(config()->get<int>(QStringLiteral("upload_rate_limit"), 0));
 
     Q_EMIT changed(false);
 }
@@ -67,6 +70,7 @@ void ShareConfig::load()
 void ShareConfig::save()
 {
     config()->set(QStringLiteral("incoming_path"), m_ui->kurlrequester->text());
+    config()->set(QStringLiteral("upload_rate_limit"), m_ui->rateLimitSpinBox->value());
 
     KCModule::save();
 
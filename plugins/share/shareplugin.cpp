@@ -20,6 +20,10 @@
 
 #include "shareplugin.h"
 #include "share_debug.h"
+#include "archiveextractjob.h"
+#include "deltaapplyjob.h"
+#include "directoryarchive.h"
+#include "filedelta.h"
 
 #include <QStandardPaths>
 #include <QProcess>
@@ -28,6 +32,12 @@
 #include <QDBusConnection>
 #include <QTemporaryFile>
 #include <QDateTime>
+#include <QDirIterator>
+#include <QBuffer>
+#include <QCryptographicHash>
+#include <QUuid>
+
+#include <algorithm>
 
 #include <KLocalizedString>
 #include <KJobTrackerInterface>
@@ -36,6 +46,7 @@
 #include <KMimeTypeTrader>
 
 #include "core/filetransferjob.h"
+#include "core/kdeconnectconfig.h"
 
 K_PLUGIN_FACTORY_WITH_JSON( KdeConnectPluginFactory, "kdeconnect_share.json", registerPlugin< SharePlugin >(); )
 
@@ -44,7 +55,25 @@ Q_LOGGING_CATEGORY(KDECONNECT_PLUGIN_SHARE, "kdeconnect.plugin.share")
 SharePlugin::SharePlugin(QObject* parent, const QVariantList& args)
     : KdeConnectPlugin(parent, args)
     , m_compositeJob()
+    , m_bandwidthLimiter(device()->bandwidthLimiter())
+{
+    connect(config(), &KdeConnectPluginConfig::configChanged, this, &SharePlugin::configChanged);
+    configChanged();
+}
+
+SharePlugin::~SharePlugin()
+{
+    //Nobody can change it anymore
+    if (m_bandwidthLimiter) {
+        m_bandwidthLimiter->setRateLimit(0);
+    }
+}
+
+void SharePlugin::configChanged()
 {
+    if (m_bandwidthLimiter) {
+        m_bandwidthLimiter->setRateLimit(config()->get<qint64>(QStringLiteral("upload_rate_limit"), 0) * 1024);
+    }
 }
 
 QUrl SharePlugin::destinationDir() const
@@ -114,6 +143,20 @@ bool SharePlugin::receivePacket(const NetworkPacket& np)
 
     qCDebug(KDECONNECT_PLUGIN_SHARE) << "File transfer";
 
+    if (np.type() == PACKET_TYPE_SHARE_ARCHIVE) {
+        receiveArchive(np);
+        return true;
+    } else if (np.type() == PACKET_TYPE_SHARE_SYNC) {
+        receiveSyncRequest(np);
+        return true;
+    } else if (np.type() == PACKET_TYPE_SHARE_SYNC_SIGNATURE) {
+        receiveSignature(np);
+        return true;
+    } else if (np.type() == PACKET_TYPE_SHARE_SYNC_DELTA) {
+        receiveDelta(np);
+        return true;
+    }
+
     if (np.hasPayload() || np.has(QStringLiteral("filename"))) {
 //         qCDebug(KDECONNECT_PLUGIN_SHARE) << "receiving file" << filename << "in" << dir << "into" << destination;
         const QString filename = cleanFilename(np.get<QString>(QStringLiteral("filename"), QString::number(QDateTime::currentMSecsSinceEpoch())));
@@ -124,6 +167,8 @@ bool SharePlugin::receivePacket(const NetworkPacket& np)
 
             if (!m_compositeJob) {
                 m_compositeJob = new CompositeFileTransferJob(device()->id());
+                m_compositeJob->setMaxConcurrentJobs(KdeConnectConfig::instance()->getDeviceProperty(device()->id(), QStringLiteral("concurrentTransfers"),
+                                                     QString::number(CompositeFileTransferJob::s_defaultMaxConcurrentJobs)).toInt());
                 KIO::getJobTracker()->registerJob(m_compositeJob);
             }
 
@@ -175,10 +220,247 @@ bool SharePlugin::receivePacket(const NetworkPacket& np)
     return true;
 }
 
+void SharePlugin::receiveArchive(const NetworkPacket& np)
+{
+    if (!np.hasPayload()) {
+        qCDebug(KDECONNECT_PLUGIN_SHARE) << "Error: Folder without contents";
+        return;
+    }
+
+    const QString dirName = cleanFilename(np.get<QString>(QStringLiteral("filename"), QString::number(QDateTime::currentMSecsSinceEpoch())));
+    const QUrl destination = getFileDestination(dirName);
+    if (!destination.isLocalFile()) {
+        qCWarning(KDECONNECT_PLUGIN_SHARE) << "Can't receive folders into" << destination;
+        return;
+    }
+
+    ArchiveExtractJob* job = new ArchiveExtractJob(np, destination.toLocalFile());
+    job->setOriginName(device()->name() + ": " + dirName);
+    connect(job, &KJob::result, this, [this, job]() {
+        if (job->error()) {
+            qCDebug(KDECONNECT_PLUGIN_SHARE) << "Folder transfer failed." << job->destination() << job->errorText();
+        } else {
+            Q_EMIT shareReceived(QUrl::fromLocalFile(job->destination()).toString());
+            qCDebug(KDECONNECT_PLUGIN_SHARE) << "Folder transfer finished." << job->destination();
+        }
+    });
+    KIO::getJobTracker()->registerJob(job);
+    job->start();
+}
+
+QString SharePlugin::syncedFilePath(const QString& filename) const
+{
+    const QString name = cleanFilename(filename);
+    if (name.isEmpty() || name == QLatin1String(".") || name == QLatin1String("..")) {
+        return QString();
+    }
+    return QDir(destinationDir().toLocalFile()).filePath(name);
+}
+
+bool SharePlugin::isSyncedFile(const QString& path) const
+{
+    return config()->get<QStringList>(QStringLiteral("syncedFiles")).contains(path);
+}
+
+void SharePlugin::addSyncedFile(const QString& path)
+{
+    //Files that came from this device, the only ones it is allowed to read back and update
+    QStringList files = config()->get<QStringList>(QStringLiteral("syncedFiles"));
+    if (files.contains(path)) {
+        return;
+    }
+    files.erase(std::remove_if(files.begin(), files.end(), [](const QString& file) {
+        return !QFileInfo(file).isFile();
+    }), files.end());
+    files.append(path);
+    config()->set(QStringLiteral("syncedFiles"), files);
+}
+
+void SharePlugin::receiveSyncRequest(const NetworkPacket& np)
+{
+    const QString syncId = np.get<QString>(QStringLiteral("syncId"));
+    const QString filename = np.get<QString>(QStringLiteral("filename"));
+    const QString path = syncedFilePath(filename);
+    if (syncId.isEmpty() || path.isEmpty()) {
+        qCWarning(KDECONNECT_PLUGIN_SHARE) << "Invalid file to sync" << filename;
+        return;
+    }
+
+    NetworkPacket reply(PACKET_TYPE_SHARE_SYNC_SIGNATURE);
+    reply.set<QString>(QStringLiteral("syncId"), syncId);
+    reply.set<QString>(QStringLiteral("filename"), filename);
+    const QFileInfo info(path);
+    if (!info.exists()) {
+        //Nothing to start from, the whole file will be sent
+        m_expectedDeltas.insert(syncId, path);
+        reply.set<int>(QStringLiteral("blockSize"), 0);
+        sendPacket(reply);
+        return;
+    } else if (!info.isFile() || !isSyncedFile(path)) {
+        //Not something this device gave us, so neither its signature nor its contents are its business
+        qCDebug(KDECONNECT_PLUGIN_SHARE) << "Refusing to sync a file that wasn't received from" << device()->name() << path;
+        reply.set<bool>(QStringLiteral("refused"), true);
+        sendPacket(reply);
+        return;
+    }
+
+    m_expectedDeltas.insert(syncId, path);
+    const int blockSize = FileDelta::blockSize(qMax(np.get<qint64>(QStringLiteral("size")), info.size()));
+    FileSignatureJob* job = new FileSignatureJob(path, blockSize);
+    connect(job, &KJob::result, this, [this, job, reply]() mutable {
+        if (job->error()) {
+            qCWarning(KDECONNECT_PLUGIN_SHARE) << "Couldn't sign the file to sync:" << job->errorText();
+            reply.set<int>(QStringLiteral("blockSize"), 0);
+        } else {
+            reply.set<int>(QStringLiteral("blockSize"), job->blockSize());
+            reply.set<QString>(QStringLiteral("sha256"), QString::fromLatin1(job->hash().toHex()));
+            const QByteArray signature = job->signature();
+            if (!signature.isEmpty()) {
+                QBuffer* buffer = new QBuffer();
+                buffer->setData(signature);
+                reply.setPayload(QSharedPointer<QIODevice>(buffer), signature.size());
+            }
+        }
+        sendPacket(reply);
+    });
+    job->start();
+}
+
+void SharePlugin::receiveSignature(const NetworkPacket& np)
+{
+    const QString syncId = np.get<QString>(QStringLiteral("syncId"));
+    const QString path = m_pendingSyncs.take(syncId);
+    if (path.isEmpty()) {
+        qCDebug(KDECONNECT_PLUGIN_SHARE) << "Received a signature for a file we didn't offer" << np.get<QString>(QStringLiteral("filename"));
+        return;
+    } else if (np.get<bool>(QStringLiteral("refused"))) {
+        //The other device has an unrelated file by that name, send ours as a new one instead
+        shareUrl(QUrl::fromLocalFile(path));
+        return;
+    }
+
+    const int blockSize = np.get<int>(QStringLiteral("blockSize"));
+    const QByteArray hash = QByteArray::fromHex(np.get<QByteArray>(QStringLiteral("sha256")));
+    if (!np.hasPayload()) {
+        sendDelta(syncId, path, QByteArray(), blockSize, hash);
+        return;
+    }
+
+    //The signature is small enough to be kept in memory until it is complete
+    const QSharedPointer<QIODevice> payload = np.payload();
+    const qint64 size = np.payloadSize();
+    const QSharedPointer<QByteArray> signature(new QByteArray());
+    if (!payload->isOpen()) {
+        payload->open(QIODevice::ReadOnly);
+    }
+    auto readSignature = [this, payload, size, signature, syncId, path, blockSize, hash]() {
+        signature->append(payload->read(size - signature->size()));
+        if (signature->size() == size) {
+            disconnect(payload.data(), nullptr, this, nullptr);
+            sendDelta(syncId, path, *signature, blockSize, hash);
+        }
+    };
+    connect(payload.data(), &QIODevice::readyRead, this, readSignature);
+    connect(payload.data(), &QIODevice::readChannelFinished, this, [this, payload, size, signature, path, readSignature]() {
+        readSignature();
+        if (signature->size() < size) {
+            qCWarning(KDECONNECT_PLUGIN_SHARE) << "Received incomplete signature for" << path;
+            disconnect(payload.data(), nullptr, this, nullptr);
+        }
+    });
+    readSignature();
+}
+
+void SharePlugin::sendDelta(const QString& syncId, const QString& path, const QByteArray& signature, int blockSize, const QByteArray& hash)
+{
+    FileDeltaJob* job = new FileDeltaJob(path, signature, blockSize, hash);
+    connect(job, &KJob::result, this, [this, job, syncId]() {
+        if (job->error()) {
+            qCWarning(KDECONNECT_PLUGIN_SHARE) << "Couldn't sync" << job->path() << job->errorText();
+            return;
+        }
+
+        const QFileInfo info(job->path());
+        NetworkPacket packet(PACKET_TYPE_SHARE_SYNC_DELTA);
+        packet.setBulk(true);
+        packet.set<QString>(QStringLiteral("syncId"), syncId);
+        packet.set<QString>(QStringLiteral("filename"), info.fileName());
+        packet.set<qint64>(QStringLiteral("lastModified"), info.lastModified().toMSecsSinceEpoch());
+        if (job->unchanged()) {
+            packet.set<bool>(QStringLiteral("unchanged"), true);
+        } else {
+            packet.set<qint64>(QStringLiteral("size"), info.size());
+            packet.set<QString>(QStringLiteral("sha256"), QString::fromLatin1(job->hash().toHex()));
+            DeltaStream* delta = new DeltaStream(job->path(), job->operations());
+            if (delta->size() > 0) {
+                packet.setPayload(QSharedPointer<QIODevice>(delta), delta->size());
+            } else {
+                delete delta; //Empty file
+            }
+        }
+        sendPacket(packet);
+    });
+    job->start();
+}
+
+void SharePlugin::receiveDelta(const NetworkPacket& np)
+{
+    //Only the file we sent the signature of, under the name we picked for it
+    const QString filename = np.get<QString>(QStringLiteral("filename"));
+    const QString path = m_expectedDeltas.take(np.get<QString>(QStringLiteral("syncId")));
+    if (path.isEmpty()) {
+        qCWarning(KDECONNECT_PLUGIN_SHARE) << "Received changes to a file we didn't ask for" << filename;
+        return;
+    }
+
+    const QUrl destination = QUrl::fromLocalFile(path);
+    const qint64 dateModified = np.get<qint64>(QStringLiteral("lastModified"), QDateTime::currentMSecsSinceEpoch());
+    if (np.get<bool>(QStringLiteral("unchanged"))) {
+        qCDebug(KDECONNECT_PLUGIN_SHARE) << "Synced file is up to date" << path;
+        addSyncedFile(path);
+        setDateModified(destination, dateModified);
+        Q_EMIT shareReceived(destination.toString());
+        return;
+    } else if (!np.hasPayload()) {
+        //Make sure an empty file really is what we should end up with before throwing ours away
+        const QByteArray emptyHash = QCryptographicHash::hash(QByteArray(), QCryptographicHash::Sha256);
+        if (np.get<qint64>(QStringLiteral("size"), -1) != 0 || QByteArray::fromHex(np.get<QByteArray>(QStringLiteral("sha256"))) != emptyHash) {
+            qCWarning(KDECONNECT_PLUGIN_SHARE) << "Received changes without any data for" << path;
+            return;
+        }
+        QFile file(path);
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+            qCWarning(KDECONNECT_PLUGIN_SHARE) << "Couldn't empty the synced file" << path << file.errorString();
+            return;
+        }
+        file.close();
+        addSyncedFile(path);
+        setDateModified(destination, dateModified);
+        Q_EMIT shareReceived(destination.toString());
+        return;
+    }
+
+    DeltaApplyJob* job = new DeltaApplyJob(np, path);
+    job->setOriginName(device()->name() + ": " + cleanFilename(filename));
+    connect(job, &KJob::result, this, [this, job, path, destination, dateModified]() {
+        if (job->error()) {
+            qCDebug(KDECONNECT_PLUGIN_SHARE) << "File sync failed." << job->destination() << job->errorText();
+        } else {
+            addSyncedFile(path);
+            setDateModified(destination, dateModified);
+            Q_EMIT shareReceived(destination.toString());
+            qCDebug(KDECONNECT_PLUGIN_SHARE) << "File sync finished." << job->destination();
+        }
+    });
+    KIO::getJobTracker()->registerJob(job);
+    job->start();
+}
+
 void SharePlugin::finished(KJob* job, const qint64 dateModified)
 {
     FileTransferJob* ftjob = qobject_cast<FileTransferJob*>(job);
     if (ftjob && !job->error()) {
+        addSyncedFile(ftjob->destination().toLocalFile());
         Q_EMIT shareReceived(ftjob->destination().toString());
         setDateModified(ftjob->destination(), dateModified);
         qCDebug(KDECONNECT_PLUGIN_SHARE) << "File transfer finished." << ftjob->destination();
@@ -194,10 +476,16 @@ void SharePlugin::openDestinationFolder()
 
 void SharePlugin::shareUrl(const QUrl& url)
 {
+    if (url.isLocalFile() && QFileInfo(url.toLocalFile()).isDir()) {
+        shareDirectory(url.toLocalFile());
+        return;
+    }
+
     NetworkPacket packet(PACKET_TYPE_SHARE_REQUEST);
     if(url.isLocalFile()) {
         QSharedPointer<QIODevice> ioFile(new QFile(url.toLocalFile()));
         packet.setPayload(ioFile, ioFile->size());
+        packet.setBulk(true);
         packet.set<QString>(QStringLiteral("filename"), QUrl(url).fileName());
     } else {
         packet.set<QString>(QStringLiteral("url"), url.toString());
@@ -205,12 +493,61 @@ void SharePlugin::shareUrl(const QUrl& url)
     sendPacket(packet);
 }
 
+void SharePlugin::shareDirectory(const QString& path)
+{
+    const QString dirName = QDir(path).dirName();
+    if (device()->hasIncomingCapability(PACKET_TYPE_SHARE_ARCHIVE)) {
+        //One stream for the whole tree, instead of a packet and a connection per file
+        DirectoryArchive* archive = new DirectoryArchive(path);
+        qCDebug(KDECONNECT_PLUGIN_SHARE) << "Sharing folder" << path << "with" << archive->fileCount() << "files";
+
+        NetworkPacket packet(PACKET_TYPE_SHARE_ARCHIVE);
+        packet.setPayload(QSharedPointer<QIODevice>(archive), archive->size());
+        packet.setBulk(true);
+        packet.set<QString>(QStringLiteral("filename"), dirName);
+        sendPacket(packet);
+        return;
+    }
+
+    //Older devices only get the files, without the folders they are in
+    QDirIterator it(path, QDir::Files | QDir::Hidden | QDir::NoSymLinks, QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        shareUrl(QUrl::fromLocalFile(it.next()));
+    }
+}
+
 void SharePlugin::shareUrls(const QStringList& urls) {
     for(const QString& url : urls) {
         shareUrl(QUrl(url));
     }
 }
 
+void SharePlugin::syncUrls(const QStringList& urls)
+{
+    for (const QString& url : urls) {
+        const QUrl fileUrl(url);
+        if (fileUrl.isLocalFile() && QFileInfo(fileUrl.toLocalFile()).isFile() && device()->hasIncomingCapability(PACKET_TYPE_SHARE_SYNC)) {
+            syncFile(fileUrl.toLocalFile());
+        } else {
+            shareUrl(fileUrl);
+        }
+    }
+}
+
+void SharePlugin::syncFile(const QString& path)
+{
+    //The receiver answers with the signature of its copy, see receiveSignature()
+    const QFileInfo info(path);
+    const QString syncId = QString::fromLatin1(QUuid::createUuid().toRfc4122().toHex());
+    m_pendingSyncs.insert(syncId, path);
+
+    NetworkPacket packet(PACKET_TYPE_SHARE_SYNC);
+    packet.set<QString>(QStringLiteral("syncId"), syncId);
+    packet.set<QString>(QStringLiteral("filename"), info.fileName());
+    packet.set<qint64>(QStringLiteral("size"), info.size());
+    sendPacket(packet);
+}
+
 void SharePlugin::shareText(const QString& text)
 {
     NetworkPacket packet(PACKET_TYPE_SHARE_REQUEST);
@@ -224,6 +561,7 @@ void SharePlugin::openFile(const QUrl& url)
     if(url.isLocalFile()) {
         QSharedPointer<QIODevice> ioFile(new QFile(url.toLocalFile()));
         packet.setPayload(ioFile, ioFile->size());
+        packet.setBulk(true);
         packet.set<QString>(QStringLiteral("filename"), QUrl(url).fileName());
         packet.set<bool>(QStringLiteral("open"), true);
     }
@@ -26,10 +26,17 @@
 #include <KIO/Job>
 
 #include <core/kdeconnectplugin.h>
+#include <core/bandwidthlimiter.h>
 #include <core/compositefiletransferjob.h>
 
 #define PACKET_TYPE_SHARE_REQUEST QStringLiteral("kdeconnect.share.request")
 #define PACKET_TYPE_SHARE_REQUEST_UPDATE QStringLiteral("kdeconnect.share.request.update")
+//A whole folder in a single payload, see DirectoryArchive
+#define PACKET_TYPE_SHARE_ARCHIVE QStringLiteral("kdeconnect.share.archive")
+//Updating a file the other device already has, see FileDelta
+#define PACKET_TYPE_SHARE_SYNC QStringLiteral("kdeconnect.share.sync")
+#define PACKET_TYPE_SHARE_SYNC_SIGNATURE QStringLiteral("kdeconnect.share.sync.signature")
+#define PACKET_TYPE_SHARE_SYNC_DELTA QStringLiteral("kdeconnect.share.sync.delta")
 
 class SharePlugin
     : public KdeConnectPlugin
@@ -39,10 +46,13 @@ class SharePlugin
 
 public:
     explicit SharePlugin(QObject* parent, const QVariantList& args);
+    ~SharePlugin() override;
 
     ///Helper method, QDBus won't recognize QUrl
     Q_SCRIPTABLE void shareUrl(const QString& url) { shareUrl(QUrl(url)); }
     Q_SCRIPTABLE void shareUrls(const QStringList& urls);
+    ///Like shareUrls, but only what changed is sent if the device already received the files
+    Q_SCRIPTABLE void syncUrls(const QStringList& urls);
     Q_SCRIPTABLE void shareText(const QString& text);
     Q_SCRIPTABLE void openFile(const QString& file) { openFile(QUrl(file)); }
 
@@ -52,6 +62,7 @@ public:
 
 private Q_SLOTS:
     void openDestinationFolder();
+    void configChanged();
 
 Q_SIGNALS:
     Q_SCRIPTABLE void shareReceived(const QString& url);
@@ -59,11 +70,24 @@ Q_SIGNALS:
 private:
     void finished(KJob* job, const qint64 dateModified);
     void shareUrl(const QUrl& url);
+    void shareDirectory(const QString& path);
+    void receiveArchive(const NetworkPacket& np);
+    void syncFile(const QString& path);
+    void receiveSyncRequest(const NetworkPacket& np);
+    void receiveSignature(const NetworkPacket& np);
+    void sendDelta(const QString& syncId, const QString& path, const QByteArray& signature, int blockSize, const QByteArray& hash);
+    void receiveDelta(const NetworkPacket& np);
+    QString syncedFilePath(const QString& filename) const;
+    bool isSyncedFile(const QString& path) const;
+    void addSyncedFile(const QString& path);
     void openFile(const QUrl& url);
     QUrl destinationDir() const;
     QUrl getFileDestination(const QString filename) const;
     void setDateModified(const QUrl& destination, const qint64 timestamp);
 
     QPointer<CompositeFileTransferJob> m_compositeJob;
+    QHash<QString, QString> m_pendingSyncs; //Local paths of the files we offered, by sync id
+    QHash<QString, QString> m_expectedDeltas; //Local paths we sent a signature of, by sync id
+    QPointer<BandwidthLimiter> m_bandwidthLimiter; //Of the device, which could be gone before us
 };
 #endif
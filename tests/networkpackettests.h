@@ -32,6 +32,17 @@ private Q_SLOTS:
 
     void networkPacketTest();
     void networkPacketIdentityTest();
+    void networkPacketSerializeTest();
+    void networkPacketUnserializeTest();
+    void networkPacketEncodingTest_data();
+    void networkPacketEncodingTest();
+    void networkPacketInlinePayloadTest_data();
+    void networkPacketInlinePayloadTest();
+    void networkPacketLargePayloadSizeTest_data();
+    void networkPacketLargePayloadSizeTest();
+    void networkPacketCopyTest();
+    void networkPacketCopyBenchmark();
+    void networkPacketReceiveBenchmark();
     //void networkPacketEncryptionTest();
 
     void cleanupTestCase();
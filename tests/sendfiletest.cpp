@@ -19,6 +19,7 @@
  */
 
 #include <QSocketNotifier>
+#include <algorithm>
 #include <kdeconnectconfig.h>
 #include <backends/lan/uploadjob.h>
 #include <core/filetransferjob.h>
@@ -39,6 +40,8 @@
 #include "testdaemon.h"
 #include <plugins/share/shareplugin.h>
 #include <backends/lan/compositeuploadjob.h>
+#include <backends/lan/lanlinkprovider.h>
+#include <backends/lan/server.h>
 
 class TestSendFile : public QObject
 {
@@ -151,6 +154,77 @@ class TestSendFile : public QObject
             QCOMPARE(resultFile.readAll(), originFile.readAll());
         }
 
+        void testLargePayload()
+        {
+            //Over 4GiB, so any 32 bit size on the way shows
+            const qint64 size = Q_INT64_C(5) * 1024 * 1024 * 1024;
+
+            const QString deviceId = KdeConnectConfig::instance()->deviceId();
+            KdeConnectConfig* kcc = KdeConnectConfig::instance();
+            kcc->addTrustedDevice(deviceId, QStringLiteral("testdevice"), kcc->deviceType());
+            kcc->setDeviceProperty(deviceId, QStringLiteral("certificate"), QString::fromLatin1(kcc->certificate().toPem()));
+
+            //Sparse, and what is received is only counted, so it doesn't need any disk space
+            QTemporaryFile source;
+            QVERIFY(source.open());
+            QVERIFY(source.resize(size));
+            source.close();
+
+            QSharedPointer<QFile> f(new QFile(source.fileName()));
+            NetworkPacket np(PACKET_TYPE_SHARE_REQUEST);
+            np.setPayload(f, f->size());
+
+            //The size has to survive the trip through the packet
+            NetworkPacket received(QString{});
+#if QT_VERSION >= QT_VERSION_CHECK(5, 12, 0)
+            QVERIFY(NetworkPacket::unserialize(np.serialize(NetworkPacket::CborEncoding), &received, NetworkPacket::CborEncoding));
+            QCOMPARE(received.payloadSize(), size);
+#endif
+            QVERIFY(NetworkPacket::unserialize(np.serialize(), &received));
+            QCOMPARE(received.payloadSize(), size);
+
+            //A payload connection over loopback, like LanDeviceLink sets it up
+            Server server;
+            QVERIFY(server.listen(QHostAddress::LocalHost));
+            QSslSocket client;
+            QSignalSpy newConnection(&server, &QTcpServer::newConnection);
+            client.connectToHost(QHostAddress::LocalHost, server.serverPort());
+            QVERIFY(newConnection.wait());
+            QSslSocket* serverSocket = server.nextPendingConnection();
+            LanLinkProvider::configureSslSocket(serverSocket, deviceId, true);
+            LanLinkProvider::configureSslSocket(&client, deviceId, true);
+
+            UploadJob* upload = new UploadJob(np);
+            upload->setSocket(serverSocket);
+            connect(serverSocket, &QSslSocket::encrypted, upload, &UploadJob::start);
+            //It deletes itself right after the result
+            int uploadError = -1;
+            connect(upload, &KJob::result, this, [&uploadError](KJob* job) { uploadError = job->error(); });
+
+            qint64 receivedSize = 0;
+            bool receivedZeros = true;
+            QByteArray buffer(1024 * 1024, 0);
+            connect(&client, &QIODevice::readyRead, this, [&]() {
+                qint64 read;
+                while ((read = client.read(buffer.data(), buffer.size())) > 0) {
+                    receivedZeros = receivedZeros && std::all_of(buffer.constData(), buffer.constData() + read, [](char c) { return c == 0; });
+                    receivedSize += read;
+                }
+            });
+
+            QSignalSpy clientEncrypted(&client, &QSslSocket::encrypted);
+            serverSocket->startServerEncryption();
+            client.startClientEncryption();
+            QVERIFY(clientEncrypted.wait());
+
+            QTRY_VERIFY_WITH_TIMEOUT(uploadError >= 0, 10 * 60 * 1000);
+            QCOMPARE(uploadError, 0);
+            QTRY_COMPARE(receivedSize, size);
+            QVERIFY(receivedZeros);
+
+            kcc->removeTrustedDevice(deviceId);
+        }
+
     private:
         TestDaemon* m_daemon;
 };
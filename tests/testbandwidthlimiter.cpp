@@ -0,0 +1,130 @@
+/**
+ * Copyright 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "../core/bandwidthlimiter.h"
+#include "../core/networkpacket.h"
+
+#include <QSignalSpy>
+#include <QTest>
+
+class TestBandwidthLimiter : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void priorities();
+    void unlimited();
+    void limited();
+    void interactiveFirst();
+    void yieldWithoutLimit();
+    void measuredRates();
+};
+
+void TestBandwidthLimiter::priorities()
+{
+    //Whoever sends the packet decides, not its type
+    NetworkPacket np(QStringLiteral("kdeconnect.share.request"));
+    QCOMPARE(BandwidthLimiter::priorityOf(np), BandwidthLimiter::Interactive);
+    np.setBulk(true);
+    QCOMPARE(BandwidthLimiter::priorityOf(np), BandwidthLimiter::Bulk);
+    QCOMPARE(BandwidthLimiter::priorityOf(NetworkPacket(np)), BandwidthLimiter::Bulk);
+    QCOMPARE(BandwidthLimiter::priorityOf(NetworkPacket(QStringLiteral("kdeconnect.mpris"))), BandwidthLimiter::Interactive);
+}
+
+void TestBandwidthLimiter::unlimited()
+{
+    BandwidthLimiter limiter;
+    QCOMPARE(limiter.allowance(), qint64(-1));
+    limiter.consume(100 * 1024 * 1024, BandwidthLimiter::Bulk);
+    QCOMPARE(limiter.allowance(), qint64(-1));
+}
+
+void TestBandwidthLimiter::limited()
+{
+    BandwidthLimiter limiter;
+    limiter.setRateLimit(1024 * 1024);
+
+    //Nothing saved up at first, then about a quarter of a second worth
+    QTest::qWait(300);
+    const qint64 burst = limiter.allowance();
+    QVERIFY(burst > 0);
+    QVERIFY(burst <= 256 * 1024);
+
+    //A bit more than allowed, as a socket write could
+    limiter.consume(burst * 2, BandwidthLimiter::Bulk);
+    QCOMPARE(limiter.allowance(), qint64(0));
+
+    QSignalSpy ready(&limiter, &BandwidthLimiter::ready);
+    limiter.waitForAllowance();
+    QVERIFY(ready.wait(1000));
+    QVERIFY(limiter.allowance() > 0);
+
+    limiter.setRateLimit(0);
+    QCOMPARE(limiter.allowance(), qint64(-1));
+}
+
+void TestBandwidthLimiter::interactiveFirst()
+{
+    //Interactive writes go through, the bulk ones pay for them
+    BandwidthLimiter limiter;
+    limiter.setRateLimit(1024 * 1024);
+    QTest::qWait(300);
+    QVERIFY(limiter.allowance() > 0);
+
+    limiter.consume(200 * 1024, BandwidthLimiter::Interactive);
+    QCOMPARE(limiter.allowance(), qint64(0));
+}
+
+void TestBandwidthLimiter::yieldWithoutLimit()
+{
+    BandwidthLimiter limiter;
+    limiter.consume(10 * 1024 * 1024, BandwidthLimiter::Bulk);
+    QVERIFY(limiter.rate(BandwidthLimiter::Bulk) > 0);
+
+    //Bulk transfers slow down while there is interactive traffic, then go back to full speed
+    limiter.consume(200, BandwidthLimiter::Interactive);
+    QVERIFY(limiter.allowance() >= 0);
+    QTRY_COMPARE_WITH_TIMEOUT(limiter.allowance(), qint64(-1), 2000);
+}
+
+void TestBandwidthLimiter::measuredRates()
+{
+    BandwidthLimiter limiter;
+    QCOMPARE(limiter.rate(BandwidthLimiter::Bulk), qint64(0));
+
+    //Being idle before doesn't dilute what is sent now
+    QTest::qWait(1500);
+    limiter.consume(1000 * 1000, BandwidthLimiter::Bulk);
+    limiter.consume(1000, BandwidthLimiter::Interactive);
+    QTest::qWait(300);
+
+    //Measured over the last second
+    QCOMPARE(limiter.rate(BandwidthLimiter::Bulk), qint64(1000 * 1000));
+    QCOMPARE(limiter.rate(BandwidthLimiter::Interactive), qint64(1000));
+
+    //And nothing once it's idle
+    QTest::qWait(1100);
+    QCOMPARE(limiter.rate(BandwidthLimiter::Bulk), qint64(0));
+    QCOMPARE(limiter.rate(BandwidthLimiter::Interactive), qint64(0));
+}
+
+QTEST_GUILESS_MAIN(TestBandwidthLimiter)
+
+#include "testbandwidthlimiter.moc"
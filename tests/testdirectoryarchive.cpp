@@ -0,0 +1,180 @@
+/**
+ * Copyright 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "../plugins/share/directoryarchive.h"
+#include "../plugins/share/archiveextractjob.h"
+#include "../plugins/share/share_debug.h"
+
+#include <QBuffer>
+#include <QTemporaryDir>
+#include <QTest>
+
+#include <core/networkpacket.h>
+
+Q_LOGGING_CATEGORY(KDECONNECT_PLUGIN_SHARE, "kdeconnect.plugin.share")
+
+class TestDirectoryArchive : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void roundtrip();
+    void unsafePath();
+    void fileChanged_data();
+    void fileChanged();
+
+private:
+    QByteArray readArchive(const QString& path);
+    bool extract(const QByteArray& archive, const QString& destination);
+};
+
+QByteArray TestDirectoryArchive::readArchive(const QString& path)
+{
+    DirectoryArchive archive(path);
+    if (!archive.open(QIODevice::ReadOnly)) {
+        return QByteArray();
+    }
+
+    //Read in pieces, like an upload would
+    QByteArray data;
+    while (!archive.atEnd()) {
+        data += archive.read(1000);
+    }
+    return data;
+}
+
+bool TestDirectoryArchive::extract(const QByteArray& archive, const QString& destination)
+{
+    QBuffer* buffer = new QBuffer();
+    buffer->setData(archive);
+    buffer->open(QIODevice::ReadOnly);
+
+    NetworkPacket np(QStringLiteral("kdeconnect.share.archive"));
+    np.setPayload(QSharedPointer<QIODevice>(buffer), archive.size());
+
+    ArchiveExtractJob* job = new ArchiveExtractJob(np, destination);
+    return job->exec();
+}
+
+void TestDirectoryArchive::roundtrip()
+{
+    QTemporaryDir source;
+    QVERIFY(source.isValid());
+    QDir dir(source.path());
+    QVERIFY(dir.mkpath(QStringLiteral("a/b")));
+    QVERIFY(dir.mkpath(QStringLiteral("empty")));
+
+    const QByteArray big(300000, 'k');
+    const QVector<QPair<QString, QByteArray>> files = {
+        { QStringLiteral("top.txt"), QByteArrayLiteral("hello") },
+        { QStringLiteral("a/b/big.bin"), big },
+        { QStringLiteral("a/nothing"), QByteArray() },
+        { QStringLiteral("a/b/ünïcode"), QByteArrayLiteral("utf-8") },
+    };
+    for (const auto& file : files) {
+        QFile f(dir.filePath(file.first));
+        QVERIFY(f.open(QIODevice::WriteOnly));
+        f.write(file.second);
+    }
+
+    DirectoryArchive archive(source.path());
+    QCOMPARE(archive.fileCount(), files.size());
+    const QByteArray data = readArchive(source.path());
+    QCOMPARE(qint64(data.size()), archive.size());
+
+    QTemporaryDir received;
+    QVERIFY(received.isValid());
+    const QString destination = received.path() + QStringLiteral("/copy");
+    QVERIFY(extract(data, destination));
+
+    for (const auto& file : files) {
+        QFile f(destination + QLatin1Char('/') + file.first);
+        QVERIFY2(f.open(QIODevice::ReadOnly), qPrintable(file.first));
+        QCOMPARE(f.readAll(), file.second);
+        QCOMPARE(QFileInfo(f).lastModified().toMSecsSinceEpoch(), QFileInfo(dir.filePath(file.first)).lastModified().toMSecsSinceEpoch());
+    }
+    QVERIFY(QFileInfo(destination + QStringLiteral("/empty")).isDir());
+
+    //Cut short, the job fails but keeps the files that arrived completely
+    const QString incomplete = received.path() + QStringLiteral("/incomplete");
+    QVERIFY(!extract(data.left(data.size() - 100), incomplete));
+}
+
+void TestDirectoryArchive::unsafePath()
+{
+    //An entry that would escape the destination
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    const QByteArray path("../escaped");
+    stream << quint16(path.size());
+    stream.writeRawData(path.constData(), path.size());
+    stream << quint8(DirectoryArchive::File) << quint32(0x600) << qint64(0) << qint64(4);
+    stream.writeRawData("evil", 4);
+    stream << quint16(0);
+
+    QTemporaryDir received;
+    QVERIFY(received.isValid());
+    QVERIFY(!extract(data, received.path() + QStringLiteral("/copy")));
+    QVERIFY(!QFile::exists(received.path() + QStringLiteral("/escaped")));
+}
+
+void TestDirectoryArchive::fileChanged_data()
+{
+    QTest::addColumn<bool>("removed");
+
+    QTest::newRow("shrunk") << false;
+    QTest::newRow("removed") << true;
+}
+
+void TestDirectoryArchive::fileChanged()
+{
+    QFETCH(bool, removed);
+
+    QTemporaryDir source;
+    QVERIFY(source.isValid());
+    const QString path = source.path() + QStringLiteral("/file");
+    QFile file(path);
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    file.write(QByteArray(300000, 'k'));
+    file.close();
+
+    DirectoryArchive archive(source.path());
+    QVERIFY(archive.open(QIODevice::ReadOnly));
+    if (removed) {
+        QVERIFY(file.remove());
+    } else {
+        QVERIFY(file.resize(1000));
+    }
+
+    //Nothing made up for what is missing, reading fails instead
+    QByteArray data;
+    QByteArray chunk;
+    while (!(chunk = archive.read(1000)).isEmpty()) {
+        data += chunk;
+    }
+    QVERIFY(qint64(data.size()) < archive.size());
+    QCOMPARE(archive.read(1000).size(), 0);
+    QCOMPARE(archive.failedPath(), path);
+    QVERIFY(archive.errorString().contains(path));
+}
+
+QTEST_GUILESS_MAIN(TestDirectoryArchive)
+
+#include "testdirectoryarchive.moc"
@@ -0,0 +1,217 @@
+/**
+ * Copyright 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "../plugins/share/filedelta.h"
+#include "../plugins/share/deltaapplyjob.h"
+#include "../plugins/share/share_debug.h"
+
+#include <QBuffer>
+#include <QSignalSpy>
+#include <QTemporaryDir>
+#include <QTest>
+
+#include <core/networkpacket.h>
+
+Q_LOGGING_CATEGORY(KDECONNECT_PLUGIN_SHARE, "kdeconnect.plugin.share")
+
+class TestFileDelta : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void rollingChecksum();
+    void sync_data();
+    void sync();
+    void corrupted();
+    void shrunkWhileMatching();
+
+private:
+    QByteArray randomData(int size);
+    QString writeFile(const QString& name, const QByteArray& data);
+    NetworkPacket deltaPacket(const FileDeltaJob& job, qint64 size);
+
+    QTemporaryDir m_dir;
+};
+
+void TestFileDelta::initTestCase()
+{
+    QVERIFY(m_dir.isValid());
+}
+
+QByteArray TestFileDelta::randomData(int size)
+{
+    QByteArray data(size, Qt::Uninitialized);
+    quint32 state = static_cast<quint32>(size);
+    for (int i = 0; i < size; i++) {
+        state = state * 1103515245 + 12345;
+        data[i] = static_cast<char>(state >> 16);
+    }
+    return data;
+}
+
+QString TestFileDelta::writeFile(const QString& name, const QByteArray& data)
+{
+    const QString path = m_dir.filePath(name);
+    QFile file(path);
+    file.open(QIODevice::WriteOnly | QIODevice::Truncate);
+    file.write(data);
+    return path;
+}
+
+NetworkPacket TestFileDelta::deltaPacket(const FileDeltaJob& job, qint64 size)
+{
+    DeltaStream delta(job.path(), job.operations());
+    delta.open(QIODevice::ReadOnly);
+    QBuffer* buffer = new QBuffer();
+    buffer->setData(delta.readAll());
+    buffer->open(QIODevice::ReadOnly);
+
+    NetworkPacket np(QStringLiteral("kdeconnect.share.sync.delta"));
+    np.set<qint64>(QStringLiteral("size"), size);
+    np.set<QString>(QStringLiteral("sha256"), QString::fromLatin1(job.hash().toHex()));
+    np.setPayload(QSharedPointer<QIODevice>(buffer), buffer->size());
+    return np;
+}
+
+void TestFileDelta::rollingChecksum()
+{
+    //Rolling the window gives the same checksum as computing it again
+    const QByteArray data = randomData(10000);
+    const int window = 2048;
+    quint32 a = 0, b = 0;
+    for (int i = 0; i < window; i++) {
+        a += static_cast<uchar>(data[i]);
+        b += static_cast<quint32>(window - i) * static_cast<uchar>(data[i]);
+    }
+    for (int pos = 0; pos + window < data.size(); pos++) {
+        QCOMPARE((a & 0xFFFF) | (b << 16), FileDelta::weakChecksum(data.constData() + pos, window));
+        const uchar out = data[pos];
+        const uchar in = data[pos + window];
+        a = a - out + in;
+        b = b - window * out + a;
+    }
+}
+
+void TestFileDelta::sync_data()
+{
+    QTest::addColumn<QByteArray>("base");
+    QTest::addColumn<QByteArray>("modified");
+    QTest::addColumn<bool>("unchanged");
+    QTest::addColumn<qint64>("maxDelta"); //Bytes that may be sent
+
+    const QByteArray base = randomData(3 * 1024 * 1024);
+    QByteArray inserted = base;
+    inserted.insert(1000001, "a few more bytes");
+    QByteArray edited = base;
+    edited[2000000] = ~edited[2000000];
+    const QByteArray appended = base + randomData(5000);
+
+    QTest::newRow("unchanged") << base << base << true << qint64(0);
+    QTest::newRow("inserted") << base << inserted << false << qint64(16 * 1024);
+    QTest::newRow("edited") << base << edited << false << qint64(16 * 1024);
+    QTest::newRow("appended") << base << appended << false << qint64(16 * 1024);
+    QTest::newRow("truncated") << base << base.left(12345) << false << qint64(4 * 1024);
+    QTest::newRow("no copy") << QByteArray() << base << false << qint64(base.size() + 1024);
+
+    //Matched in several slices, with a change where one ends
+    const QByteArray big = randomData(9 * 1024 * 1024);
+    QByteArray bigEdited = big;
+    bigEdited.replace(4 * 1024 * 1024 - 8, 16, "across the slice");
+    QTest::newRow("several slices") << big << bigEdited << false << qint64(16 * 1024);
+}
+
+void TestFileDelta::sync()
+{
+    QFETCH(QByteArray, base);
+    QFETCH(QByteArray, modified);
+    QFETCH(bool, unchanged);
+    QFETCH(qint64, maxDelta);
+
+    const QString basePath = writeFile(QStringLiteral("base"), base);
+    const QString modifiedPath = writeFile(QStringLiteral("modified"), modified);
+
+    FileSignatureJob signatureJob(basePath, FileDelta::blockSize(modified.size()));
+    signatureJob.setAutoDelete(false);
+    QVERIFY(signatureJob.exec());
+    QCOMPARE(signatureJob.hash(), QCryptographicHash::hash(base, QCryptographicHash::Sha256));
+
+    FileDeltaJob deltaJob(modifiedPath, signatureJob.signature(), signatureJob.blockSize(), signatureJob.hash());
+    deltaJob.setAutoDelete(false);
+    QVERIFY(deltaJob.exec());
+    QCOMPARE(deltaJob.unchanged(), unchanged);
+    QCOMPARE(deltaJob.hash(), QCryptographicHash::hash(modified, QCryptographicHash::Sha256));
+    if (unchanged) {
+        return;
+    }
+
+    const NetworkPacket np = deltaPacket(deltaJob, modified.size());
+    QVERIFY2(np.payloadSize() <= maxDelta, qPrintable(QString::number(np.payloadSize())));
+
+    DeltaApplyJob* applyJob = new DeltaApplyJob(np, basePath);
+    QVERIFY(applyJob->exec());
+
+    QFile result(basePath);
+    QVERIFY(result.open(QIODevice::ReadOnly));
+    QCOMPARE(result.readAll(), modified);
+}
+
+void TestFileDelta::corrupted()
+{
+    //A delta that doesn't give the announced file leaves our copy alone
+    const QByteArray base = randomData(100000);
+    const QString basePath = writeFile(QStringLiteral("base"), base);
+    const QString modifiedPath = writeFile(QStringLiteral("modified"), base + "changed");
+
+    FileDeltaJob deltaJob(modifiedPath, QByteArray(), 0, QByteArray());
+    deltaJob.setAutoDelete(false);
+    QVERIFY(deltaJob.exec());
+
+    NetworkPacket np = deltaPacket(deltaJob, base.size() + 7);
+    np.set<QString>(QStringLiteral("sha256"), QString::fromLatin1(QCryptographicHash::hash(base, QCryptographicHash::Sha256).toHex()));
+    DeltaApplyJob* applyJob = new DeltaApplyJob(np, basePath);
+    QVERIFY(!applyJob->exec());
+
+    QFile result(basePath);
+    QVERIFY(result.open(QIODevice::ReadOnly));
+    QCOMPARE(result.readAll(), base);
+}
+
+void TestFileDelta::shrunkWhileMatching()
+{
+    //Editors save by truncating the file, which only fails the job
+    const QString path = writeFile(QStringLiteral("shrinking"), randomData(6 * 1024 * 1024));
+
+    FileDeltaJob deltaJob(path, QByteArray(), FileDelta::blockSize(6 * 1024 * 1024), QByteArray());
+    deltaJob.setAutoDelete(false);
+    QSignalSpy result(&deltaJob, &KJob::result);
+    deltaJob.start();
+    //The first slice, then the file shrinks before the second one
+    QCoreApplication::processEvents();
+    QCOMPARE(result.count(), 0);
+    QVERIFY(QFile::resize(path, 1024));
+
+    QVERIFY(result.wait());
+    QVERIFY(deltaJob.error());
+}
+
+QTEST_GUILESS_MAIN(TestFileDelta)
+
+#include "testfiledelta.moc"
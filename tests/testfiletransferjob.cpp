@@ -0,0 +1,256 @@
+/**
+ * Copyright 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "../core/filetransferjob.h"
+#include "../core/networkpacket.h"
+
+#include <QCryptographicHash>
+#include <QSignalSpy>
+#include <QTemporaryDir>
+#include <QTemporaryFile>
+#include <QTest>
+#include <QtEndian>
+
+#ifdef Q_OS_LINUX
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
+
+//Stands for the payload connection: it has everything the test feeds it and keeps what the job writes
+class FakePayload : public QIODevice
+{
+public:
+    explicit FakePayload(const QByteArray& data)
+        : m_data(data)
+    {
+        open(QIODevice::ReadWrite | QIODevice::Unbuffered);
+    }
+
+    bool isSequential() const override { return true; }
+    qint64 bytesAvailable() const override { return m_data.size() + QIODevice::bytesAvailable(); }
+
+    //The connection breaks
+    void finish() { Q_EMIT readChannelFinished(); }
+
+    QByteArray m_written;
+
+protected:
+    qint64 readData(char* data, qint64 maxSize) override
+    {
+        const int size = static_cast<int>(qMin<qint64>(maxSize, m_data.size()));
+        memcpy(data, m_data.constData(), size);
+        m_data.remove(0, size);
+        return size;
+    }
+
+    qint64 writeData(const char* data, qint64 size) override
+    {
+        m_written.append(data, static_cast<int>(size));
+        return size;
+    }
+
+private:
+    QByteArray m_data;
+};
+
+#ifdef Q_OS_LINUX
+static bool canPreallocate(const QString& dir)
+{
+    QTemporaryFile probe(dir + QStringLiteral("/probe"));
+    return probe.open() && fallocate(probe.handle(), FALLOC_FL_KEEP_SIZE, 0, 4096) == 0;
+}
+#endif
+
+class TestFileTransferJob : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void init();
+    void receiveFile();
+    void resumeBrokenTransfer();
+    void resumeCorruptedPartialFile();
+    void hashMismatch();
+
+private:
+    NetworkPacket* packet(FakePayload* payload, qint64 size, bool resumable, bool hashed);
+    static QByteArray testData(int size);
+    static QByteArray readFile(const QString& path);
+
+    QTemporaryDir m_dir;
+    QString m_destination;
+    QScopedPointer<NetworkPacket> m_np;
+};
+
+void TestFileTransferJob::init()
+{
+    QVERIFY(m_dir.isValid());
+    m_destination = m_dir.filePath(QStringLiteral("received"));
+    QFile::remove(m_destination);
+    QFile::remove(m_destination + QStringLiteral(".part"));
+    QFile::remove(m_destination + QStringLiteral(".part.info"));
+}
+
+NetworkPacket* TestFileTransferJob::packet(FakePayload* payload, qint64 size, bool resumable, bool hashed)
+{
+    //The job keeps a pointer to it
+    m_np.reset(new NetworkPacket(QStringLiteral("kdeconnect.share.request")));
+    m_np->set<qint64>(QStringLiteral("lastModified"), 1234);
+    m_np->setPayload(QSharedPointer<QIODevice>(payload), size);
+    QVariantMap transferInfo;
+    if (resumable) {
+        transferInfo.insert(QStringLiteral("resumable"), true);
+    }
+    if (hashed) {
+        transferInfo.insert(QStringLiteral("hash"), QStringLiteral("sha256"));
+    }
+    m_np->setPayloadTransferInfo(transferInfo);
+    return m_np.data();
+}
+
+QByteArray TestFileTransferJob::testData(int size)
+{
+    QByteArray data(size, Qt::Uninitialized);
+    for (int i = 0; i < size; ++i) {
+        data[i] = static_cast<char>(i * 7 + i / 4096);
+    }
+    return data;
+}
+
+QByteArray TestFileTransferJob::readFile(const QString& path)
+{
+    QFile file(path);
+    return file.open(QIODevice::ReadOnly) ? file.readAll() : QByteArray();
+}
+
+void TestFileTransferJob::receiveFile()
+{
+    //Several times the write buffer, and not a multiple of it
+    const QByteArray data = testData(3 * 1024 * 1024 + 123);
+    FileTransferJob job(packet(new FakePayload(data), data.size(), false, false), QUrl::fromLocalFile(m_destination));
+    job.setAutoDelete(false);
+    QSignalSpy result(&job, &KJob::result);
+    job.start();
+
+    QVERIFY(result.wait());
+    QCOMPARE(job.error(), 0);
+    QCOMPARE(job.processedAmount(KJob::Bytes), qulonglong(data.size()));
+    QCOMPARE(readFile(m_destination), data);
+}
+
+void TestFileTransferJob::resumeBrokenTransfer()
+{
+    const QByteArray data = testData(5 * 1024 * 1024 / 2);
+    const int brokenAt = 1024 * 1024 + 17;
+
+    //The connection breaks in the middle, the partial file is kept
+    FakePayload* payload = new FakePayload(data.left(brokenAt));
+    {
+        FileTransferJob job(packet(payload, data.size(), true, true), QUrl::fromLocalFile(m_destination));
+        job.setAutoDelete(false);
+        QSignalSpy result(&job, &KJob::result);
+        job.start();
+        QTRY_COMPARE(job.processedAmount(KJob::Bytes), qulonglong(brokenAt));
+        payload->finish();
+
+        QVERIFY(result.count() || result.wait());
+        QCOMPARE(job.error(), 3);
+        QCOMPARE(payload->m_written, QByteArray(8, '\0'));
+    }
+    QVERIFY(!QFile::exists(m_destination));
+    //Space is preallocated past the end, but the size tells how much we have
+    QCOMPARE(QFileInfo(m_destination + QStringLiteral(".part")).size(), qint64(brokenAt));
+#ifdef Q_OS_LINUX
+    if (canPreallocate(m_dir.path())) {
+        struct stat st;
+        QCOMPARE(stat(QFile::encodeName(m_destination + QStringLiteral(".part")).constData(), &st), 0);
+        QVERIFY(st.st_blocks * 512 >= data.size());
+    }
+#endif
+
+    //Sent again, only the rest comes. The hash is still of the whole file.
+    payload = new FakePayload(data.mid(brokenAt) + QCryptographicHash::hash(data, QCryptographicHash::Sha256));
+    FileTransferJob job(packet(payload, data.size(), true, true), QUrl::fromLocalFile(m_destination));
+    job.setAutoDelete(false);
+    QSignalSpy result(&job, &KJob::result);
+    job.start();
+
+    QVERIFY(result.wait());
+    QCOMPARE(job.error(), 0);
+    QCOMPARE(qFromBigEndian<quint64>(reinterpret_cast<const uchar*>(payload->m_written.constData())), quint64(brokenAt));
+    QCOMPARE(readFile(m_destination), data);
+    QVERIFY(!QFile::exists(m_destination + QStringLiteral(".part")));
+}
+
+void TestFileTransferJob::resumeCorruptedPartialFile()
+{
+    const QByteArray data = testData(1024 * 1024);
+    const int brokenAt = data.size() / 2;
+
+    FakePayload* payload = new FakePayload(data.left(brokenAt));
+    {
+        FileTransferJob job(packet(payload, data.size(), true, true), QUrl::fromLocalFile(m_destination));
+        job.setAutoDelete(false);
+        QSignalSpy result(&job, &KJob::result);
+        job.start();
+        QTRY_COMPARE(job.processedAmount(KJob::Bytes), qulonglong(brokenAt));
+        payload->finish();
+        QVERIFY(result.count() || result.wait());
+    }
+
+    //Something changed the start of the partial file in between
+    QFile partialFile(m_destination + QStringLiteral(".part"));
+    QVERIFY(partialFile.open(QIODevice::ReadWrite));
+    QVERIFY(partialFile.seek(100));
+    QCOMPARE(partialFile.write("corrupted"), qint64(9));
+    partialFile.close();
+
+    payload = new FakePayload(data.mid(brokenAt) + QCryptographicHash::hash(data, QCryptographicHash::Sha256));
+    FileTransferJob job(packet(payload, data.size(), true, true), QUrl::fromLocalFile(m_destination));
+    job.setAutoDelete(false);
+    QSignalSpy result(&job, &KJob::result);
+    job.start();
+
+    QVERIFY(result.wait());
+    QCOMPARE(job.error(), 5);
+    QVERIFY(!QFile::exists(m_destination));
+    QVERIFY(!QFile::exists(m_destination + QStringLiteral(".part")));
+}
+
+void TestFileTransferJob::hashMismatch()
+{
+    const QByteArray data = testData(1024 * 1024 + 1);
+    QByteArray corrupted = data;
+    corrupted[1000] = ~corrupted[1000];
+
+    FileTransferJob job(packet(new FakePayload(corrupted + QCryptographicHash::hash(data, QCryptographicHash::Sha256)), data.size(), false, true),
+                        QUrl::fromLocalFile(m_destination));
+    job.setAutoDelete(false);
+    QSignalSpy result(&job, &KJob::result);
+    job.start();
+
+    QVERIFY(result.wait());
+    QCOMPARE(job.error(), 5);
+    QVERIFY(!QFile::exists(m_destination));
+}
+
+QTEST_GUILESS_MAIN(TestFileTransferJob)
+
+#include "testfiletransferjob.moc"
@@ -0,0 +1,202 @@
+/**
+ * Copyright 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "../core/backends/lan/kerneltlssocket.h"
+#include "../core/backends/lan/server.h"
+#include "../core/kdeconnectconfig.h"
+
+#include <QRandomGenerator>
+#include <QSignalSpy>
+#include <QSslKey>
+#include <QStandardPaths>
+#include <QTemporaryFile>
+#include <QTest>
+#include <QtCrypto>
+
+/*
+ * Sends over loopback from a KernelTlsSocket to a QSslSocket, like a payload connection
+ * between two devices. Needs the tls kernel module, without it there's nothing to test.
+ */
+class TestKernelTlsSocket : public QObject
+{
+    Q_OBJECT
+public:
+    TestKernelTlsSocket()
+    {
+        QStandardPaths::setTestModeEnabled(true);
+    }
+
+private Q_SLOTS:
+    void initTestCase();
+    void cleanupTestCase();
+    void init();
+    void cleanup();
+
+    void sendFile();
+    void readAndWrite();
+    void wrongCertificate();
+
+private:
+    bool connectSockets();
+
+    const QString m_deviceId = QStringLiteral("testkerneltlsdevice");
+    QCA::Initializer m_qcaInitializer;
+    Server* m_server;
+    QSslSocket* m_clientSocket;
+    KernelTlsSocket* m_socket;
+};
+
+void TestKernelTlsSocket::initTestCase()
+{
+    if (!KernelTlsSocket::isAvailable()) {
+        QSKIP("The tls kernel module isn't loaded");
+    }
+#ifdef OPENSSL_NO_KTLS
+    QSKIP("OpenSSL is built without kTLS support");
+#endif
+
+    //The other side is ourselves
+    KdeConnectConfig* config = KdeConnectConfig::instance();
+    config->addTrustedDevice(m_deviceId, QStringLiteral("Test Device"), QStringLiteral("phone"));
+    config->setDeviceProperty(m_deviceId, QStringLiteral("certificate"), QString::fromLatin1(config->certificate().toPem()));
+
+    m_server = new Server(this);
+    QVERIFY(m_server->listen(QHostAddress::LocalHost));
+}
+
+void TestKernelTlsSocket::cleanupTestCase()
+{
+    KdeConnectConfig::instance()->removeTrustedDevice(m_deviceId);
+}
+
+void TestKernelTlsSocket::init()
+{
+    KdeConnectConfig* config = KdeConnectConfig::instance();
+    m_clientSocket = new QSslSocket(this);
+    m_clientSocket->setLocalCertificate(config->certificate());
+    m_clientSocket->setPrivateKey(config->privateKey());
+    m_clientSocket->setPeerVerifyMode(QSslSocket::QueryPeer);
+
+    QSignalSpy newConnection(m_server, &QTcpServer::newConnection);
+    m_clientSocket->connectToHost(QHostAddress::LocalHost, m_server->serverPort());
+    QVERIFY(newConnection.wait());
+
+    m_socket = KernelTlsSocket::takeOver(m_server->nextPendingConnection(), m_deviceId, true);
+    QVERIFY(m_socket);
+}
+
+void TestKernelTlsSocket::cleanup()
+{
+    delete m_socket;
+    delete m_clientSocket;
+}
+
+bool TestKernelTlsSocket::connectSockets()
+{
+    QSignalSpy clientEncrypted(m_clientSocket, &QSslSocket::encrypted);
+    QSignalSpy encrypted(m_socket, &KernelTlsSocket::encrypted);
+    m_clientSocket->startClientEncryption();
+    return (encrypted.count() > 0 || encrypted.wait()) && (clientEncrypted.count() > 0 || clientEncrypted.wait());
+}
+
+void TestKernelTlsSocket::sendFile()
+{
+    QVERIFY(connectSockets());
+    //Otherwise this would only test the fallback to OpenSSL
+    QVERIFY(m_socket->isKernelEncrypted());
+
+    QTemporaryFile file;
+    QVERIFY(file.open());
+    QByteArray content(4 * 1024 * 1024, Qt::Uninitialized);
+    for (int i = 0; i < content.size(); i++) {
+        content[i] = static_cast<char>(QRandomGenerator::global()->generate());
+    }
+    QCOMPARE(file.write(content), qint64(content.size()));
+    QVERIFY(file.flush());
+
+    //Start halfway, like a resumed transfer
+    const qint64 offset = 1000;
+    qint64 sent = offset;
+    QByteArray received;
+    QSignalSpy writable(m_socket, &KernelTlsSocket::writable);
+    while (received.size() < content.size() - offset) {
+        if (sent < content.size()) {
+            const qint64 chunk = m_socket->sendFile(file.handle(), sent, content.size() - sent);
+            QVERIFY(chunk >= 0);
+            sent += chunk;
+        }
+        if (m_clientSocket->bytesAvailable() == 0) {
+            QVERIFY(m_clientSocket->waitForReadyRead(5000));
+        }
+        received += m_clientSocket->readAll();
+    }
+    QCOMPARE(received, content.mid(offset));
+
+    //Anything written is sent before the connection is closed
+    QSignalSpy disconnected(m_clientSocket, &QAbstractSocket::disconnected);
+    m_socket->write("hash");
+    m_socket->disconnectFromHost();
+    QVERIFY(disconnected.wait());
+    QCOMPARE(m_clientSocket->readAll(), QByteArray("hash"));
+}
+
+void TestKernelTlsSocket::readAndWrite()
+{
+    QVERIFY(connectSockets());
+
+    QSignalSpy readyRead(m_socket, &QIODevice::readyRead);
+    m_clientSocket->write("12345678");
+    QVERIFY(readyRead.wait());
+    QCOMPARE(m_socket->bytesAvailable(), qint64(8));
+    QCOMPARE(m_socket->read(8), QByteArray("12345678"));
+
+    QCOMPARE(m_socket->write("reply"), qint64(5));
+    QVERIFY(m_clientSocket->waitForReadyRead(5000));
+    QCOMPARE(m_clientSocket->readAll(), QByteArray("reply"));
+
+    //The other side closing is noticed
+    QSignalSpy disconnected(m_socket, &KernelTlsSocket::disconnected);
+    m_clientSocket->disconnectFromHost();
+    QVERIFY(disconnected.wait());
+    QVERIFY(!m_socket->isOpen());
+}
+
+void TestKernelTlsSocket::wrongCertificate()
+{
+    //Some other device, with its own key
+    QCA::PrivateKey privateKey = QCA::KeyGenerator().createRSA(2048);
+    QCA::CertificateOptions certificateOptions;
+    QCA::CertificateInfo certificateInfo;
+    certificateInfo.insert(QCA::CommonName, QStringLiteral("someotherdevice"));
+    certificateOptions.setInfo(certificateInfo);
+    certificateOptions.setValidityPeriod(QDateTime::currentDateTime(), QDateTime::currentDateTime().addDays(1));
+    const QCA::Certificate certificate(certificateOptions, privateKey);
+    m_clientSocket->setLocalCertificate(QSslCertificate(certificate.toPEM().toLatin1()));
+    m_clientSocket->setPrivateKey(QSslKey(privateKey.toPEM().toLatin1(), QSsl::Rsa));
+
+    QSignalSpy error(m_socket, &KernelTlsSocket::errorOccurred);
+    m_clientSocket->startClientEncryption();
+    QVERIFY(error.wait());
+    QVERIFY(!m_socket->isOpen());
+}
+
+QTEST_GUILESS_MAIN(TestKernelTlsSocket)
+
+#include "testkerneltlssocket.moc"
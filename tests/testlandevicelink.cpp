@@ -0,0 +1,124 @@
+/**
+ * Copyright 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "../core/backends/lan/landevicelink.h"
+#include "../core/backends/lan/server.h"
+#include "../core/kdeconnectconfig.h"
+
+#include <QSslSocket>
+#include <QStandardPaths>
+#include <QTest>
+
+class TestLanDeviceLink : public QObject
+{
+    Q_OBJECT
+public:
+    TestLanDeviceLink()
+        : m_receivedInFirstTurn(-1)
+    {
+        QStandardPaths::setTestModeEnabled(true);
+    }
+
+public Q_SLOTS:
+    void packetReceived(const NetworkPacket& np);
+    void firstTurnEnded();
+
+private Q_SLOTS:
+    void receiveBudgetFromConfig();
+    void receiveStopsAtBudget();
+
+private:
+    QList<qint64> m_ids;
+    int m_receivedInFirstTurn;
+};
+
+void TestLanDeviceLink::packetReceived(const NetworkPacket& np)
+{
+    //Queued on the first packet, so it runs before the link continues with the rest
+    if (m_ids.isEmpty()) {
+        QMetaObject::invokeMethod(this, "firstTurnEnded", Qt::QueuedConnection);
+    }
+    m_ids.append(np.id().toLongLong());
+}
+
+void TestLanDeviceLink::firstTurnEnded()
+{
+    m_receivedInFirstTurn = m_ids.count();
+}
+
+void TestLanDeviceLink::receiveBudgetFromConfig()
+{
+    const QString deviceId = QStringLiteral("testdevice");
+
+    //The links take ownership of the sockets
+    KdeConnectConfig::instance()->setDeviceProperty(deviceId, QStringLiteral("receiveBudget"), QStringLiteral("3"));
+    LanDeviceLink link(deviceId, nullptr, new QSslSocket, LanDeviceLink::Remotely);
+    QCOMPARE(link.receiveBudget(), 3);
+
+    //Nonsense falls back to the default
+    KdeConnectConfig::instance()->setDeviceProperty(deviceId, QStringLiteral("receiveBudget"), QStringLiteral("-1"));
+    LanDeviceLink otherLink(deviceId, nullptr, new QSslSocket, LanDeviceLink::Remotely);
+    QCOMPARE(otherLink.receiveBudget(), DeviceLink::s_defaultReceiveBudget);
+
+    KdeConnectConfig::instance()->removeTrustedDevice(deviceId);
+}
+
+void TestLanDeviceLink::receiveStopsAtBudget()
+{
+    const int budget = 3;
+    const int packetCount = 10;
+
+    Server server;
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+    QSslSocket client;
+    client.connectToHost(QHostAddress::LocalHost, server.serverPort());
+    QVERIFY(client.waitForConnected());
+    QVERIFY(server.waitForNewConnection(5000));
+
+    QByteArray data;
+    for (int i = 0; i < packetCount; ++i) {
+        data += "{\"id\":" + QByteArray::number(i) + ",\"type\":\"kdeconnect.ping\",\"body\":{}}\n";
+    }
+    client.write(data);
+    QVERIFY(client.waitForBytesWritten());
+    //Let everything reach the other socket, so it is read in one go
+    QTest::qSleep(100);
+
+    QSslSocket* socket = server.nextPendingConnection();
+    QVERIFY(socket);
+    LanDeviceLink* link = new LanDeviceLink(QStringLiteral("testdevice"), nullptr, socket, LanDeviceLink::Remotely);
+    link->setReceiveBudget(budget);
+
+    m_ids.clear();
+    m_receivedInFirstTurn = -1;
+    connect(link, &DeviceLink::receivedPacket, this, &TestLanDeviceLink::packetReceived);
+
+    QTRY_COMPARE(m_ids.count(), packetCount);
+    QCOMPARE(m_receivedInFirstTurn, budget);
+    for (int i = 0; i < packetCount; ++i) {
+        QCOMPARE(m_ids[i], qint64(i));
+    }
+
+    delete link;
+}
+
+QTEST_GUILESS_MAIN(TestLanDeviceLink)
+
+#include "testlandevicelink.moc"
@@ -0,0 +1,125 @@
+/**
+ * Copyright 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "../core/backends/packetframer.h"
+
+#include <QBuffer>
+#include <QTest>
+#include <QtEndian>
+
+class TestPacketFramer : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void splitLines();
+    void splitLengthPrefixedPackets();
+    void refuseBigPackets();
+
+private:
+    static bool feed(PacketFramer& framer, const QByteArray& data);
+    static QList<QByteArray> takeAll(PacketFramer& framer);
+};
+
+bool TestPacketFramer::feed(PacketFramer& framer, const QByteArray& data)
+{
+    QByteArray copy(data);
+    QBuffer buffer(&copy);
+    buffer.open(QIODevice::ReadOnly);
+    return framer.readFrom(&buffer);
+}
+
+QList<QByteArray> TestPacketFramer::takeAll(PacketFramer& framer)
+{
+    QList<QByteArray> packets;
+    while (framer.packetCount() > 0) {
+        packets.append(framer.takePacket().toByteArray());
+    }
+    return packets;
+}
+
+void TestPacketFramer::splitLines()
+{
+    PacketFramer framer;
+
+    QVERIFY(feed(framer, "foobar\nbarf"));
+    QCOMPARE(takeAll(framer), QList<QByteArray>{"foobar\n"});
+
+    //Lines split across reads, and empty lines that should be skipped
+    QVERIFY(feed(framer, "oo\n\nfoo"));
+    QVERIFY(feed(framer, "bar?\n"));
+    QCOMPARE(takeAll(framer), (QList<QByteArray>{"barfoo\n", "foobar?\n"}));
+
+    //Packets that haven't been taken yet survive the next read
+    QVERIFY(feed(framer, "panda\n"));
+    QVERIFY(feed(framer, "koala\n"));
+    QCOMPARE(takeAll(framer), (QList<QByteArray>{"panda\n", "koala\n"}));
+    QCOMPARE(framer.packetCount(), 0);
+
+    //Copies outlive the buffer being compacted by the next read
+    QVERIFY(feed(framer, "first\nsec"));
+    const QByteArray first = framer.takePacket().toByteArray();
+    QVERIFY(feed(framer, "ond\n"));
+    QCOMPARE(first, QByteArray("first\n"));
+    QCOMPARE(takeAll(framer), QList<QByteArray>{"second\n"});
+}
+
+void TestPacketFramer::splitLengthPrefixedPackets()
+{
+    PacketFramer framer;
+    framer.setEncoding(NetworkPacket::CborEncoding);
+
+    QBuffer output;
+    output.open(QIODevice::WriteOnly);
+    PacketFramer::write(&output, "first\n", NetworkPacket::CborEncoding);
+    PacketFramer::write(&output, "second", NetworkPacket::CborEncoding);
+    const QByteArray data = output.data();
+    QCOMPARE(data.size(), 4 + 6 + 4 + 6);
+
+    QVERIFY(feed(framer, data.left(7)));
+    QCOMPARE(framer.packetCount(), 0);
+    QVERIFY(feed(framer, data.mid(7, 9)));
+    QCOMPARE(takeAll(framer), QList<QByteArray>{"first\n"});
+    QVERIFY(feed(framer, data.mid(16)));
+    QCOMPARE(takeAll(framer), QList<QByteArray>{"second"});
+}
+
+void TestPacketFramer::refuseBigPackets()
+{
+    PacketFramer framer;
+    framer.setEncoding(NetworkPacket::CborEncoding);
+    uchar header[4];
+    qToBigEndian<quint32>(PacketFramer::s_maxPacketLength + 1, header);
+    QVERIFY(!feed(framer, QByteArray(reinterpret_cast<const char*>(header), sizeof(header))));
+
+    //A line that never ends
+    PacketFramer lineFramer;
+    const QByteArray chunk(1024 * 1024, 'a');
+    bool ok = true;
+    for (int i = 0; ok && i <= PacketFramer::s_maxPacketLength / chunk.size(); ++i) {
+        ok = feed(lineFramer, chunk);
+    }
+    QVERIFY(!ok);
+}
+
+QTEST_GUILESS_MAIN(TestPacketFramer)
+
+#include "testpacketframer.moc"
@@ -0,0 +1,89 @@
+/**
+ * Copyright 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "../core/payloadhasher.h"
+
+#include <QBuffer>
+#include <QTest>
+
+class TestPayloadHasher : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void negotiate();
+    void verify_data();
+    void verify();
+};
+
+void TestPayloadHasher::negotiate()
+{
+    QCOMPARE(PayloadHasher::negotiateAlgorithm(PayloadHasher::supportedAlgorithms()), QStringLiteral("sha256"));
+    QCOMPARE(PayloadHasher::negotiateAlgorithm({QStringLiteral("md4"), QStringLiteral("sha256")}), QStringLiteral("sha256"));
+    QVERIFY(PayloadHasher::negotiateAlgorithm({}).isEmpty());
+}
+
+void TestPayloadHasher::verify_data()
+{
+    QTest::addColumn<QByteArray>("payload");
+    QTest::addColumn<QByteArray>("hash");
+    QTest::addColumn<bool>("matches");
+
+    const QByteArray payload(100000, 'k');
+    const QByteArray hash = QCryptographicHash::hash(payload, QCryptographicHash::Sha256);
+    QByteArray corrupted = payload;
+    corrupted[5000] = 'x';
+
+    QTest::newRow("valid") << payload << hash << true;
+    QTest::newRow("corrupted") << corrupted << hash << false;
+    QTest::newRow("no hash") << payload << QByteArray() << false;
+    QTest::newRow("empty") << QByteArray() << QCryptographicHash::hash(QByteArray(), QCryptographicHash::Sha256) << true;
+}
+
+void TestPayloadHasher::verify()
+{
+    QFETCH(QByteArray, payload);
+    QFETCH(QByteArray, hash);
+    QFETCH(bool, matches);
+
+    QBuffer* buffer = new QBuffer();
+    buffer->setData(payload + hash);
+    buffer->open(QIODevice::ReadOnly);
+
+    PayloadHasher hasher(QSharedPointer<QIODevice>(buffer), payload.size(), QStringLiteral("sha256"));
+    QCOMPARE(hasher.bytesAvailable(), qint64(payload.size()));
+
+    //Read in pieces, like a socket would be
+    QByteArray read;
+    while (!hasher.atEnd()) {
+        const QByteArray piece = hasher.read(4096);
+        QVERIFY(!piece.isEmpty());
+        read += piece;
+    }
+    QCOMPARE(read, payload);
+    QCOMPARE(hasher.read(1), QByteArray());
+
+    QCOMPARE(hasher.isHashReady(), !hash.isEmpty());
+    QCOMPARE(hasher.verify(), matches);
+}
+
+QTEST_GUILESS_MAIN(TestPayloadHasher)
+
+#include "testpayloadhasher.moc"
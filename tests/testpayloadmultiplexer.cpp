@@ -0,0 +1,130 @@
+/**
+ * Copyright 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "../core/backends/lan/payloadmultiplexer.h"
+#include "../core/backends/lan/socketlinereader.h"
+#include "../core/backends/lan/server.h"
+
+#include <QBuffer>
+#include <QEventLoop>
+#include <QSslSocket>
+#include <QTest>
+#include <QTimer>
+
+class TestPayloadMultiplexer : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void multiplexPayloads();
+
+private:
+    void packetReceived();
+
+    QTimer m_timer;
+    QEventLoop m_loop;
+    Server* m_server;
+    QSslSocket* m_conn;
+    SocketLineReader* m_senderReader;
+    SocketLineReader* m_receiverReader;
+    PayloadMultiplexer* m_sender;
+    PayloadMultiplexer* m_receiver;
+    QList<QSharedPointer<QIODevice>> m_payloads;
+};
+
+void TestPayloadMultiplexer::initTestCase()
+{
+    m_server = new Server(this);
+    QVERIFY2(m_server->listen(QHostAddress::LocalHost, 8695), "Failed to create local tcp server");
+
+    m_timer.setInterval(4000);
+    m_timer.setSingleShot(true);
+    connect(&m_timer, &QTimer::timeout, &m_loop, &QEventLoop::quit);
+
+    m_conn = new QSslSocket(this);
+    m_conn->connectToHost(QHostAddress::LocalHost, 8695);
+    connect(m_conn, &QAbstractSocket::connected, &m_loop, &QEventLoop::quit);
+    m_timer.start();
+    m_loop.exec();
+    QVERIFY2(m_conn->isOpen(), "Could not connect to local tcp server");
+
+    QVERIFY(m_server->waitForNewConnection(4000));
+    QSslSocket* sock = m_server->nextPendingConnection();
+    QVERIFY2(sock != nullptr, "Could not open a connection to the client");
+
+    m_senderReader = new SocketLineReader(m_conn, this);
+    m_receiverReader = new SocketLineReader(sock, this);
+    connect(m_receiverReader, &SocketLineReader::readyRead, this, &TestPayloadMultiplexer::packetReceived);
+
+    m_sender = new PayloadMultiplexer(this);
+    m_sender->setSocketLineReader(m_senderReader);
+    m_receiver = new PayloadMultiplexer(this);
+    m_receiver->setSocketLineReader(m_receiverReader);
+}
+
+void TestPayloadMultiplexer::multiplexPayloads()
+{
+    //Small enough to not need encryptedBytesWritten to go on, we have no TLS here
+    const QList<QByteArray> payloads = {
+        QByteArray(40000, 'a'),
+        QByteArray(10000, 'b'),
+        QByteArray(),
+    };
+
+    for (const QByteArray& payload : payloads) {
+        NetworkPacket np(QStringLiteral("kdeconnect.test"));
+        QBuffer* buffer = new QBuffer();
+        buffer->setData(payload);
+        np.setPayload(QSharedPointer<QIODevice>(buffer), payload.size());
+        QVERIFY(PayloadMultiplexer::canMultiplex(np));
+        np.setPayloadTransferInfo(m_sender->sendPayload(np));
+        m_senderReader->write(np.serialize());
+    }
+
+    m_timer.start();
+    m_loop.exec();
+
+    QCOMPARE(m_payloads.size(), payloads.size());
+    for (int i = 0; i < payloads.size(); ++i) {
+        QCOMPARE(m_payloads[i]->readAll(), payloads[i]);
+        QVERIFY(m_payloads[i]->atEnd());
+    }
+}
+
+void TestPayloadMultiplexer::packetReceived()
+{
+    while (m_receiverReader->bytesAvailable() > 0) {
+        NetworkPacket np((QString()));
+        QVERIFY(NetworkPacket::unserialize(m_receiverReader->readLine(), &np));
+        if (!m_receiver->packetReceived(np)) {
+            QVERIFY(np.payloadTransferInfo().contains(QStringLiteral("channel")));
+            m_payloads.append(m_receiver->receivePayload(np));
+        }
+    }
+
+    if (m_payloads.size() == 3 && m_payloads[0]->bytesAvailable() == 40000 && m_payloads[1]->bytesAvailable() == 10000) {
+        m_loop.quit();
+    }
+}
+
+QTEST_GUILESS_MAIN(TestPayloadMultiplexer)
+
+#include "testpayloadmultiplexer.moc"
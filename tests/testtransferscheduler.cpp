@@ -0,0 +1,246 @@
+/**
+ * Copyright 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "../core/transferscheduler.h"
+
+#include <KJob>
+#include <QJsonObject>
+#include <QTest>
+
+class DummyJob : public KJob
+{
+    Q_OBJECT
+
+public:
+    void start() override {}
+    void finish() { emitResult(); }
+    void send(qulonglong bytes) { setProcessedAmount(Bytes, processedAmount(Bytes) + bytes); }
+};
+
+class TestTransferScheduler : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void init();
+    void maxActiveTransfers();
+    void fairSharing();
+    void groupLimit();
+    void deletedJobs();
+    void stalledTransfers();
+    void unreachableDevice();
+    void queue();
+
+private:
+    DummyJob* enqueue(const QString& deviceId, QObject* group, int groupLimit = 4);
+    QString state(const QString& deviceId) const;
+
+    QScopedPointer<TransferScheduler> m_scheduler;
+    QList<KJob*> m_allowed;
+};
+
+void TestTransferScheduler::init()
+{
+    m_allowed.clear();
+    //Devices served in a previous test would go last
+    m_scheduler.reset(new TransferScheduler());
+    connect(m_scheduler.data(), &TransferScheduler::transferAllowed, this, [this](KJob* job) { m_allowed.append(job); });
+}
+
+DummyJob* TestTransferScheduler::enqueue(const QString& deviceId, QObject* group, int groupLimit)
+{
+    DummyJob* job = new DummyJob();
+    m_scheduler->enqueue(job, deviceId, QStringLiteral("file"), 1024, group, groupLimit);
+    return job;
+}
+
+//Of the first transfer to the device in the queue
+QString TestTransferScheduler::state(const QString& deviceId) const
+{
+    for (const QJsonValue& transfer : m_scheduler->queue()) {
+        if (transfer.toObject().value(QStringLiteral("deviceId")).toString() == deviceId) {
+            return transfer.toObject().value(QStringLiteral("state")).toString();
+        }
+    }
+    return QString();
+}
+
+void TestTransferScheduler::maxActiveTransfers()
+{
+    QObject group;
+    m_scheduler->setMaxActiveTransfers(2);
+    DummyJob* first = enqueue(QStringLiteral("a"), &group);
+    DummyJob* second = enqueue(QStringLiteral("a"), &group);
+    DummyJob* third = enqueue(QStringLiteral("a"), &group);
+
+    //Nothing starts before getting back to the event loop
+    QVERIFY(m_allowed.isEmpty());
+    QTRY_COMPARE(m_allowed.size(), 2);
+    QCOMPARE(m_allowed, (QList<KJob*>{first, second}));
+    QCOMPARE(m_scheduler->activeTransfers(), 2);
+    QCOMPARE(m_scheduler->pendingTransfers(), 1);
+
+    first->finish();
+    QTRY_COMPARE(m_allowed.size(), 3);
+    QCOMPARE(m_allowed.last(), third);
+
+    second->finish();
+    third->finish();
+    QCOMPARE(m_scheduler->activeTransfers(), 0);
+    QCOMPARE(m_scheduler->pendingTransfers(), 0);
+}
+
+void TestTransferScheduler::fairSharing()
+{
+    QObject groupA, groupB;
+    m_scheduler->setMaxActiveTransfers(1);
+    DummyJob* a1 = enqueue(QStringLiteral("a"), &groupA);
+    DummyJob* a2 = enqueue(QStringLiteral("a"), &groupA);
+    DummyJob* a3 = enqueue(QStringLiteral("a"), &groupA);
+    DummyJob* b1 = enqueue(QStringLiteral("b"), &groupB);
+    DummyJob* b2 = enqueue(QStringLiteral("b"), &groupB);
+
+    //The devices take turns, although "a" queued its files first
+    QList<KJob*> order;
+    for (DummyJob* expected : {a1, b1, a2, b2, a3}) {
+        QTRY_COMPARE(m_allowed.size(), order.size() + 1);
+        QCOMPARE(m_allowed.last(), expected);
+        order.append(expected);
+        expected->finish();
+    }
+    QTest::qWait(50);
+    QCOMPARE(m_allowed, order);
+}
+
+void TestTransferScheduler::groupLimit()
+{
+    QObject groupA, groupB;
+    DummyJob* a1 = enqueue(QStringLiteral("a"), &groupA, 1);
+    DummyJob* a2 = enqueue(QStringLiteral("a"), &groupA, 1);
+    DummyJob* b1 = enqueue(QStringLiteral("b"), &groupB, 1);
+
+    QTRY_COMPARE(m_allowed.size(), 2);
+    QCOMPARE(m_allowed, (QList<KJob*>{a1, b1}));
+
+    //Slots are left, but the group is full
+    QTest::qWait(50);
+    QCOMPARE(m_allowed.size(), 2);
+
+    a1->finish();
+    QTRY_COMPARE(m_allowed.size(), 3);
+    QCOMPARE(m_allowed.last(), a2);
+
+    a2->finish();
+    b1->finish();
+}
+
+void TestTransferScheduler::deletedJobs()
+{
+    QObject group;
+    m_scheduler->setMaxActiveTransfers(1);
+    DummyJob* first = enqueue(QStringLiteral("a"), &group);
+    DummyJob* pending = enqueue(QStringLiteral("a"), &group);
+    DummyJob* last = enqueue(QStringLiteral("a"), &group);
+
+    QTRY_COMPARE(m_allowed.size(), 1);
+
+    //Without ever finishing, as subjobs of a killed CompositeUploadJob
+    delete pending;
+    QCOMPARE(m_scheduler->pendingTransfers(), 1);
+    delete first;
+
+    QTRY_COMPARE(m_allowed.size(), 2);
+    QCOMPARE(m_allowed.last(), last);
+    last->finish();
+}
+
+void TestTransferScheduler::stalledTransfers()
+{
+    QObject groupA, groupB;
+    m_scheduler->setMaxActiveTransfers(1);
+    m_scheduler->setStallTimeout(100);
+    DummyJob* a1 = enqueue(QStringLiteral("a"), &groupA, 1);
+    DummyJob* a2 = enqueue(QStringLiteral("a"), &groupA, 1);
+    DummyJob* b1 = enqueue(QStringLiteral("b"), &groupB);
+    QTRY_COMPARE(m_allowed.size(), 1);
+
+    //a1 never sends anything, b1 gets its slot but a2 still waits for a1
+    QTRY_COMPARE(m_allowed.size(), 2);
+    QCOMPARE(m_allowed.last(), b1);
+    QCOMPARE(state(QStringLiteral("a")), QStringLiteral("stalled"));
+    QCOMPARE(m_scheduler->pendingTransfers(), 1);
+
+    //Once data flows again it takes a slot back, even above the limit
+    a1->send(1024);
+    QTRY_COMPARE(state(QStringLiteral("a")), QStringLiteral("active"));
+    b1->finish();
+    a1->finish();
+    QTRY_COMPARE(m_allowed.size(), 3);
+    QCOMPARE(m_allowed.last(), a2);
+    a2->finish();
+}
+
+void TestTransferScheduler::unreachableDevice()
+{
+    QObject groupA, groupB;
+    m_scheduler->setMaxActiveTransfers(1);
+    DummyJob* a1 = enqueue(QStringLiteral("a"), &groupA);
+    DummyJob* b1 = enqueue(QStringLiteral("b"), &groupB);
+    QTRY_COMPARE(m_allowed.size(), 1);
+
+    //Without waiting for the stall timeout
+    m_scheduler->deviceUnreachable(QStringLiteral("a"));
+    QTRY_COMPARE(m_allowed.size(), 2);
+    QCOMPARE(m_allowed.last(), b1);
+    QCOMPARE(state(QStringLiteral("a")), QStringLiteral("stalled"));
+
+    a1->finish();
+    b1->finish();
+}
+
+void TestTransferScheduler::queue()
+{
+    QObject group;
+    m_scheduler->setMaxActiveTransfers(1);
+    DummyJob* active = enqueue(QStringLiteral("a"), &group);
+    DummyJob* pending = enqueue(QStringLiteral("b"), &group);
+    QTRY_COMPARE(m_allowed.size(), 1);
+
+    const QJsonArray queue = m_scheduler->queue();
+    QCOMPARE(queue.size(), 2);
+    const QJsonObject first = queue[0].toObject();
+    QCOMPARE(first.value(QStringLiteral("deviceId")).toString(), QStringLiteral("a"));
+    QCOMPARE(first.value(QStringLiteral("state")).toString(), QStringLiteral("active"));
+    QCOMPARE(first.value(QStringLiteral("size")).toInt(), 1024);
+    const QJsonObject second = queue[1].toObject();
+    QCOMPARE(second.value(QStringLiteral("deviceId")).toString(), QStringLiteral("b"));
+    QCOMPARE(second.value(QStringLiteral("state")).toString(), QStringLiteral("pending"));
+
+    //b gets the only slot once a is done
+    active->finish();
+    QTRY_COMPARE(m_allowed.size(), 2);
+    QCOMPARE(m_scheduler->queue().size(), 1);
+    pending->finish();
+    QVERIFY(m_scheduler->queue().isEmpty());
+}
+
+QTEST_GUILESS_MAIN(TestTransferScheduler)
+
+#include "testtransferscheduler.moc"
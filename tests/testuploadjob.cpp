@@ -0,0 +1,241 @@
+/**
+ * Copyright 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "../core/backends/lan/lanlinkprovider.h"
+#include "../core/backends/lan/server.h"
+#include "../core/backends/lan/uploadjob.h"
+#include "../core/kdeconnectconfig.h"
+
+#include <QBuffer>
+#include <QSignalSpy>
+#include <QSslSocket>
+#include <QStandardPaths>
+#include <QTemporaryFile>
+#include <QTest>
+#include <QTimer>
+
+class TestUploadJob : public QObject
+{
+    Q_OBJECT
+public:
+    TestUploadJob()
+    {
+        QStandardPaths::setTestModeEnabled(true);
+    }
+
+private Q_SLOTS:
+    void initTestCase();
+    void cleanupTestCase();
+    void sendWholePayload_data();
+    void sendWholePayload();
+    void fileTruncatedWhileSending();
+
+private:
+    //A payload connection over loopback, encrypted once startEncryption() is called
+    void connectSockets(Server& server, QSslSocket& client, QSslSocket*& socket);
+    void startEncryption(QSslSocket* socket, QSslSocket& client);
+    static QByteArray randomData(int size);
+
+    QString m_deviceId;
+};
+
+void TestUploadJob::initTestCase()
+{
+    //We connect to ourselves, with our own certificate
+    KdeConnectConfig* config = KdeConnectConfig::instance();
+    m_deviceId = config->deviceId();
+    config->addTrustedDevice(m_deviceId, QStringLiteral("testdevice"), config->deviceType());
+    config->setDeviceProperty(m_deviceId, QStringLiteral("certificate"), QString::fromLatin1(config->certificate().toPem()));
+}
+
+void TestUploadJob::cleanupTestCase()
+{
+    KdeConnectConfig::instance()->removeTrustedDevice(m_deviceId);
+}
+
+void TestUploadJob::connectSockets(Server& server, QSslSocket& client, QSslSocket*& socket)
+{
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+    QSignalSpy newConnection(&server, &QTcpServer::newConnection);
+    client.connectToHost(QHostAddress::LocalHost, server.serverPort());
+    QVERIFY(newConnection.wait());
+    socket = server.nextPendingConnection();
+    QVERIFY(socket);
+    LanLinkProvider::configureSslSocket(socket, m_deviceId, true);
+    LanLinkProvider::configureSslSocket(&client, m_deviceId, true);
+}
+
+void TestUploadJob::startEncryption(QSslSocket* socket, QSslSocket& client)
+{
+    QSignalSpy encrypted(&client, &QSslSocket::encrypted);
+    socket->startServerEncryption();
+    client.startClientEncryption();
+    QVERIFY(encrypted.wait());
+}
+
+QByteArray TestUploadJob::randomData(int size)
+{
+    //Random, so anything out of place shows
+    QByteArray data(size, Qt::Uninitialized);
+    for (int i = 0; i < size; ++i) {
+        data[i] = static_cast<char>(qrand());
+    }
+    return data;
+}
+
+void TestUploadJob::sendWholePayload_data()
+{
+    QTest::addColumn<bool>("fromFile");
+
+    //Files are read with the kernel's read-ahead, anything else as it comes
+    QTest::newRow("file") << true;
+    QTest::newRow("buffer") << false;
+}
+
+void TestUploadJob::sendWholePayload()
+{
+    QFETCH(bool, fromFile);
+
+    //Several times what the job keeps in the socket
+    const QByteArray content = randomData(8 * 1024 * 1024);
+
+    QTemporaryFile file;
+    QSharedPointer<QIODevice> payload;
+    if (fromFile) {
+        QVERIFY(file.open());
+        QCOMPARE(file.write(content), qint64(content.size()));
+        file.close();
+        payload.reset(new QFile(file.fileName()));
+    } else {
+        QBuffer* buffer = new QBuffer();
+        buffer->setData(content);
+        payload.reset(buffer);
+    }
+    NetworkPacket np(QStringLiteral("kdeconnect.share.request"));
+    np.setPayload(payload, content.size());
+
+    Server server;
+    QSslSocket client;
+    QSslSocket* socket = nullptr;
+    connectSockets(server, client, socket);
+    if (QTest::currentTestFailed()) {
+        return;
+    }
+
+    //The job deletes itself once it's done, the socket has to outlive it until everything is sent
+    UploadJob* job = new UploadJob(np);
+    job->setSocket(socket);
+    connect(socket, &QSslSocket::encrypted, job, &UploadJob::start);
+    int error = -1;
+    qint64 chunkSize = 0;
+    connect(job, &KJob::result, this, [job, &error, &chunkSize]() {
+        error = job->error();
+        chunkSize = job->chunkSize();
+    });
+
+    //The most the socket held, it is refilled before it runs dry but never beyond the high watermark
+    qint64 maxPending = 0;
+    const QMetaObject::Connection pendingConnection = connect(socket, &QSslSocket::encryptedBytesWritten, this, [socket, &maxPending]() {
+        maxPending = qMax(maxPending, socket->bytesToWrite() + socket->encryptedBytesToWrite());
+    });
+
+    //Read slowly, so most of the payload is still on our side when the last chunk is queued
+    const qint64 readSize = 128 * 1024;
+    client.setReadBufferSize(readSize);
+    QByteArray received;
+    QTimer reader;
+    connect(&reader, &QTimer::timeout, this, [&client, &received, readSize]() {
+        received += client.read(readSize);
+    });
+    reader.start(10);
+
+    startEncryption(socket, client);
+    if (QTest::currentTestFailed()) {
+        return;
+    }
+
+    QTRY_COMPARE_WITH_TIMEOUT(received.size(), content.size(), 30000);
+    QTRY_COMPARE(error, 0);
+    //Not QCOMPARE, it would print all of it
+    QVERIFY(received == content);
+    disconnect(pendingConnection);
+
+    //Four chunks of at most 1 MiB, plus the one that crossed the watermark and the TLS records around them
+    QVERIFY(maxPending > readSize);
+    QVERIFY(maxPending <= 5 * 1024 * 1024 + 64 * 1024);
+
+    //Bigger than the first chunk, the reader takes ~12 MB/s
+    QVERIFY(chunkSize > 16 * 1024);
+    QVERIFY(chunkSize <= 1024 * 1024);
+}
+
+void TestUploadJob::fileTruncatedWhileSending()
+{
+    //Editors save by truncating and rewriting the file, which must only fail the upload
+    QTemporaryFile file;
+    QVERIFY(file.open());
+    const QByteArray content = randomData(32 * 1024 * 1024);
+    QCOMPARE(file.write(content), qint64(content.size()));
+    QVERIFY(file.flush());
+
+    NetworkPacket np(QStringLiteral("kdeconnect.share.request"));
+    np.setPayload(QSharedPointer<QIODevice>(new QFile(file.fileName())), content.size());
+
+    Server server;
+    QSslSocket client;
+    QSslSocket* socket = nullptr;
+    connectSockets(server, client, socket);
+    if (QTest::currentTestFailed()) {
+        return;
+    }
+
+    UploadJob* job = new UploadJob(np);
+    job->setSocket(socket);
+    connect(socket, &QSslSocket::encrypted, job, &UploadJob::start);
+    int error = -1;
+    connect(job, &KJob::result, this, [job, &error]() {
+        error = job->error();
+    });
+
+    //Slow enough that most of the file is still to be read when it shrinks
+    const qint64 readSize = 128 * 1024;
+    client.setReadBufferSize(readSize);
+    qint64 received = 0;
+    QTimer reader;
+    connect(&reader, &QTimer::timeout, this, [&client, &received, &file, readSize]() {
+        received += client.read(readSize).size();
+        if (received > 0 && file.size() > readSize) {
+            file.resize(readSize);
+        }
+    });
+    reader.start(10);
+
+    startEncryption(socket, client);
+    if (QTest::currentTestFailed()) {
+        return;
+    }
+
+    QTRY_VERIFY_WITH_TIMEOUT(error > 0, 30000);
+    QVERIFY(received < content.size());
+}
+
+QTEST_GUILESS_MAIN(TestUploadJob)
+
+#include "testuploadjob.moc"